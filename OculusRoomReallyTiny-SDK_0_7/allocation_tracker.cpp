@@ -0,0 +1,31 @@
+// Global operator new and delete replacements counting heap allocations per thread, see
+// AllocationTracker. Every replaceable allocation form is covered so none bypass the counts.
+
+#include <cstdlib>
+#include <new>
+
+#include "core.h"
+
+thread_local size_t AllocationTracker::Count = 0;
+thread_local size_t AllocationTracker::Bytes = 0;
+
+static void* CountedMalloc(size_t bytes) {
+    ++AllocationTracker::Count;
+    AllocationTracker::Bytes += bytes;
+    return malloc(bytes ? bytes : 1);
+}
+
+void* operator new(size_t bytes) {
+    if (auto p = CountedMalloc(bytes)) return p;
+    throw std::bad_alloc{};
+}
+void* operator new[](size_t bytes) { return operator new(bytes); }
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept { return CountedMalloc(bytes); }
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept { return CountedMalloc(bytes); }
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
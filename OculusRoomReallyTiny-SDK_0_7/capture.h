@@ -0,0 +1,263 @@
+// PNG encoding and the CPU side of asynchronous frame capture, independent of the graphics API
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "core.h"
+
+// CRC-32 as used by PNG chunks
+inline uint32_t Crc32(const unsigned char* data, size_t bytes) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> res;
+        for (auto n = 0u; n < 256; ++n) {
+            auto c = n;
+            for (auto k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            res[n] = c;
+        }
+        return res;
+    }();
+    auto crc = ~0u;
+    while (bytes--) crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// 8 bit RGB PNG of 0x00RRGGBB pixels. Rows use the Sub filter and the zlib stream is a single fixed
+// Huffman block with a one probe LZ77 match search, favouring encode speed over size.
+inline std::vector<unsigned char> EncodePng(const std::vector<uint32_t>& pixels, int w, int h) {
+    std::vector<unsigned char> raw;
+    raw.reserve(size_t(h) * (1 + 3 * size_t(w)));
+    for (auto y = 0; y < h; ++y) {
+        raw.push_back(1);  // Sub filter: each byte less the same channel of the pixel to its left
+        auto left = uint32_t{0};
+        for (auto x = 0; x < w; ++x) {
+            const auto p = pixels[size_t(y) * w + x];
+            for (auto shift : {16, 8, 0})
+                raw.push_back(static_cast<unsigned char>((p >> shift) - (left >> shift)));
+            left = p;
+        }
+    }
+
+    std::vector<unsigned char> z = {0x78, 0x01};
+    auto bits = 0u;
+    auto count = 0;
+    auto put = [&z, &bits, &count](unsigned value, int n) {  // Deflate packs bits LSB first
+        bits |= value << count;
+        for (count += n; count >= 8; count -= 8, bits >>= 8)
+            z.push_back(static_cast<unsigned char>(bits));
+    };
+    // Huffman codes go MSB first so are stored bit reversed, with their lengths
+    static const auto codes = [] {
+        auto reverse = [](unsigned value, int n) {
+            auto res = 0u;
+            for (auto i = 0; i < n; ++i) res |= ((value >> i) & 1) << (n - 1 - i);
+            return res;
+        };
+        std::array<std::pair<unsigned, int>, 288 + 30> res;
+        for (auto sym = 0u; sym < 288; ++sym)
+            res[sym] = sym < 144   ? std::make_pair(reverse(0x30 + sym, 8), 8)
+                       : sym < 256 ? std::make_pair(reverse(0x190 + sym - 144, 9), 9)
+                       : sym < 280 ? std::make_pair(reverse(sym - 256, 7), 7)
+                                   : std::make_pair(reverse(0xc0 + sym - 280, 8), 8);
+        for (auto d = 0u; d < 30; ++d) res[288 + d] = std::make_pair(reverse(d, 5), 5);
+        return res;
+    }();
+    auto symbol = [&put](unsigned sym) { put(codes[sym].first, codes[sym].second); };
+    static const unsigned lengthBase[] = {3,  4,  5,  6,  7,  8,  9,  10,  11,  13,
+                                          15, 17, 19, 23, 27, 31, 35, 43,  51,  59,
+                                          67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int lengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                      2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const unsigned distanceBase[] = {1,    2,    3,    4,    5,    7,     9,     13,
+                                            17,   25,   33,   49,   65,   97,    129,   193,
+                                            257,  385,  513,  769,  1025, 1537,  2049,  3073,
+                                            4097, 6145, 8193, 12289, 16385, 24577};
+    put(1, 1);  // Final block
+    put(1, 2);  // Fixed Huffman codes
+    std::vector<size_t> head(size_t{1} << 15, ~size_t{0});
+    for (auto i = size_t{0}; i < raw.size();) {
+        auto length = size_t{0}, distance = size_t{0};
+        if (i + 3 <= raw.size()) {
+            const auto key = uint32_t(raw[i]) << 16 | uint32_t(raw[i + 1]) << 8 | raw[i + 2];
+            const auto hash = (key * 2654435761u) >> 17;
+            const auto candidate = head[hash];
+            head[hash] = i;
+            if (candidate != ~size_t{0} && i - candidate <= 32768) {
+                const auto limit = std::min<size_t>(258, raw.size() - i);
+                while (length < limit && raw[candidate + length] == raw[i + length]) ++length;
+                distance = i - candidate;
+            }
+        }
+        if (length < 3) {
+            symbol(raw[i++]);
+            continue;
+        }
+        auto l = 28;
+        while (lengthBase[l] > length) --l;
+        symbol(257u + unsigned(l));
+        put(unsigned(length) - lengthBase[l], lengthExtra[l]);
+        auto d = 29;
+        while (distanceBase[d] > distance) --d;
+        symbol(288u + unsigned(d));
+        put(unsigned(distance) - distanceBase[d], std::max(0, d / 2 - 1));
+        i += length;
+    }
+    symbol(256);
+    if (count) z.push_back(static_cast<unsigned char>(bits));
+    auto a = 1u, b = 0u;
+    for (auto i = size_t{0}; i < raw.size();) {  // Adler-32, reduced every 5552 bytes
+        for (const auto end = std::min(raw.size(), i + 5552); i < end; ++i) b += a += raw[i];
+        a %= 65521;
+        b %= 65521;
+    }
+
+    std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    auto be32 = [](std::vector<unsigned char>& out, size_t value) {
+        for (auto shift : {24, 16, 8, 0}) out.push_back(static_cast<unsigned char>(value >> shift));
+    };
+    be32(z, (b << 16) | a);
+    auto chunk = [&png, &be32](const char* type, const std::vector<unsigned char>& data) {
+        be32(png, data.size());
+        const auto start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        be32(png, Crc32(png.data() + start, png.size() - start));
+    };
+    auto header = std::vector<unsigned char>{};
+    be32(header, size_t(w));
+    be32(header, size_t(h));
+    header.insert(header.end(), {8, 2, 0, 0, 0});  // 8 bit RGB, no interlace
+    chunk("IHDR", header);
+    chunk("IDAT", z);
+    chunk("IEND", {});
+    return png;
+}
+
+inline bool WritePng(const char* path, const std::vector<uint32_t>& pixels, int w, int h) {
+#ifdef _WIN32
+    FILE* file = nullptr;
+    if (fopen_s(&file, path, "wb") != 0 || !file) return false;
+#else
+    const auto file = fopen(path, "wb");
+    if (!file) return false;
+#endif
+    const auto png = EncodePng(pixels, w, h);
+    const auto ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+    return fclose(file) == 0 && ok;
+}
+
+// CPU side of asynchronous frame capture. Captures go through a fixed ring of slots in order: Issue
+// claims the next slot, the caller fills its pixels once they can be read without waiting, and
+// Retire hands it to the worker threads, which encode and write the PNG then free the slot. When
+// the next slot is still busy the capture is dropped rather than waited for. Captures issued with
+// an empty path are encoded into the slot's Png instead of a file, for benchmarks and tests.
+struct CaptureQueue {
+    struct Slot {
+        std::atomic<bool> Busy{false};  // From Issue until the PNG is written
+        unsigned Frame = 0;
+        int W = 0, H = 0;
+        char Path[64] = {};
+        std::vector<uint32_t> Pixels;  // R8G8B8A8 as read back, swizzled by the worker
+        std::vector<unsigned char> Png;  // The encoding of a capture with no path
+    };
+    std::unique_ptr<Slot[]> Slots;
+    const unsigned Count, Latency;
+    unsigned Issued = 0, Retired = 0;  // Frame thread only
+    size_t Dropped = 0;
+    std::mutex Lock;
+    std::condition_variable Wake;
+    unsigned Queued = 0, Taken = 0;  // Slots retired and slots taken by a worker, under Lock
+    bool Running = true;
+    size_t Written = 0, Failed = 0;  // PNGs written to a file or memory, files that failed
+    double EncodeSeconds = 0.0;
+    std::vector<std::thread> Workers;
+
+    // Pixel buffers are reserved up front so the frame thread never allocates
+    CaptureQueue(unsigned count, size_t maxPixels, unsigned latency, unsigned workers)
+        : Slots{new Slot[count]}, Count{count}, Latency{latency} {
+        for (auto i = 0u; i < count; ++i) Slots[i].Pixels.reserve(maxPixels);
+        for (auto i = 0u; i < workers; ++i) Workers.emplace_back([this] { Work(); });
+    }
+
+    // Retired captures are still written, ones waiting for their pixels are lost
+    ~CaptureQueue() {
+        {
+            std::lock_guard<std::mutex> lock{Lock};
+            Running = false;
+        }
+        Wake.notify_all();
+        for (auto& worker : Workers) worker.join();
+    }
+
+    // Claim a slot for a w x h capture of frame to be written to path, or kept in memory if it is
+    // empty, -1 if it is dropped
+    int Issue(unsigned frame, int w, int h, const char* path) {
+        auto& slot = Slots[Issued % Count];
+        if (slot.Busy.load(std::memory_order_acquire) ||
+            size_t(w) * h > slot.Pixels.capacity()) {
+            ++Dropped;
+            return -1;
+        }
+        slot.Busy.store(true, std::memory_order_relaxed);
+        slot.Frame = frame;
+        slot.W = w;
+        slot.H = h;
+        snprintf(slot.Path, sizeof(slot.Path), "%s", path);
+        return int(Issued++ % Count);
+    }
+
+    // The oldest slot waiting for its pixels if it was issued at least Latency frames ago, else -1
+    int Oldest(unsigned frame) const {
+        if (Retired == Issued) return -1;
+        const auto index = Retired % Count;
+        return frame - Slots[index].Frame >= Latency ? int(index) : -1;
+    }
+
+    // The oldest slot has its pixels, queue it for encoding
+    void Retire() {
+        ++Retired;
+        {
+            std::lock_guard<std::mutex> lock{Lock};
+            ++Queued;
+        }
+        Wake.notify_one();
+    }
+
+    void Work() {
+        for (;;) {
+            std::unique_lock<std::mutex> lock{Lock};
+            Wake.wait(lock, [this] { return Queued != Taken || !Running; });
+            if (Queued == Taken) return;
+            auto& slot = Slots[Taken++ % Count];
+            lock.unlock();
+            const auto start = CpuSeconds();
+            for (auto& p : slot.Pixels) p = (p & 0xff) << 16 | (p & 0xff00) | ((p >> 16) & 0xff);
+            auto ok = true;
+            if (*slot.Path)
+                ok = WritePng(slot.Path, slot.Pixels, slot.W, slot.H);
+            else
+                slot.Png = EncodePng(slot.Pixels, slot.W, slot.H);
+            lock.lock();
+            ++(ok ? Written : Failed);
+            EncodeSeconds += CpuSeconds() - start;
+            lock.unlock();
+            slot.Busy.store(false, std::memory_order_release);
+        }
+    }
+
+    void Report() {
+        std::lock_guard<std::mutex> lock{Lock};
+        if (Written + Failed)
+            LOG_INFO("Capture encoding: %zu written, %zu failed, %zu dropped, %.1fms per PNG\n",
+                     Written, Failed, Dropped, 1000.0 * EncodeSeconds / double(Written + Failed));
+    }
+};
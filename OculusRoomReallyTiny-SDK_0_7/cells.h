@@ -0,0 +1,166 @@
+// Portal and cell visibility for interiors, independent of the graphics API
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "geometry.h"
+#include "vectors.h"
+
+// Interior visibility from the scene description: convex cells (axis aligned boxes of open space)
+// joined by rectangular portals (doorways and other openings) in axis planes. Each eye walks the
+// graph from the cell containing it, narrowing a tangent space rectangle through every portal it
+// looks through, and only meshes overlapping a reached cell are drawn.
+struct CellGraph {
+    struct Cell {
+        Float3 Min, Max;
+        std::vector<unsigned> Portals;
+    };
+    // A rectangle flat along Axis, Min and Max are equal on that axis
+    struct Portal {
+        unsigned Cells[2];
+        int Axis;
+        Float3 Min, Max;
+    };
+    // Bounds of x / -z and y / -z in view space
+    struct Rect {
+        float MinX, MaxX, MinY, MaxY;
+        bool Empty() const { return MinX >= MaxX || MinY >= MaxY; }
+        bool Contains(const Rect& r) const {
+            return r.MinX >= MinX && r.MaxX <= MaxX && r.MinY >= MinY && r.MaxY <= MaxY;
+        }
+        float Area() const { return Empty() ? 0.0f : (MaxX - MinX) * (MaxY - MinY); }
+    };
+
+    std::vector<Cell> Cells;
+    std::vector<Portal> Portals;
+    std::vector<std::vector<unsigned>> MeshCells;  // Cells each mesh overlaps, empty for dynamic
+    std::vector<bool> VisibleCells;
+    std::vector<Rect> Widest;  // Widest rect each cell was entered with by the last traversal
+    size_t CellsVisited = 0;
+
+    unsigned AddCell(Float3 min, Float3 max) {
+        Cells.push_back({min, max, {}});
+        return unsigned(Cells.size() - 1);
+    }
+
+    void AddPortal(unsigned a, unsigned b, Float3 min, Float3 max) {
+        const auto axis = min.x == max.x ? 0 : min.y == max.y ? 1 : 2;
+        Portals.push_back({{a, b}, axis, min, max});
+        Cells[a].Portals.push_back(unsigned(Portals.size() - 1));
+        Cells[b].Portals.push_back(unsigned(Portals.size() - 1));
+    }
+
+    // The cell containing a point, -1 if it is outside every cell (e.g. inside a wall)
+    int Locate(const Float3& p) const {
+        for (auto c = size_t{0}; c < Cells.size(); ++c) {
+            const auto& cell = Cells[c];
+            if (p.x >= cell.Min.x && p.x <= cell.Max.x && p.y >= cell.Min.y &&
+                p.y <= cell.Max.y && p.z >= cell.Min.z && p.z <= cell.Max.z)
+                return int(c);
+        }
+        return -1;
+    }
+
+    // Record the cells each mesh overlaps, call once the scene meshes are final
+    void AssignMeshes(const std::vector<MeshDesc>& meshes) {
+        MeshCells.assign(meshes.size(), {});
+        VisibleCells.assign(Cells.size(), false);
+        Widest.assign(Cells.size(), Rect{0.0f, 0.0f, 0.0f, 0.0f});
+        for (auto m = size_t{0}; m < meshes.size(); ++m) {
+            const auto& mesh = meshes[m];
+            if (mesh.Dynamic || mesh.Mesh.Vertices.empty()) continue;
+            auto mn = Float3{FLT_MAX, FLT_MAX, FLT_MAX}, mx = Float3{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (const auto& v : mesh.Mesh.Vertices) {
+                const auto p = Add(v.Pos, mesh.Pos);
+                mn = {std::min(mn.x, p.x), std::min(mn.y, p.y), std::min(mn.z, p.z)};
+                mx = {std::max(mx.x, p.x), std::max(mx.y, p.y), std::max(mx.z, p.z)};
+            }
+            // Walls lie between cells, so overlap includes touching within the wall thickness
+            const auto slack = 0.15f;
+            for (auto c = 0u; c < Cells.size(); ++c) {
+                const auto& cell = Cells[c];
+                if (mn.x <= cell.Max.x + slack && mx.x >= cell.Min.x - slack &&
+                    mn.y <= cell.Max.y + slack && mx.y >= cell.Min.y - slack &&
+                    mn.z <= cell.Max.z + slack && mx.z >= cell.Min.z - slack)
+                    MeshCells[m].push_back(c);
+            }
+        }
+    }
+
+    // Mark the cells visible from an eye with an ovrFovPort or anything else with the same
+    // tangents. Outside every cell nothing can be culled and all cells are marked. Returns false
+    // in that case.
+    template <typename Fov>
+    bool Traverse(const Pose& eye, const Fov& fov) {
+        CellsVisited = 0;
+        const auto start = Locate(eye.Pos);
+        std::fill(begin(VisibleCells), end(VisibleCells), start < 0);
+        if (start < 0) return false;
+        Widest.assign(Cells.size(), Rect{0.0f, 0.0f, 0.0f, 0.0f});
+        Visit(unsigned(start), {-fov.LeftTan, fov.RightTan, -fov.DownTan, fov.UpTan}, eye, 0);
+        return true;
+    }
+
+    // Everything seen through a rect is also seen through any rect containing it, so a portal is
+    // skipped when the rect through it fits in the widest one its far cell has been entered with.
+    // That walk has already covered it or will once the recursion unwinds, which keeps graphs with
+    // loops from being walked again for every path around them.
+    void Visit(unsigned c, const Rect& rect, const Pose& eye, int depth) {
+        VisibleCells[c] = true;
+        ++CellsVisited;
+        if (rect.Area() > Widest[c].Area()) Widest[c] = rect;
+        if (depth == 64) return;
+        auto component = [](const Float3& v, int axis) { return (&v.x)[axis]; };
+        for (auto p : Cells[c].Portals) {
+            const auto& portal = Portals[p];
+            const auto next = portal.Cells[portal.Cells[0] == c ? 1 : 0];
+            // Only look through a portal from the side of the current cell
+            const auto plane = component(portal.Min, portal.Axis);
+            const auto& cell = Cells[c];
+            const auto cellSide =
+                component(cell.Min, portal.Axis) + component(cell.Max, portal.Axis) - 2 * plane;
+            if ((component(eye.Pos, portal.Axis) - plane) * cellSide <= 0.0f) continue;
+
+            // Clip the portal to the near plane in view space and narrow to its tangent bounds
+            const auto a0 = (portal.Axis + 1) % 3, a1 = (portal.Axis + 2) % 3;
+            Float3 corners[4];
+            for (auto corner = 0; corner < 4; ++corner) {
+                auto p3 = portal.Min;
+                (&p3.x)[a0] = component(corner == 1 || corner == 2 ? portal.Max : portal.Min, a0);
+                (&p3.x)[a1] = component(corner >= 2 ? portal.Max : portal.Min, a1);
+                corners[corner] = ToView(eye, p3);
+            }
+            const auto nearZ = 0.01f;
+            auto bounds = Rect{FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX};
+            auto extend = [&bounds](float x, float y, float w) {
+                bounds = {std::min(bounds.MinX, x / w), std::max(bounds.MaxX, x / w),
+                          std::min(bounds.MinY, y / w), std::max(bounds.MaxY, y / w)};
+            };
+            for (auto corner = 0; corner < 4; ++corner) {
+                const auto& v = corners[corner];
+                const auto& w = corners[(corner + 1) % 4];
+                if (-v.z >= nearZ) extend(v.x, v.y, -v.z);
+                if ((-v.z >= nearZ) != (-w.z >= nearZ)) {
+                    const auto t = (-nearZ - v.z) / (w.z - v.z);
+                    extend(v.x + t * (w.x - v.x), v.y + t * (w.y - v.y), nearZ);
+                }
+            }
+            const auto narrowed =
+                Rect{std::max(rect.MinX, bounds.MinX), std::min(rect.MaxX, bounds.MaxX),
+                     std::max(rect.MinY, bounds.MinY), std::min(rect.MaxY, bounds.MaxY)};
+            if (!narrowed.Empty() && !Widest[next].Contains(narrowed))
+                Visit(next, narrowed, eye, depth + 1);
+        }
+    }
+
+    // Hide meshes that overlap no visible cell, dynamic meshes are left alone
+    void Cull(std::vector<bool>& visible) const {
+        for (auto m = size_t{0}; m < MeshCells.size(); ++m)
+            if (!MeshCells[m].empty() &&
+                std::none_of(begin(MeshCells[m]), end(MeshCells[m]),
+                             [this](unsigned c) { return VisibleCells[c]; }))
+                visible[m] = false;
+    }
+};
@@ -0,0 +1,384 @@
+// Timing, logging, hashing and fatal error checks shared by the app, its tools and the tests
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Wall clock seconds for CPU timings that must also work without LibOVR initialized
+inline double CpuSeconds() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(now).count();
+}
+
+// 64 bit FNV-1a hash of a block of bytes, pass the previous result as hash to continue it over
+// several blocks. For cache keys, not for security.
+inline unsigned long long Fnv1a(const void* data, size_t bytes,
+                                unsigned long long hash = 14695981039346656037ull) {
+    for (auto p = static_cast<const unsigned char*>(data); bytes--; ++p)
+        hash = (hash ^ *p) * 1099511628211ull;
+    return hash;
+}
+
+// fopen without the MSVC deprecation warning, nullptr on failure
+inline FILE* OpenFile(const char* path, const char* mode) {
+#ifdef _WIN32
+    FILE* file = nullptr;
+    return fopen_s(&file, path, mode) == 0 ? file : nullptr;
+#else
+    return fopen(path, mode);
+#endif
+}
+
+// Lock free ring for one producer thread and one consumer thread. Capacity must be a power of two.
+// Head is only written by the consumer and Tail only by the producer.
+template <typename T, size_t Capacity>
+struct SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    std::array<T, Capacity> Items;
+    std::atomic<size_t> Head{0}, Tail{0};
+
+    // False if the ring is full
+    bool Push(const T& item) {
+        const auto tail = Tail.load(std::memory_order_relaxed);
+        if (tail - Head.load(std::memory_order_acquire) == Capacity) return false;
+        Items[tail & (Capacity - 1)] = item;
+        Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // False if the ring is empty
+    bool Pop(T& item) {
+        const auto head = Head.load(std::memory_order_relaxed);
+        if (head == Tail.load(std::memory_order_acquire)) return false;
+        item = Items[head & (Capacity - 1)];
+        Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Operating system id of the calling thread, as debuggers show it
+inline unsigned long CurrentThreadId() {
+#ifdef _WIN32
+    return GetCurrentThreadId();
+#else
+    return static_cast<unsigned long>(syscall(SYS_gettid));
+#endif
+}
+
+// Text for the debugger output window, or stderr where there is none
+inline void DebugOutput(const char* text) {
+#ifdef _WIN32
+    OutputDebugStringA(text);
+#else
+    fputs(text, stderr);
+#endif
+}
+
+// Asynchronous logging. A log call packs its format string and arguments into a fixed size binary
+// record in the calling thread's own ring, and a background thread formats and writes the records
+// to the debugger output. String arguments are stored as pointers and must outlive the call, use
+// literals and other static strings. Levels below LOG_LEVEL compile to nothing.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1  // 0 debug, 1 info, 2 warning, 3 error
+#endif
+
+enum class LogLevel { Debug, Info, Warning, Error };
+
+struct LogRecord {
+    union Arg {
+        long long I;
+        unsigned long long U;
+        double F;
+        const void* P;
+    };
+    enum { MaxArgs = 12 };
+    double Time;
+    const char* Format;
+    LogLevel Level;
+    unsigned long Thread;
+    Arg Args[MaxArgs];
+};
+
+struct Logger {
+    using Ring = SpscRing<LogRecord, 1024>;
+    std::mutex Lock;  // Guards Rings and the consumer side of every ring
+    std::vector<std::unique_ptr<Ring>> Rings;
+    std::atomic<size_t> Dropped{0};  // Records lost to a full ring
+    std::atomic<bool> Running{true};
+    const double Start = CpuSeconds();
+    const bool Output;  // Off to format records without writing them, for benchmarks
+    std::thread Writer;
+
+    static Logger& Get() {
+        static Logger logger;
+        return logger;
+    }
+
+    explicit Logger(bool output = true) : Output{output}, Writer{[this] {
+        std::vector<LogRecord> batch;
+        while (Running) {
+            Drain(batch);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        Drain(batch);
+    }} {}
+
+    ~Logger() {
+        Running = false;
+        Writer.join();
+    }
+
+    static LogRecord::Arg Pack(double v) {
+        auto a = LogRecord::Arg{};
+        a.F = v;
+        return a;
+    }
+    static LogRecord::Arg Pack(const void* p) {
+        auto a = LogRecord::Arg{};
+        a.P = p;
+        return a;
+    }
+    template <typename T>
+    static std::enable_if_t<std::is_signed<T>::value && std::is_integral<T>::value,
+                            LogRecord::Arg>
+    Pack(T v) {
+        auto a = LogRecord::Arg{};
+        a.I = v;
+        return a;
+    }
+    template <typename T>
+    static std::enable_if_t<std::is_unsigned<T>::value, LogRecord::Arg> Pack(T v) {
+        auto a = LogRecord::Arg{};
+        a.U = v;
+        return a;
+    }
+
+    // The calling thread's ring, registered on its first log call. A thread writes to one logger.
+    Ring& ThreadRing() {
+        thread_local Ring* ring = nullptr;
+        if (!ring) {
+            std::lock_guard<std::mutex> lock{Lock};
+            Rings.push_back(std::make_unique<Ring>());
+            ring = Rings.back().get();
+        }
+        return *ring;
+    }
+
+    // No formatting, locking or allocation after a thread's first call
+    template <typename... Ts>
+    void Write(LogLevel level, const char* format, Ts... args) {
+        static_assert(sizeof...(Ts) <= LogRecord::MaxArgs, "Too many log arguments");
+        thread_local const auto thread = CurrentThreadId();
+        auto record = LogRecord{CpuSeconds() - Start, format, level, thread, {}};
+        const LogRecord::Arg packed[] = {Pack(args)..., {}};
+        std::copy(packed, packed + sizeof...(Ts), record.Args);
+        if (!ThreadRing().Push(record)) ++Dropped;
+    }
+
+    // Format and output everything queued so far, from any thread
+    void Flush() {
+        std::vector<LogRecord> batch;
+        Drain(batch);
+    }
+
+    // Log an error, flush and exit, for failures the app cannot continue from. On Windows the user
+    // is also shown the message, as the debugger output is usually not being watched.
+    [[noreturn]] void Fatal(const char* file, int line, const char* message) {
+        Write(LogLevel::Error, "%s(%d): %s\n", file, line, message);
+        Flush();
+#ifdef _WIN32
+        if (Output) MessageBoxA(nullptr, message, "OculusRoomTiny", MB_ICONERROR | MB_OK);
+#endif
+        exit(-1);
+    }
+
+    // Records are output in time order across threads within each batch
+    void Drain(std::vector<LogRecord>& batch) {
+        std::lock_guard<std::mutex> lock{Lock};
+        batch.clear();
+        for (auto& ring : Rings)
+            for (auto record = LogRecord{}; ring->Pop(record);) batch.push_back(record);
+        std::stable_sort(begin(batch), end(batch), [](const LogRecord& a, const LogRecord& b) {
+            return a.Time < b.Time;
+        });
+        for (const auto& record : batch) {
+            char buf[512];
+            Format(record, buf, sizeof(buf));
+            if (Output) DebugOutput(buf);
+        }
+        if (const auto dropped = Dropped.exchange(0)) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "Log: %zu records dropped\n", dropped);
+            if (Output) DebugOutput(buf);
+        }
+    }
+
+    // printf each conversion of the format with its argument, integers are stored widened to 64
+    // bits so length modifiers are replaced with ll
+    static void Format(const LogRecord& record, char* buf, size_t bytes) {
+        const char levels[] = {'D', 'I', 'W', 'E'};
+        auto out = snprintf(buf, bytes, "[%8.3f %c %5lu] ", record.Time,
+                            levels[int(record.Level)], static_cast<unsigned long>(record.Thread));
+        auto arg = record.Args;
+        for (auto f = record.Format; *f && out >= 0 && size_t(out) < bytes; ++f) {
+            if (*f != '%' || f[1] == '%') {
+                buf[out++] = *f;
+                f += *f == '%' ? 1 : 0;
+                continue;
+            }
+            char spec[32] = "%";
+            auto s = 1;
+            for (++f; *f && strchr("-+ #0123456789.", *f) && s < 24; ++f) spec[s++] = *f;
+            while (*f && strchr("hljztL", *f)) ++f;
+            if (!*f) break;
+            const auto conversion = *f;
+            const auto at = buf + out;
+            const auto rest = bytes - size_t(out);
+            auto written = 0;
+            if (strchr("diuoxX", conversion)) {
+                spec[s++] = 'l';
+                spec[s++] = 'l';
+                spec[s++] = conversion;
+                written = conversion == 'd' || conversion == 'i' ? snprintf(at, rest, spec, arg->I)
+                                                                 : snprintf(at, rest, spec, arg->U);
+            } else if (strchr("fFeEgGaA", conversion)) {
+                spec[s++] = conversion;
+                written = snprintf(at, rest, spec, arg->F);
+            } else if (conversion == 'c') {
+                spec[s++] = 'c';
+                written = snprintf(at, rest, spec, int(arg->I));
+            } else if (conversion == 's') {
+                spec[s++] = 's';
+                written = snprintf(at, rest, spec, static_cast<const char*>(arg->P));
+            } else {
+                spec[s++] = 'p';
+                written = snprintf(at, rest, spec, arg->P);
+            }
+            ++arg;
+            if (written < 0) break;
+            out += written;
+        }
+        out = std::min(std::max(out, 0), int(bytes) - 1);
+        buf[out] = '\0';
+    }
+};
+
+#if LOG_LEVEL <= 0
+#define LOG_DEBUG(...) Logger::Get().Write(LogLevel::Debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_LEVEL <= 1
+#define LOG_INFO(...) Logger::Get().Write(LogLevel::Info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_LEVEL <= 2
+#define LOG_WARNING(...) Logger::Get().Write(LogLevel::Warning, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) ((void)0)
+#endif
+#define LOG_ERROR(...) Logger::Get().Write(LogLevel::Error, __VA_ARGS__)
+
+// Fatal check, logged as an error with its location before exiting
+#ifndef VALIDATE
+#define VALIDATE(x, msg)                                \
+    if (!(x)) {                                         \
+        Logger::Get().Fatal(__FILE__, __LINE__, (msg)); \
+    }
+#endif
+
+// Heap allocation counters for the calling thread, every operator new goes through the global
+// replacements in allocation_tracker.cpp. Snapshot before and after a block of code to see what it
+// allocated.
+struct AllocationTracker {
+    static thread_local size_t Count;
+    static thread_local size_t Bytes;
+};
+
+// Linear bump allocator over a block allocated once up front. Individual frees are no-ops, the
+// whole arena is released at once with Reset(). Running out of space is fatal, size it generously.
+struct ArenaAllocator {
+    std::unique_ptr<char[]> Block;
+    size_t Capacity, Used = 0, HighWater = 0;
+
+    explicit ArenaAllocator(size_t capacity) : Block{new char[capacity]}, Capacity{capacity} {}
+
+    void* Allocate(size_t bytes, size_t alignment) {
+        const auto start = (Used + alignment - 1) & ~(alignment - 1);
+        VALIDATE(start + bytes <= Capacity, "Arena allocator out of memory.");
+        Used = start + bytes;
+        HighWater = std::max(HighWater, Used);
+        return Block.get() + start;
+    }
+
+    // Uninitialized storage for n trivially destructible objects
+    template <typename T>
+    T* AllocateArray(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena memory is never destructed");
+        return static_cast<T*>(Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void Reset() { Used = 0; }
+};
+
+// Standard allocator adapter so containers can live in an arena
+template <typename T>
+struct ArenaAdapter {
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    ArenaAllocator* Arena;
+
+    ArenaAdapter(ArenaAllocator& arena) : Arena{&arena} {}
+    template <typename U>
+    ArenaAdapter(const ArenaAdapter<U>& other) : Arena{other.Arena} {}
+
+    T* allocate(size_t n) { return static_cast<T*>(Arena->Allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAdapter<U>& other) const { return Arena == other.Arena; }
+    template <typename U>
+    bool operator!=(const ArenaAdapter<U>& other) const { return Arena != other.Arena; }
+};
+
+template <typename T>
+using FrameVector = std::vector<T, ArenaAdapter<T>>;
+
+// Double buffered per frame arena for transient frame data. Anything allocated during a frame stays
+// valid until the end of the following frame, so data still in flight (e.g. layers resubmitted to
+// the compositor) can be referenced one frame later.
+struct FrameArena {
+    std::array<ArenaAllocator, 2> Arenas;
+    unsigned Current = 0;
+
+    explicit FrameArena(size_t capacity)
+        : Arenas{{ArenaAllocator{capacity}, ArenaAllocator{capacity}}} {}
+
+    void BeginFrame() {
+        Current ^= 1;
+        Arenas[Current].Reset();
+    }
+    ArenaAllocator& Get() { return Arenas[Current]; }
+    template <typename T>
+    FrameVector<T> MakeVector() {
+        return FrameVector<T>{ArenaAdapter<T>{Get()}};
+    }
+};
@@ -0,0 +1,724 @@
+// CPU side scene geometry: box meshes, their static processing and buffer sub-allocation,
+// independent of the graphics API
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <tuple>
+#include <vector>
+
+#include "core.h"
+#include "vectors.h"
+
+// First fit sub-allocator handing out ranges of elements from a fixed capacity. The free list is
+// kept sorted by start and adjacent free ranges are coalesced on release.
+struct RangeAllocator {
+    struct Range {
+        unsigned Start, Count;
+    };
+    unsigned Capacity;
+    std::vector<Range> Free;
+
+    explicit RangeAllocator(unsigned capacity) : Capacity{capacity}, Free{{0, capacity}} {}
+
+    // Returns false if no free range is large enough
+    bool Allocate(unsigned count, Range& range) {
+        auto it =
+            std::find_if(begin(Free), end(Free), [count](auto r) { return r.Count >= count; });
+        if (it == end(Free)) return false;
+        range = {it->Start, count};
+        it->Start += count;
+        it->Count -= count;
+        if (!it->Count) Free.erase(it);
+        return true;
+    }
+
+    void Release(Range range) {
+        if (!range.Count) return;
+        auto it = std::lower_bound(begin(Free), end(Free), range,
+                                   [](auto a, auto b) { return a.Start < b.Start; });
+        it = Free.insert(it, range);
+        if (it + 1 != end(Free) && it->Start + it->Count == (it + 1)->Start) {
+            it->Count += (it + 1)->Count;
+            Free.erase(it + 1);
+        }
+        if (it != begin(Free) && (it - 1)->Start + (it - 1)->Count == it->Start) {
+            (it - 1)->Count += it->Count;
+            Free.erase(it);
+        }
+    }
+
+    unsigned FreeCount() const {
+        auto res = 0u;
+        for (auto r : Free) res += r.Count;
+        return res;
+    }
+    unsigned LargestFree() const {
+        auto res = 0u;
+        for (auto r : Free) res = std::max(res, r.Count);
+        return res;
+    }
+    // 0 when all free space is one contiguous range, approaching 1 as it splinters
+    float Fragmentation() const {
+        const auto free = FreeCount();
+        return free ? 1.0f - float(LargestFree()) / float(free) : 0.0f;
+    }
+};
+
+struct Vertex {
+    Float3 Pos;
+    uint32_t C;
+    float U, V;
+};
+
+// Split the positions out of an interleaved vertex stream for position only passes. Reuses the
+// storage of res, so repeated calls only allocate when count grows.
+inline void SplitPositions(const Vertex* vertices, size_t count, std::vector<Float3>& res) {
+    res.resize(count);
+    std::transform(vertices, vertices + count, begin(res), [](const Vertex& v) { return v.Pos; });
+}
+
+// A color lit by the fixed lights at a mesh space position, with random brightness noise
+inline uint32_t LitColor(uint32_t c, const Float3& pos) {
+    auto dist = [&pos](float x, float y, float z) {
+        return std::sqrt((pos.x + x) * (pos.x + x) + (pos.y + y) * (pos.y + y) +
+                         (pos.z + z) * (pos.z + z));
+    };
+    const auto dist1 = dist(2.0f, -4.0f, 2.0f);
+    const auto dist2 = dist(-3.0f, -4.0f, 3.0f);
+    const auto dist3 = dist(4.0f, -3.0f, -25.0f);
+    int bri = rand() % 160;
+    float r = ((c >> 16) & 0xff) *
+              (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
+    float g = ((c >> 8) & 0xff) *
+              (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
+    float b = ((c >> 0) & 0xff) *
+              (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
+    return ((c & 0xff000000) + ((r > 255 ? 255 : (uint32_t)r) << 16) +
+            ((g > 255 ? 255 : (uint32_t)g) << 8) + (b > 255 ? 255 : (uint32_t)b));
+}
+
+// Boxes are stored as fixed runs of 36 vertices and indices, so a box handle is just its slot and a
+// box can be modified or removed in place. Removed boxes become degenerate triangles and their slot
+// is reused by the next AddBox. Edits are recorded as dirty vertex ranges (a box's index range is
+// the same as its vertex range) for the owner to flush to the GPU.
+struct TriangleSet {
+    static constexpr unsigned VerticesPerBox = 36;
+    using BoxHandle = unsigned;
+
+    // Extents of each box slot, removed boxes are empty (Min > Max)
+    struct Box {
+        Float3 Min, Max;
+        bool Empty() const { return Min.x > Max.x; }
+    };
+
+    std::vector<Vertex> Vertices;
+    std::vector<short> Indices;
+    std::vector<Box> Boxes;
+    std::vector<BoxHandle> FreeBoxes;
+    std::vector<RangeAllocator::Range> Dirty;
+    bool BakeLighting = true;  // Light boxes as they are written, otherwise flat colors
+
+    BoxHandle AddBox(float x1, float y1, float z1, float x2, float y2, float z2, uint32_t c) {
+        auto box = BoxHandle(Vertices.size() / VerticesPerBox);
+        if (!FreeBoxes.empty()) {
+            box = FreeBoxes.back();
+            FreeBoxes.pop_back();
+        }
+        WriteBox(box, x1, y1, z1, x2, y2, z2, c);
+        return box;
+    }
+
+    void ModifyBox(BoxHandle box, float x1, float y1, float z1, float x2, float y2, float z2,
+                   uint32_t c) {
+        WriteBox(box, x1, y1, z1, x2, y2, z2, c);
+    }
+
+    // Append a copy of a box from another set, keeping its vertex colors
+    BoxHandle CopyBox(const TriangleSet& from, BoxHandle box) {
+        const auto res = BoxHandle(Boxes.size());
+        const auto first = begin(from.Vertices) + box * VerticesPerBox;
+        for (auto v = first; v != first + VerticesPerBox; ++v) {
+            Indices.push_back(static_cast<short>(Vertices.size()));
+            Vertices.push_back(*v);
+        }
+        Boxes.push_back(from.Boxes[box]);
+        MarkDirty(res);
+        return res;
+    }
+
+    void RemoveBox(BoxHandle box) {
+        const auto start = box * VerticesPerBox;
+        std::fill_n(begin(Indices) + start, VerticesPerBox, static_cast<short>(start));
+        Boxes[box] = {{1, 1, 1}, {0, 0, 0}};
+        FreeBoxes.push_back(box);
+        MarkDirty(box);
+    }
+
+    void MarkDirty(BoxHandle box) {
+        const auto start = box * VerticesPerBox;
+        if (!Dirty.empty() && Dirty.back().Start + Dirty.back().Count == start)
+            Dirty.back().Count += VerticesPerBox;
+        else
+            Dirty.push_back({start, VerticesPerBox});
+    }
+
+    void WriteBox(BoxHandle box, float x1, float y1, float z1, float x2, float y2, float z2,
+                  uint32_t c) {
+        const auto start = box * VerticesPerBox;
+        if (start == Vertices.size()) {
+            Vertices.resize(start + VerticesPerBox);
+            Indices.resize(start + VerticesPerBox);
+            Boxes.resize(box + 1);
+        }
+        Boxes[box] = {{std::min(x1, x2), std::min(y1, y2), std::min(z1, z2)},
+                      {std::max(x1, x2), std::max(y1, y2), std::max(z1, z2)}};
+        auto next = start;
+        auto addQuad = [this, &next](Vertex v0, Vertex v1, Vertex v2, Vertex v3) {
+            auto addTriangle = [this, &next](const std::initializer_list<Vertex>& vs) {
+                for (const auto& v : vs) {
+                    Indices[next] = static_cast<short>(next);
+                    Vertices[next++] = v;
+                }
+            };
+
+            addTriangle({v0, v1, v2});
+            addTriangle({v3, v2, v1});
+        };
+
+        auto modifyColor = [this](uint32_t c, Float3 pos) {
+            return BakeLighting ? LitColor(c, pos) : c;
+        };
+
+        addQuad({{x1, y2, z1}, modifyColor(c, {x1, y2, z1}), z1, x1},
+                {{x2, y2, z1}, modifyColor(c, {x2, y2, z1}), z1, x2},
+                {{x1, y2, z2}, modifyColor(c, {x1, y2, z2}), z2, x1},
+                {{x2, y2, z2}, modifyColor(c, {x2, y2, z2}), z2, x2});
+        addQuad({{x2, y1, z1}, modifyColor(c, {x2, y1, z1}), z1, x2},
+                {{x1, y1, z1}, modifyColor(c, {x1, y1, z1}), z1, x1},
+                {{x2, y1, z2}, modifyColor(c, {x2, y1, z2}), z2, x2},
+                {{x1, y1, z2}, modifyColor(c, {x1, y1, z2}), z2, x1});
+        addQuad({{x1, y1, z2}, modifyColor(c, {x1, y1, z2}), z2, y1},
+                {{x1, y1, z1}, modifyColor(c, {x1, y1, z1}), z1, y1},
+                {{x1, y2, z2}, modifyColor(c, {x1, y2, z2}), z2, y2},
+                {{x1, y2, z1}, modifyColor(c, {x1, y2, z1}), z1, y2});
+        addQuad({{x2, y1, z1}, modifyColor(c, {x2, y1, z1}), z1, y1},
+                {{x2, y1, z2}, modifyColor(c, {x2, y1, z2}), z2, y1},
+                {{x2, y2, z1}, modifyColor(c, {x2, y2, z1}), z1, y2},
+                {{x2, y2, z2}, modifyColor(c, {x2, y2, z2}), z2, y2});
+        addQuad({{x1, y1, z1}, modifyColor(c, {x1, y1, z1}), x1, y1},
+                {{x2, y1, z1}, modifyColor(c, {x2, y1, z1}), x2, y1},
+                {{x1, y2, z1}, modifyColor(c, {x1, y2, z1}), x1, y2},
+                {{x2, y2, z1}, modifyColor(c, {x2, y2, z1}), x2, y2});
+        addQuad({{x2, y1, z2}, modifyColor(c, {x2, y1, z2}), x2, y1},
+                {{x1, y1, z2}, modifyColor(c, {x1, y1, z2}), x1, y1},
+                {{x2, y2, z2}, modifyColor(c, {x2, y2, z2}), x2, y2},
+                {{x1, y2, z2}, modifyColor(c, {x1, y2, z2}), x1, y2});
+        MarkDirty(box);
+    }
+};
+
+enum class TextureFill { AUTO_WHITE, AUTO_WALL, AUTO_FLOOR, AUTO_CEILING };
+
+// Texel of a 256x256 procedural texture as 0xAABBGGRR, for the GPU textures and the CPU ray caster
+inline uint32_t TexturePixel(TextureFill texFill, unsigned x, unsigned y) {
+    switch (texFill) {
+        case (TextureFill::AUTO_WALL):
+            return (((y / 4 & 15) == 0) ||
+                    (((x / 4 & 15) == 0) && ((((x / 4 & 31) == 0) ^ ((y / 4 >> 4) & 1)) == 0)))
+                       ? 0xff3c3c3c
+                       : 0xffb4b4b4;
+        case (TextureFill::AUTO_FLOOR):
+            return (((x >> 7) ^ (y >> 7)) & 1) ? 0xffb4b4b4 : 0xff505050;
+        case (TextureFill::AUTO_CEILING):
+            return (x / 4 == 0 || y / 4 == 0) ? 0xff505050 : 0xffb4b4b4;
+        case (TextureFill::AUTO_WHITE):
+            return 0xffffffff;
+        default:
+            return 0xffffffff;
+    }
+}
+
+// CPU side description of a scene mesh, kept for building GPU models and for CPU analysis
+struct MeshDesc {
+    TriangleSet Mesh;
+    Float3 Pos;
+    TextureFill Fill;
+    bool Dynamic = false;  // Moves at runtime, excluded from static geometry processing
+};
+
+// Bake the fixed lights into the vertex colors of meshes built with flat colors, once processing
+// that needs flat colors (MergeCoplanarFaces) is done. Meshes already lit as written are left
+// alone, the others light boxes written later as they are written.
+inline void BakeVertexLighting(std::vector<MeshDesc>& meshes) {
+    for (auto& mesh : meshes) {
+        if (mesh.Mesh.BakeLighting) continue;
+        mesh.Mesh.BakeLighting = true;
+        for (auto& v : mesh.Mesh.Vertices) v.C = LitColor(v.C, v.Pos);
+    }
+}
+
+// Uniform grid over world space boxes for finding the boxes that contain a point. Each cell lists
+// every box overlapping it, stored flattened with a start offset per cell. Boxes are expanded by
+// Slack when binned so points within Slack of a box still find it.
+struct BoxGrid {
+    static constexpr int MaxCellsPerAxis = 32;
+    Float3 Min = {}, CellSize = {1, 1, 1};
+    int Dims[3] = {1, 1, 1};
+    std::vector<unsigned> CellStart, Items;
+
+    void Build(const std::vector<Float3>& mins, const std::vector<Float3>& maxs, float slack) {
+        auto lo = Float3{FLT_MAX, FLT_MAX, FLT_MAX}, hi = Float3{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (size_t b = 0; b < mins.size(); ++b)
+            for (auto a = 0; a < 3; ++a) {
+                (&lo.x)[a] = std::min((&lo.x)[a], (&mins[b].x)[a] - slack);
+                (&hi.x)[a] = std::max((&hi.x)[a], (&maxs[b].x)[a] + slack);
+            }
+        if (mins.empty()) lo = hi = {};
+        // Cubic cells sized so the longest axis has MaxCellsPerAxis of them
+        const auto extent = std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z, slack});
+        const auto size = extent / MaxCellsPerAxis;
+        Min = lo;
+        CellSize = {size, size, size};
+        for (auto a = 0; a < 3; ++a)
+            Dims[a] = std::max(1, std::min(int(MaxCellsPerAxis),
+                                           int(std::ceil(((&hi.x)[a] - (&lo.x)[a]) / size))));
+
+        // Count, prefix sum, then fill each box into the cells its expanded extents overlap
+        CellStart.assign(size_t(Dims[0]) * Dims[1] * Dims[2] + 1, 0);
+        auto forCells = [this, &mins, &maxs, slack](size_t b, auto f) {
+            int from[3], to[3];
+            for (auto a = 0; a < 3; ++a) {
+                from[a] = Cell((&mins[b].x)[a] - slack, a);
+                to[a] = Cell((&maxs[b].x)[a] + slack, a);
+            }
+            for (auto z = from[2]; z <= to[2]; ++z)
+                for (auto y = from[1]; y <= to[1]; ++y)
+                    for (auto x = from[0]; x <= to[0]; ++x)
+                        f((size_t(z) * Dims[1] + y) * Dims[0] + x);
+        };
+        for (size_t b = 0; b < mins.size(); ++b)
+            forCells(b, [this](size_t cell) { ++CellStart[cell + 1]; });
+        for (size_t c = 1; c < CellStart.size(); ++c) CellStart[c] += CellStart[c - 1];
+        Items.resize(CellStart.back());
+        auto next = std::vector<unsigned>(begin(CellStart), end(CellStart) - 1);
+        for (size_t b = 0; b < mins.size(); ++b)
+            forCells(b, [this, &next, b](size_t cell) { Items[next[cell]++] = unsigned(b); });
+    }
+
+    int Cell(float v, int axis) const {
+        const auto c = int(std::floor((v - (&Min.x)[axis]) / (&CellSize.x)[axis]));
+        return std::max(0, std::min(Dims[axis] - 1, c));
+    }
+
+    // Calls f(box) for every box that may contain p, a superset of those that do
+    template <typename F>
+    void ForCandidates(const Float3& p, F f) const {
+        const auto cell = (size_t(Cell(p.z, 2)) * Dims[1] + Cell(p.y, 1)) * Dims[0] + Cell(p.x, 0);
+        for (auto i = CellStart[cell]; i < CellStart[cell + 1]; ++i) f(Items[i]);
+    }
+};
+
+// Drop box faces that can never be seen because another box's solid volume covers the whole face
+// and extends past it on the outward side. Faces that are merely coincident with a coplanar face
+// of a box on the same side are kept, so duplicated or touching-from-inside boxes still render.
+// Dynamic meshes neither occlude nor get culled. Culled meshes are compacted and lose their box
+// slots, so they are for static geometry only. An occluder covering a face contains the face's
+// center, so only the occluders binned in the grid cell of the center are tested.
+struct HiddenFaceStats {
+    size_t TrianglesBefore = 0, TrianglesAfter = 0, VerticesBefore = 0, VerticesAfter = 0;
+    size_t OccluderTests = 0;
+    double Seconds = 0.0;
+};
+
+inline auto RemoveHiddenFaces(std::vector<MeshDesc>& meshes) {
+    const auto start = CpuSeconds();
+    auto stats = HiddenFaceStats{};
+
+    // World space extents of every static box
+    struct Occluder {
+        size_t Mesh, Box;
+    };
+    std::vector<Occluder> occluders;
+    std::vector<Float3> mins, maxs;
+    for (size_t m = 0; m < meshes.size(); ++m) {
+        if (meshes[m].Dynamic) continue;
+        const auto& pos = meshes[m].Pos;
+        const auto& boxes = meshes[m].Mesh.Boxes;
+        for (size_t b = 0; b < boxes.size(); ++b)
+            if (!boxes[b].Empty()) {
+                occluders.push_back({m, b});
+                mins.push_back(
+                    {boxes[b].Min.x + pos.x, boxes[b].Min.y + pos.y, boxes[b].Min.z + pos.z});
+                maxs.push_back(
+                    {boxes[b].Max.x + pos.x, boxes[b].Max.y + pos.y, boxes[b].Max.z + pos.z});
+            }
+    }
+    const auto eps = 1e-4f;
+    auto grid = BoxGrid{};
+    grid.Build(mins, maxs, eps);
+
+    auto component = [](const Float3& v, int axis) { return (&v.x)[axis]; };
+    // AddBox emits six quads of six vertices, facing y, y, x, x, z, z
+    const int faceAxes[] = {1, 1, 0, 0, 2, 2};
+    for (size_t m = 0; m < meshes.size(); ++m) {
+        auto& mesh = meshes[m];
+        if (mesh.Dynamic) continue;
+        const auto& t = mesh.Mesh;
+        stats.TrianglesBefore += t.Indices.size() / 3;
+        stats.VerticesBefore += t.Vertices.size();
+        auto res = TriangleSet{};
+        for (size_t b = 0; b < t.Boxes.size(); ++b) {
+            if (t.Boxes[b].Empty()) continue;
+            const auto& box = t.Boxes[b];
+            const auto boxMin = Float3{box.Min.x + mesh.Pos.x, box.Min.y + mesh.Pos.y,
+                                       box.Min.z + mesh.Pos.z};
+            const auto boxMax = Float3{box.Max.x + mesh.Pos.x, box.Max.y + mesh.Pos.y,
+                                       box.Max.z + mesh.Pos.z};
+            for (auto f = 0u; f < 6; ++f) {
+                const auto first = b * TriangleSet::VerticesPerBox + f * 6;
+                const auto axis = faceAxes[f];
+                const auto c = component(t.Vertices[first].Pos, axis) + component(mesh.Pos, axis);
+                const auto outward = c >= component(boxMax, axis);
+                auto center = Float3{(boxMin.x + boxMax.x) / 2, (boxMin.y + boxMax.y) / 2,
+                                     (boxMin.z + boxMax.z) / 2};
+                (&center.x)[axis] = c;
+                auto hidden = false;
+                grid.ForCandidates(center, [&](unsigned o) {
+                    if (hidden || (occluders[o].Mesh == m && occluders[o].Box == b)) return;
+                    ++stats.OccluderTests;
+                    const auto &occMin = mins[o], &occMax = maxs[o];
+                    for (auto a = 0; a < 3; ++a) {
+                        if (a == axis) continue;
+                        if (component(occMin, a) > component(boxMin, a) + eps ||
+                            component(occMax, a) < component(boxMax, a) - eps)
+                            return;
+                    }
+                    hidden = outward ? component(occMin, axis) <= c + eps &&
+                                           component(occMax, axis) > c + eps
+                                     : component(occMax, axis) >= c - eps &&
+                                           component(occMin, axis) < c - eps;
+                });
+                if (hidden) continue;
+                for (auto v = first; v < first + 6; ++v) {
+                    res.Indices.push_back(static_cast<short>(res.Vertices.size()));
+                    res.Vertices.push_back(t.Vertices[v]);
+                }
+            }
+        }
+        stats.TrianglesAfter += res.Indices.size() / 3;
+        stats.VerticesAfter += res.Vertices.size();
+        mesh.Mesh = std::move(res);
+    }
+    stats.Seconds = CpuSeconds() - start;
+    LOG_INFO("Hidden face removal: %zu -> %zu triangles, %zu -> %zu vertices, %zu occluder tests "
+             "for %zu boxes in %.2fms\n",
+             stats.TrianglesBefore, stats.TrianglesAfter, stats.VerticesBefore,
+             stats.VerticesAfter, stats.OccluderTests, occluders.size(), 1000.0 * stats.Seconds);
+    return stats;
+}
+
+// Greedy merging of coplanar box faces. Every quad of six vertices (as emitted by AddBox) with a
+// single flat color becomes a rectangle on its plane. Rectangles with the same plane, facing and
+// color are merged whenever two share a full edge, alternating between the two in-plane axes until
+// nothing merges. Texture coordinates are mesh space positions (see AddBox) so they are recomputed
+// exactly for merged corners. Quads with per-vertex color variation are left untouched, so this
+// runs before lighting is baked into vertex colors (BakeVertexLighting).
+struct FaceRect {
+    int Axis;
+    float Plane;
+    bool Positive;  // Sign of the triangle normal along Axis, so opposite faces never merge
+    uint32_t Color;
+    float Lo[2], Hi[2];   // Extents along the in-plane axes (Axis + 1) % 3 and (Axis + 2) % 3
+    unsigned Corners[4];  // For each quad vertex, bit 0 set at Hi[0] and bit 1 set at Hi[1]
+    unsigned Quads;       // Source quads merged into this rectangle
+};
+
+// Mesh space position to texture coordinate axes used by AddBox for faces along each axis
+const int FaceUvAxes[3][2] = {{2, 1}, {2, 0}, {0, 1}};
+
+// Classify a six vertex quad, returns false if it isn't an axis aligned flat colored rectangle
+// with AddBox texture coordinates
+inline bool ToFaceRect(const Vertex* quad, FaceRect& rect) {
+    auto component = [](const Float3& v, int axis) { return (&v.x)[axis]; };
+    for (auto axis = 0; axis < 3; ++axis) {
+        const auto plane = component(quad[0].Pos, axis);
+        if (!std::all_of(quad, quad + 4, [&](const Vertex& v) {
+                return component(v.Pos, axis) == plane && v.C == quad[0].C &&
+                       v.U == component(v.Pos, FaceUvAxes[axis][0]) &&
+                       v.V == component(v.Pos, FaceUvAxes[axis][1]);
+            }))
+            continue;
+        const int a[] = {(axis + 1) % 3, (axis + 2) % 3};
+        rect = {axis, plane, false, quad[0].C, {}, {}, {}, 1};
+        for (auto i = 0; i < 2; ++i) {
+            rect.Lo[i] = std::min({component(quad[0].Pos, a[i]), component(quad[1].Pos, a[i]),
+                                   component(quad[2].Pos, a[i]), component(quad[3].Pos, a[i])});
+            rect.Hi[i] = std::max({component(quad[0].Pos, a[i]), component(quad[1].Pos, a[i]),
+                                   component(quad[2].Pos, a[i]), component(quad[3].Pos, a[i])});
+        }
+        for (auto v = 0; v < 4; ++v) {
+            const auto p = quad[v].Pos;
+            rect.Corners[v] = (component(p, a[0]) == rect.Hi[0] ? 1u : 0u) |
+                              (component(p, a[1]) == rect.Hi[1] ? 2u : 0u);
+        }
+        // Facing from the winding of the first triangle, Corners keeps the winding when merged
+        auto edge = [quad, &component, &a](int v, int i) {
+            return component(quad[v].Pos, a[i]) - component(quad[0].Pos, a[i]);
+        };
+        rect.Positive = edge(1, 0) * edge(2, 1) - edge(1, 1) * edge(2, 0) < 0.0f;
+        return true;
+    }
+    return false;
+}
+
+// Merge rectangles sharing a full edge until none do. The ends of every shared edge, the source
+// corners that merging drops, are added to seams in mesh space.
+inline void MergeFaceRects(std::vector<FaceRect>& rects, std::vector<Float3>& seams) {
+    auto key = [](const FaceRect& r) {
+        return std::make_tuple(r.Axis, r.Plane, r.Positive, r.Color);
+    };
+    for (auto merged = true; merged;) {
+        merged = false;
+        for (auto along = 0; along < 2; ++along) {
+            const auto across = 1 - along;
+            // Sort so rectangles that could merge along this axis are next to each other
+            std::sort(begin(rects), end(rects), [&](const FaceRect& l, const FaceRect& r) {
+                return std::make_tuple(key(l), l.Lo[across], l.Hi[across], l.Lo[along]) <
+                       std::make_tuple(key(r), r.Lo[across], r.Hi[across], r.Lo[along]);
+            });
+            auto out = begin(rects);
+            for (auto it = begin(rects); it != end(rects); ++it) {
+                if (out != begin(rects)) {
+                    auto& prev = *(out - 1);
+                    if (key(prev) == key(*it) && prev.Lo[across] == it->Lo[across] &&
+                        prev.Hi[across] == it->Hi[across] && prev.Hi[along] == it->Lo[along]) {
+                        const int a[] = {(prev.Axis + 1) % 3, (prev.Axis + 2) % 3};
+                        for (auto end : {prev.Lo[across], prev.Hi[across]}) {
+                            auto p = Float3{};
+                            (&p.x)[prev.Axis] = prev.Plane;
+                            (&p.x)[a[along]] = prev.Hi[along];
+                            (&p.x)[a[across]] = end;
+                            seams.push_back(p);
+                        }
+                        prev.Hi[along] = it->Hi[along];
+                        prev.Quads += it->Quads;
+                        merged = true;
+                        continue;
+                    }
+                }
+                *out++ = *it;
+            }
+            rects.erase(out, end(rects));
+        }
+    }
+}
+
+// World space points on each axis aligned line through them: for direction d the key is d and
+// the two other coordinates in axis order, the values are the sorted coordinates along d
+using CornerLines = std::map<std::tuple<int, float, float>, std::vector<float>>;
+
+inline void AddCorner(CornerLines& lines, const Float3& p) {
+    for (auto d = 0; d < 3; ++d)
+        lines[std::make_tuple(d, (&p.x)[(d + 1) % 3], (&p.x)[(d + 2) % 3])].push_back((&p.x)[d]);
+}
+
+inline void SortCorners(CornerLines& lines) {
+    for (auto& line : lines) {
+        auto& values = line.second;
+        std::sort(begin(values), end(values));
+        values.erase(std::unique(begin(values), end(values)), end(values));
+    }
+}
+
+// Coordinates on a line strictly between lo and hi
+inline auto CornersBetween(const CornerLines& lines, const std::tuple<int, float, float>& line,
+                           float lo, float hi) {
+    const auto it = lines.find(line);
+    if (it == end(lines)) return std::vector<float>{};
+    const auto from = std::upper_bound(begin(it->second), end(it->second), lo);
+    return std::vector<float>(from, std::lower_bound(from, end(it->second), hi));
+}
+
+// Append a rectangle of a mesh at pos as two triangles. A merged rectangle's edges can pass
+// through corners of neighbouring faces that used to meet the corners of its source quads, which
+// leaves T-junctions that crack under rasterization. Such rectangles are instead triangulated with
+// those points as extra vertices: seam ends (see MergeFaceRects) on their edges that are still
+// corners of other faces. T-junctions the source quads already had are left as they were. Returns
+// the edge vertices added.
+inline size_t AppendFaceRect(const FaceRect& rect, const Float3& pos, const CornerLines& corners,
+                             const CornerLines& seams, TriangleSet& t) {
+    const int a[] = {(rect.Axis + 1) % 3, (rect.Axis + 2) % 3};
+    auto vertex = [&rect, &a](float s, float u) {
+        float p[3];
+        p[rect.Axis] = rect.Plane;
+        p[a[0]] = s;
+        p[a[1]] = u;
+        const auto& uv = FaceUvAxes[rect.Axis];
+        return Vertex{{p[0], p[1], p[2]}, rect.Color, p[uv[0]], p[uv[1]]};
+    };
+    auto corner = [&rect, &vertex](int v) {
+        return vertex(rect.Corners[v] & 1u ? rect.Hi[0] : rect.Lo[0],
+                      rect.Corners[v] & 2u ? rect.Hi[1] : rect.Lo[1]);
+    };
+
+    // Boundary counterclockwise in the in-plane axes, with the corners of other faces that lie
+    // inside each edge. The edge along in-plane axis i at coordinate c of the other one.
+    std::vector<Vertex> boundary;
+    auto addEdge = [&](int i, float c, bool forward) {
+        const auto first = forward ? rect.Lo[i] : rect.Hi[i];
+        boundary.push_back(i == 0 ? vertex(first, c) : vertex(c, first));
+        if (rect.Quads < 2) return;
+        float p[3];
+        p[rect.Axis] = rect.Plane + (&pos.x)[rect.Axis];
+        p[a[1 - i]] = c + (&pos.x)[a[1 - i]];
+        const auto d = a[i];
+        const auto line = std::make_tuple(d, p[(d + 1) % 3], p[(d + 2) % 3]);
+        const auto lo = rect.Lo[i] + (&pos.x)[d], hi = rect.Hi[i] + (&pos.x)[d];
+        const auto ends = CornersBetween(seams, line, lo, hi);
+        if (ends.empty()) return;
+        const auto others = CornersBetween(corners, line, lo, hi);
+        std::vector<float> splits;
+        std::set_intersection(begin(ends), end(ends), begin(others), end(others),
+                              std::back_inserter(splits));
+        if (!forward) std::reverse(begin(splits), end(splits));
+        for (auto w : splits) {
+            const auto s = w - (&pos.x)[d];
+            boundary.push_back(i == 0 ? vertex(s, c) : vertex(c, s));
+        }
+    };
+    addEdge(0, rect.Lo[1], true);
+    addEdge(1, rect.Hi[0], true);
+    addEdge(0, rect.Hi[1], false);
+    addEdge(1, rect.Lo[0], false);
+
+    auto push = [&t](const Vertex& v) {
+        t.Indices.push_back(static_cast<short>(t.Vertices.size()));
+        t.Vertices.push_back(v);
+    };
+    if (boundary.size() == 4) {
+        for (auto v : {0, 1, 2, 3, 2, 1}) push(corner(v));
+        return 0;
+    }
+    // Keep the winding of the source quads, whose first triangle is corners 0, 1, 2
+    auto at = [&rect](int v, unsigned bit) { return rect.Corners[v] & bit ? 1.0f : 0.0f; };
+    const auto counterclockwise = (at(1, 1) - at(0, 1)) * (at(2, 2) - at(0, 2)) -
+                                      (at(1, 2) - at(0, 2)) * (at(2, 1) - at(0, 1)) >
+                                  0.0f;
+    // Clip ears off the convex boundary. An ear is clipped only if it has area and no other vertex
+    // lies on the edge it leaves, so every edge vertex stays on the edges of the triangles.
+    const auto first = t.Vertices.size();
+    t.Vertices.insert(end(t.Vertices), begin(boundary), end(boundary));
+    auto coord = [&boundary, &a](size_t v, int i) { return (&boundary[v].Pos.x)[a[i]]; };
+    auto cross = [&coord](size_t p, size_t v, size_t q) {
+        return (coord(v, 0) - coord(p, 0)) * (coord(q, 1) - coord(p, 1)) -
+               (coord(v, 1) - coord(p, 1)) * (coord(q, 0) - coord(p, 0));
+    };
+    auto between = [&coord](size_t p, size_t v, size_t q) {
+        return std::min(coord(p, 0), coord(q, 0)) <= coord(v, 0) &&
+               coord(v, 0) <= std::max(coord(p, 0), coord(q, 0)) &&
+               std::min(coord(p, 1), coord(q, 1)) <= coord(v, 1) &&
+               coord(v, 1) <= std::max(coord(p, 1), coord(q, 1));
+    };
+    auto triangle = [&t, first, counterclockwise](size_t p, size_t v, size_t q) {
+        const auto i0 = static_cast<short>(first + p), i1 = static_cast<short>(first + v),
+                   i2 = static_cast<short>(first + q);
+        t.Indices.insert(end(t.Indices), {i0, counterclockwise ? i1 : i2,
+                                          counterclockwise ? i2 : i1});
+    };
+    std::vector<size_t> ring(boundary.size());
+    for (size_t v = 0; v < ring.size(); ++v) ring[v] = v;
+    while (ring.size() > 3) {
+        const auto n = ring.size();
+        auto ear = n;
+        for (size_t i = 0; i < n && ear == n; ++i) {
+            const auto p = ring[(i + n - 1) % n], v = ring[i], q = ring[(i + 1) % n];
+            if (cross(p, v, q) == 0.0f) continue;
+            if (std::none_of(begin(ring), end(ring), [&](size_t w) {
+                    return w != p && w != v && w != q && cross(p, w, q) == 0.0f &&
+                           between(p, w, q);
+                }))
+                ear = i;
+        }
+        if (ear == n) break;  // Can't happen for a convex boundary with area
+        triangle(ring[(ear + n - 1) % n], ring[ear], ring[(ear + 1) % n]);
+        ring.erase(begin(ring) + ear);
+    }
+    if (ring.size() == 3) triangle(ring[0], ring[1], ring[2]);
+    return boundary.size() - 4;
+}
+
+struct MergeStats {
+    size_t TrianglesBefore = 0, TrianglesAfter = 0, EdgeVertices = 0;
+    double Seconds = 0.0;
+};
+
+// Merge the coplanar faces of every static mesh. Corners and seams of all static meshes are
+// collected in world space first, so merged faces are also split where another mesh's faces meet
+// their edges.
+inline auto MergeCoplanarFaces(std::vector<MeshDesc>& meshes) {
+    const auto start = CpuSeconds();
+    auto stats = MergeStats{};
+    std::vector<TriangleSet> res(meshes.size());
+    std::vector<std::vector<FaceRect>> rects(meshes.size());
+    auto corners = CornerLines{}, seams = CornerLines{};
+    std::vector<Float3> meshSeams;
+    for (size_t m = 0; m < meshes.size(); ++m) {
+        const auto& mesh = meshes[m];
+        if (mesh.Dynamic) continue;
+        const auto& t = mesh.Mesh;
+        auto world = [&mesh](const Float3& p) {
+            return Float3{p.x + mesh.Pos.x, p.y + mesh.Pos.y, p.z + mesh.Pos.z};
+        };
+        for (size_t q = 0; q + 6 <= t.Indices.size(); q += 6) {
+            auto rect = FaceRect{};
+            const auto quad = &t.Vertices[t.Indices[q]];
+            if (ToFaceRect(quad, rect)) {
+                rects[m].push_back(rect);
+                continue;
+            }
+            for (auto v = 0; v < 6; ++v) {
+                res[m].Indices.push_back(static_cast<short>(res[m].Vertices.size()));
+                res[m].Vertices.push_back(quad[v]);
+                AddCorner(corners, world(quad[v].Pos));
+            }
+        }
+        meshSeams.clear();
+        MergeFaceRects(rects[m], meshSeams);
+        for (const auto& p : meshSeams) AddCorner(seams, world(p));
+        for (const auto& rect : rects[m]) {
+            const int a[] = {(rect.Axis + 1) % 3, (rect.Axis + 2) % 3};
+            for (auto corner = 0u; corner < 4; ++corner) {
+                auto p = Float3{};
+                (&p.x)[rect.Axis] = rect.Plane;
+                (&p.x)[a[0]] = corner & 1u ? rect.Hi[0] : rect.Lo[0];
+                (&p.x)[a[1]] = corner & 2u ? rect.Hi[1] : rect.Lo[1];
+                AddCorner(corners, world(p));
+            }
+        }
+    }
+    SortCorners(corners);
+    SortCorners(seams);
+    for (size_t m = 0; m < meshes.size(); ++m) {
+        auto& mesh = meshes[m];
+        if (mesh.Dynamic) continue;
+        for (const auto& rect : rects[m])
+            stats.EdgeVertices += AppendFaceRect(rect, mesh.Pos, corners, seams, res[m]);
+        stats.TrianglesBefore += mesh.Mesh.Indices.size() / 3;
+        stats.TrianglesAfter += res[m].Indices.size() / 3;
+        mesh.Mesh = std::move(res[m]);
+    }
+    stats.Seconds = CpuSeconds() - start;
+    LOG_INFO("Coplanar face merging: %zu -> %zu triangles, %zu vertices added against "
+             "T-junctions in %.2fms\n",
+             stats.TrianglesBefore, stats.TrianglesAfter, stats.EdgeVertices,
+             1000.0 * stats.Seconds);
+    return stats;
+}
@@ -0,0 +1,90 @@
+// GPU memory accounting, independent of the graphics API
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "core.h"
+
+// Storage of a texture format as Bytes per Size x Size block of texels: 1x1 blocks for formats with
+// a size per texel, 4x4 blocks for block compressed formats
+struct FormatBlock {
+    unsigned Size;
+    size_t Bytes;
+};
+
+// Size of a 2D texture including its mip chain (all of it for mips 0), array slices and samples.
+// Block compressed mips are padded to whole blocks, so the 2x2 and 1x1 mips take a block each.
+inline size_t TextureBytes(unsigned width, unsigned height, unsigned mips, unsigned arraySize,
+                           unsigned samples, FormatBlock format) {
+    if (!mips)
+        for (auto dim = std::max(width, height); dim; dim >>= 1) ++mips;
+    auto blocks = size_t{0};
+    for (auto mip = 0u; mip < mips; ++mip) {
+        const auto w = std::max(1u, width >> mip), h = std::max(1u, height >> mip);
+        blocks +=
+            size_t((w + format.Size - 1) / format.Size) * ((h + format.Size - 1) / format.Size);
+    }
+    return blocks * format.Bytes * arraySize * std::max(1u, samples);
+}
+
+// GPU memory accounting. Every resource we create or receive from LibOVR is tagged with a category
+// and owner. Totals are tracked live along with the high-water mark, and going over the budget
+// (if one is set) logs a warning. Resources can be released on any thread, so the counts are
+// guarded by Lock. Set Budget before tracking starts.
+enum class GpuMemoryCategory { RenderTarget, DepthStencil, Texture, Geometry, Constants, Count };
+
+struct GpuMemoryTracker {
+    std::array<size_t, size_t(GpuMemoryCategory::Count)> Bytes = {};
+    std::vector<std::pair<const char*, size_t>> Owners;
+    size_t Total = 0, HighWater = 0, Budget = 0;
+    mutable std::mutex Lock;
+
+    static const char* Name(GpuMemoryCategory category) {
+        const char* names[] = {"render target", "depth stencil", "texture", "geometry",
+                               "constants"};
+        return names[size_t(category)];
+    }
+
+    // Call with Lock held
+    size_t& OwnerBytes(const char* owner) {
+        auto it = std::find_if(begin(Owners), end(Owners),
+                               [owner](const std::pair<const char*, size_t>& o) {
+                                   return strcmp(o.first, owner) == 0;
+                               });
+        if (it == end(Owners)) it = Owners.insert(end(Owners), {owner, size_t{0}});
+        return it->second;
+    }
+
+    void Add(GpuMemoryCategory category, const char* owner, size_t bytes) {
+        std::lock_guard<std::mutex> lock{Lock};
+        Bytes[size_t(category)] += bytes;
+        OwnerBytes(owner) += bytes;
+        Total += bytes;
+        HighWater = std::max(HighWater, Total);
+        if (Budget && Total > Budget && Total - bytes <= Budget)
+            LOG_WARNING("GPU memory over budget: %zu KB of %zu KB after %zu KB for %s\n",
+                        Total / 1024, Budget / 1024, bytes / 1024, owner);
+    }
+
+    void Remove(GpuMemoryCategory category, const char* owner, size_t bytes) {
+        std::lock_guard<std::mutex> lock{Lock};
+        Bytes[size_t(category)] -= bytes;
+        OwnerBytes(owner) -= bytes;
+        Total -= bytes;
+    }
+
+    void Report() const {
+        std::lock_guard<std::mutex> lock{Lock};
+        LOG_INFO("GPU memory: %zu KB, high-water %zu KB, budget %zu KB\n", Total / 1024,
+                 HighWater / 1024, Budget / 1024);
+        for (auto i = 0u; i < Bytes.size(); ++i)
+            LOG_INFO("  %-14s %8zu KB\n", Name(GpuMemoryCategory(i)), Bytes[i] / 1024);
+        for (const auto& owner : Owners)
+            LOG_INFO("  %-20s %8zu KB\n", owner.first, owner.second / 1024);
+    }
+};
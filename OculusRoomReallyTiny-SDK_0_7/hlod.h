@@ -0,0 +1,214 @@
+// Hierarchical LOD proxies for the cells of large scenes, independent of the graphics API
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "core.h"
+#include "geometry.h"
+#include "vectors.h"
+
+// Hierarchical LOD for large scenes. The static boxes are bucketed into square cells on the floor
+// plan, each cell's boxes becoming separate detail meshes per source mesh, plus one merged proxy
+// mesh per cell that collapses the cell's boxes into a few flat colored bounding slabs: thin boxes
+// sharing a plane (walls with doorways, floors) become one slab and the remaining small boxes one
+// block per 2m. Each eye draws a cell's proxy instead of its detail when the cell's bounding sphere
+// projects smaller than a pixel threshold.
+struct Hlod {
+    struct Cluster {
+        Float3 Center;
+        float Radius;
+        std::vector<size_t> Detail;  // Scene model indices
+        size_t Proxy;
+    };
+    std::vector<Cluster> Clusters;
+    std::vector<MeshDesc> Proxies;  // Appended to the scene meshes by AppendProxies
+    float CellSize = 8.0f;
+
+    // Split the static meshes per cell, the meshes are replaced in place with dynamic meshes kept
+    // first. Done on box geometry, before hidden face removal.
+    void Build(std::vector<MeshDesc>& meshes) {
+        const auto start = CpuSeconds();
+        // Proxies are untextured, so their colors include each texture's average
+        float texAverage[4][3] = {};
+        for (auto fill = 0; fill < 4; ++fill)
+            for (auto y = 0u; y < 256; ++y)
+                for (auto x = 0u; x < 256; ++x)
+                    for (auto ch = 0; ch < 3; ++ch)
+                        texAverage[fill][ch] +=
+                            float((TexturePixel(TextureFill(fill), x, y) >> 8 * ch) & 0xff) /
+                            (256.0f * 256.0f * 255.0f);
+        // Cells start at the scene's minimum corner, so a generated grid gets a cell per room
+        auto originX = FLT_MAX, originZ = FLT_MAX;
+        for (const auto& mesh : meshes)
+            for (const auto& b : mesh.Mesh.Boxes)
+                if (!mesh.Dynamic && !b.Empty()) {
+                    originX = std::min(originX, b.Min.x + mesh.Pos.x);
+                    originZ = std::min(originZ, b.Min.z + mesh.Pos.z);
+                }
+        auto cellOf = [=](const TriangleSet::Box& b, const Float3& pos) {
+            const auto x = (b.Min.x + b.Max.x) / 2 + pos.x - originX;
+            const auto z = (b.Min.z + b.Max.z) / 2 + pos.z - originZ;
+            return std::make_pair(int(std::floor(x / CellSize)), int(std::floor(z / CellSize)));
+        };
+
+        // Detail meshes, one per cell and source mesh
+        std::vector<MeshDesc> res;
+        std::vector<std::pair<int, int>> cells;
+        std::vector<size_t> cellOfMesh;
+        for (const auto& mesh : meshes)
+            if (mesh.Dynamic) res.push_back(mesh);
+        const auto firstDetail = res.size();
+        for (const auto& mesh : meshes) {
+            if (mesh.Dynamic) continue;
+            const auto first = res.size();
+            for (auto b = 0u; b < mesh.Mesh.Boxes.size(); ++b) {
+                if (mesh.Mesh.Boxes[b].Empty()) continue;
+                const auto cell = cellOf(mesh.Mesh.Boxes[b], mesh.Pos);
+                auto cellIndex = size_t(std::find(begin(cells), end(cells), cell) - begin(cells));
+                if (cellIndex == cells.size()) cells.push_back(cell);
+                auto it = std::find(begin(cellOfMesh) + (first - firstDetail), end(cellOfMesh),
+                                    cellIndex);
+                if (it == end(cellOfMesh)) {
+                    res.push_back({TriangleSet{}, mesh.Pos, mesh.Fill, false});
+                    cellOfMesh.push_back(cellIndex);
+                    it = end(cellOfMesh) - 1;
+                }
+                res[firstDetail + (it - begin(cellOfMesh))].Mesh.CopyBox(mesh.Mesh, b);
+            }
+        }
+
+        // Proxy slabs per cell, keyed by source fill, then the thin axis and plane or the 2m block
+        Clusters.assign(cells.size(), Cluster{});
+        Proxies.assign(cells.size(), MeshDesc{TriangleSet{}, {0, 0, 0}, TextureFill::AUTO_WHITE});
+        for (auto c = 0u; c < cells.size(); ++c) {
+            struct Slab {
+                std::tuple<int, int, int, int> Key;
+                Float3 Min, Max;
+                float Color[3];
+                int Count;
+            };
+            std::vector<Slab> slabs;
+            auto lo = Float3{FLT_MAX, FLT_MAX, FLT_MAX}, hi = Float3{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (auto m = firstDetail; m < res.size(); ++m) {
+                if (cellOfMesh[m - firstDetail] != c) continue;
+                Clusters[c].Detail.push_back(m);
+                const auto& mesh = res[m];
+                const auto tex = texAverage[int(mesh.Fill)];
+                for (auto b = 0u; b < mesh.Mesh.Boxes.size(); ++b) {
+                    const auto& box = mesh.Mesh.Boxes[b];
+                    const auto mn = Add(box.Min, mesh.Pos), mx = Add(box.Max, mesh.Pos);
+                    lo = {std::min(lo.x, mn.x), std::min(lo.y, mn.y), std::min(lo.z, mn.z)};
+                    hi = {std::max(hi.x, mx.x), std::max(hi.y, mx.y), std::max(hi.z, mx.z)};
+                    const float extents[] = {mx.x - mn.x, mx.y - mn.y, mx.z - mn.z};
+                    const auto thin = int(std::min_element(extents, extents + 3) - extents);
+                    const auto second = std::max(std::min(extents[(thin + 1) % 3],
+                                                          extents[(thin + 2) % 3]),
+                                                 1e-6f);
+                    const auto key =
+                        extents[thin] <= 0.25f * second
+                            ? std::make_tuple(int(mesh.Fill), thin,
+                                              int(std::floor((&mn.x)[thin] / 0.25f)), 0)
+                            : std::make_tuple(int(mesh.Fill), 3,
+                                              int(std::floor((mn.x + mx.x) / 4.0f)),
+                                              int(std::floor((mn.z + mx.z) / 4.0f)));
+                    float color[3] = {};
+                    for (auto v = 0u; v < TriangleSet::VerticesPerBox; ++v) {
+                        const auto vc = mesh.Mesh.Vertices[b * TriangleSet::VerticesPerBox + v].C;
+                        for (auto ch = 0; ch < 3; ++ch)
+                            color[ch] += float((vc >> (16 - 8 * ch)) & 0xff) /
+                                         TriangleSet::VerticesPerBox * tex[ch];
+                    }
+                    auto slab = std::find_if(begin(slabs), end(slabs),
+                                             [&key](const Slab& s) { return s.Key == key; });
+                    if (slab == end(slabs)) {
+                        slabs.push_back({key, mn, mx, {}, 0});
+                        slab = end(slabs) - 1;
+                    }
+                    slab->Min = {std::min(slab->Min.x, mn.x), std::min(slab->Min.y, mn.y),
+                                 std::min(slab->Min.z, mn.z)};
+                    slab->Max = {std::max(slab->Max.x, mx.x), std::max(slab->Max.y, mx.y),
+                                 std::max(slab->Max.z, mx.z)};
+                    for (auto ch = 0; ch < 3; ++ch) slab->Color[ch] += color[ch];
+                    ++slab->Count;
+                }
+            }
+            auto& proxy = Proxies[c].Mesh;
+            proxy.BakeLighting = false;
+            for (const auto& slab : slabs) {
+                auto channel = [&slab](int ch) {
+                    return uint32_t(std::min(255.0f, slab.Color[ch] / slab.Count)) << (16 - 8 * ch);
+                };
+                proxy.AddBox(slab.Min.x, slab.Min.y, slab.Min.z, slab.Max.x, slab.Max.y,
+                             slab.Max.z, 0xff000000 | channel(0) | channel(1) | channel(2));
+            }
+            Clusters[c].Center = Scale(Add(lo, hi), 0.5f);
+            Clusters[c].Radius = 0.5f * Length(Subtract(hi, lo));
+        }
+
+        auto triangles = [](const std::vector<MeshDesc>& ms, size_t first) {
+            auto count = size_t{0};
+            for (auto m = first; m < ms.size(); ++m) count += ms[m].Mesh.Indices.size() / 3;
+            return count;
+        };
+        LOG_INFO("HLOD build: %zu cells, detail %zu triangles in %zu draws, proxies %zu triangles "
+                 "in %zu draws, %.2fms\n",
+                 Clusters.size(), triangles(res, firstDetail), res.size() - firstDetail,
+                 triangles(Proxies, 0), Proxies.size(),
+                 1000.0 * (CpuSeconds() - start));
+        meshes = std::move(res);
+    }
+
+    // Add the proxies after the meshes have been through any further processing
+    void AppendProxies(std::vector<MeshDesc>& meshes) {
+        for (auto c = 0u; c < Clusters.size(); ++c) {
+            Clusters[c].Proxy = meshes.size();
+            meshes.push_back(std::move(Proxies[c]));
+        }
+        Proxies.clear();
+    }
+
+    // Choose detail or proxy for every cell as seen from an eye, marking the chosen meshes in
+    // visible. Returns the number of proxies.
+    size_t Select(std::vector<bool>& visible, const Float3& eye, float pixelsPerTan,
+                  float thresholdPixels) const {
+        auto proxies = size_t{0};
+        for (const auto& cluster : Clusters) {
+            const auto distance = Length(Subtract(cluster.Center, eye));
+            const auto useProxy = distance > cluster.Radius &&
+                                  2 * cluster.Radius / distance * pixelsPerTan < thresholdPixels;
+            for (auto m : cluster.Detail) visible[m] = !useProxy;
+            visible[cluster.Proxy] = useProxy;
+            proxies += useProxy ? 1 : 0;
+        }
+        return proxies;
+    }
+
+    // Draws and triangles from one viewpoint with and without proxies
+    void ReportSavings(const std::vector<MeshDesc>& meshes, std::vector<bool>& visible,
+                       const Float3& eye, float pixelsPerTan, float threshold) const {
+        Select(visible, eye, pixelsPerTan, threshold);
+        auto draws = size_t{0}, triangles = size_t{0}, fullDraws = size_t{0},
+             fullTriangles = size_t{0};
+        for (auto m = size_t{0}; m < meshes.size(); ++m) {
+            const auto isProxy = std::any_of(begin(Clusters), end(Clusters),
+                                             [m](const Cluster& c) { return c.Proxy == m; });
+            const auto count = meshes[m].Mesh.Indices.size() / 3;
+            if (!isProxy) {
+                ++fullDraws;
+                fullTriangles += count;
+            }
+            if (visible[m]) {
+                ++draws;
+                triangles += count;
+            }
+        }
+        LOG_INFO("HLOD from the start position: %zu -> %zu draws, %zu -> %zu triangles\n",
+                 fullDraws, draws, fullTriangles, triangles);
+    }
+};
@@ -0,0 +1,51 @@
+// Keyboard input as a stream of timestamped events, independent of any window
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "core.h"
+
+struct KeyEvent {
+    double Time;   // Seconds when the message was handled, on the clock Drain is given
+    unsigned Key;  // Virtual key code
+    bool Down;
+};
+
+// Where the simulation gets its key events from
+struct InputSource {
+    virtual bool Poll(KeyEvent& event) = 0;
+
+protected:
+    ~InputSource() = default;
+};
+
+// Key events queued by the window's message thread for the render thread
+struct KeyEventQueue : InputSource {
+    SpscRing<KeyEvent, 256> Ring;
+    std::atomic<size_t> Dropped{0};  // Events lost to a full ring
+
+    void Push(const KeyEvent& event) {
+        if (!Ring.Push(event)) ++Dropped;
+    }
+    bool Poll(KeyEvent& event) override { return Ring.Pop(event); }
+};
+
+// Key state rebuilt from an event stream
+struct KeyboardState {
+    bool Keys[256] = {};
+    size_t Events = 0;     // Events applied by the last Drain
+    double Latency = 0.0;  // Summed queue time of those events in seconds
+
+    void Apply(const KeyEvent& event) { Keys[event.Key & 0xff] = event.Down; }
+
+    // Apply all pending events in order
+    void Drain(InputSource& source, double now) {
+        Events = 0;
+        Latency = 0.0;
+        for (auto event = KeyEvent{}; source.Poll(event); ++Events) {
+            Apply(event);
+            Latency += now - event.Time;
+        }
+    }
+};
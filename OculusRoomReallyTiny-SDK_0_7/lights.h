@@ -0,0 +1,167 @@
+// Dynamic point lights and their per eye cluster assignment for clustered forward lighting
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "geometry.h"
+#include "vectors.h"
+
+// Clustered forward lighting. The eye frustum is split into a froxel grid, tiles in tangent space
+// across the eye fov times exponentially spaced depth slices, and each light is binned into every
+// cluster its bounding box touches. The pixel shader finds its cluster from its view space position
+// and only evaluates that cluster's lights.
+struct PointLight {
+    Float3 Pos;
+    float Radius;
+    Float3 Color;
+    Float3 Orbit;  // Center of the circle the light moves around
+    float OrbitRadius, Phase;
+};
+
+struct LightClusters {
+    enum { TilesX = 16, TilesY = 8, Slices = 24, Count = TilesX * TilesY * Slices };
+    enum { IndexCapacity = Count * 64 };  // Lights beyond this are dropped from the furthest slices
+    struct Bounds {
+        int X0, X1, Y0, Y1, S0, S1;  // Inclusive cluster ranges, empty when S0 > S1
+    };
+    struct Range {
+        uint32_t Offset, Count;  // Into Indices
+    };
+
+    FovTangents Fov;
+    float Near = 0.2f, Far = 100.0f;
+    std::vector<Float4> ViewLights;  // View space position and radius, color, per light
+    std::vector<Range> Ranges;       // Per cluster
+    std::vector<uint32_t> Indices;
+    std::vector<uint32_t> Counts;
+    std::vector<Bounds> LightBounds;
+    size_t Assigned = 0, Dropped = 0;
+
+    // Fov is an ovrFovPort or anything else with the same tangents
+    template <typename FovPort>
+    explicit LightClusters(const FovPort& fov)
+        : Fov{fov.UpTan, fov.DownTan, fov.LeftTan, fov.RightTan},
+          Ranges(Count),
+          Indices(IndexCapacity),
+          Counts(Count) {}
+
+    float SliceScale() const { return float(Slices) / std::log(Far / Near); }
+
+    // Bin lights in three passes: count lights per cluster, prefix sum the counts into offsets,
+    // then fill the index list. Storage is reused so building doesn't allocate after the first
+    // frame with a given number of lights.
+    void Build(const std::vector<PointLight>& lights, const Pose& eye) {
+        ViewLights.resize(2 * lights.size());
+        LightBounds.resize(lights.size());
+        std::fill(begin(Counts), end(Counts), 0u);
+
+        // Tangent space to tile scale and offset, lanes are min x, max x, min y, max y
+        const auto xScale = float(TilesX) / (Fov.LeftTan + Fov.RightTan);
+        const auto yScale = float(TilesY) / (Fov.DownTan + Fov.UpTan);
+        const float tileScale[] = {xScale, xScale, yScale, yScale};
+        const float tileOffset[] = {Fov.LeftTan, Fov.LeftTan, Fov.DownTan, Fov.DownTan};
+        const float tileMax[] = {float(TilesX - 1), float(TilesX - 1), float(TilesY - 1),
+                                 float(TilesY - 1)};
+        const auto sliceScale = SliceScale();
+        for (auto i = size_t{0}; i < lights.size(); ++i) {
+            const auto& light = lights[i];
+            const auto pos = ToView(eye, light.Pos);
+            ViewLights[2 * i] = {pos.x, pos.y, pos.z, light.Radius};
+            ViewLights[2 * i + 1] = {light.Color.x, light.Color.y, light.Color.z, 0.0f};
+
+            auto& b = LightBounds[i];
+            b = {0, -1, 0, -1, 0, -1};
+            const auto r = light.Radius, depth = -pos.z;
+            const auto zNear = std::max(depth - r, Near), zFar = std::min(depth + r, Far);
+            if (zNear > zFar) continue;
+            // x / z and y / z over the light's bounding box are extremal at its corners, so the
+            // tangent bounds come from the box extents divided by the near and far depths. The
+            // lanes are independent so the loop vectorizes.
+            const float extents[] = {pos.x - r, pos.x + r, pos.y - r, pos.y + r};
+            float tiles[4];
+            for (auto lane = 0; lane < 4; ++lane) {
+                const auto atNear = extents[lane] / zNear, atFar = extents[lane] / zFar;
+                const auto tangent = lane & 1 ? std::max(atNear, atFar) : std::min(atNear, atFar);
+                tiles[lane] = std::floor((tangent + tileOffset[lane]) * tileScale[lane]);
+            }
+            if (tiles[1] < 0 || tiles[0] >= float(TilesX) || tiles[3] < 0 ||
+                tiles[2] >= float(TilesY))
+                continue;
+            for (auto lane = 0; lane < 4; ++lane)
+                tiles[lane] = std::min(std::max(tiles[lane], 0.0f), tileMax[lane]);
+            b = {int(tiles[0]), int(tiles[1]), int(tiles[2]), int(tiles[3]),
+                 std::min(int(std::log(zNear / Near) * sliceScale), Slices - 1),
+                 std::min(int(std::log(zFar / Near) * sliceScale), Slices - 1)};
+            for (auto s = b.S0; s <= b.S1; ++s)
+                for (auto y = b.Y0; y <= b.Y1; ++y)
+                    for (auto x = b.X0; x <= b.X1; ++x) ++Counts[(s * TilesY + y) * TilesX + x];
+        }
+
+        auto offset = 0u;
+        Dropped = 0;
+        for (auto c = 0; c < Count; ++c) {
+            const auto count = std::min(Counts[c], unsigned(IndexCapacity) - offset);
+            Dropped += Counts[c] - count;
+            Counts[c] = count;
+            Ranges[c] = {offset, 0};
+            offset += count;
+        }
+        Assigned = offset;
+
+        for (auto i = size_t{0}; i < lights.size(); ++i) {
+            const auto& b = LightBounds[i];
+            for (auto s = b.S0; s <= b.S1; ++s)
+                for (auto y = b.Y0; y <= b.Y1; ++y)
+                    for (auto x = b.X0; x <= b.X1; ++x) {
+                        const auto c = (s * TilesY + y) * TilesX + x;
+                        auto& range = Ranges[c];
+                        if (range.Count < Counts[c])
+                            Indices[range.Offset + range.Count++] = uint32_t(i);
+                    }
+        }
+    }
+};
+
+// The three lights previously baked into vertex colors, then randomly colored lights orbiting
+// points inside the bounds of the static meshes
+inline auto CreateLights(int count, const std::vector<MeshDesc>& meshes) {
+    auto lo = Float3{FLT_MAX, FLT_MAX, FLT_MAX}, hi = Float3{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (const auto& mesh : meshes) {
+        if (mesh.Dynamic) continue;
+        for (const auto& v : mesh.Mesh.Vertices) {
+            const auto p = Float3{v.Pos.x + mesh.Pos.x, v.Pos.y + mesh.Pos.y, v.Pos.z + mesh.Pos.z};
+            lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+            hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+        }
+    }
+    auto random = [](float a, float b) { return a + (b - a) * float(rand()) / RAND_MAX; };
+    std::vector<PointLight> res = {
+        {{-2.0f, 4.0f, -2.0f}, 12.0f, {0.6f, 0.6f, 0.6f}, {-2.0f, 4.0f, -2.0f}, 0.0f, 0.0f},
+        {{3.0f, 4.0f, -3.0f}, 12.0f, {0.6f, 0.6f, 0.6f}, {3.0f, 4.0f, -3.0f}, 0.0f, 0.0f},
+        {{-4.0f, 3.0f, 25.0f}, 30.0f, {0.4f, 0.4f, 0.4f}, {-4.0f, 3.0f, 25.0f}, 0.0f, 0.0f}};
+    res.resize(std::max(size_t(count), res.size()));
+    for (auto i = size_t{3}; i < res.size(); ++i) {
+        const auto orbit = Float3{random(lo.x, hi.x), random(lo.y + 0.3f, hi.y - 0.3f),
+                                  random(lo.z, hi.z)};
+        res[i] = {orbit,
+                  random(1.5f, 4.0f),
+                  {random(0.2f, 1.0f), random(0.2f, 1.0f), random(0.2f, 1.0f)},
+                  orbit,
+                  random(0.5f, 2.0f),
+                  random(0.0f, 2.0f * Pi)};
+    }
+    return res;
+}
+
+inline void AnimateLights(std::vector<PointLight>& lights, float time) {
+    for (auto& light : lights) {
+        const auto angle = time + light.Phase;
+        light.Pos = {light.Orbit.x + light.OrbitRadius * std::cos(angle), light.Orbit.y,
+                     light.Orbit.z + light.OrbitRadius * std::sin(angle)};
+    }
+}
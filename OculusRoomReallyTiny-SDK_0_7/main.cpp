@@ -26,9 +26,23 @@ limitations under the License.
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
+#include <future>
 #include <initializer_list>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
@@ -40,19 +54,50 @@ limitations under the License.
 
 #include <OVR_CAPI_D3D.h>
 
+#include "capture.h"
+#include "core.h"
+#include "geometry.h"
+#include "gpu_memory.h"
+#include "hlod.h"
+#include "input.h"
+#include "lights.h"
+#include "pacing.h"
+#include "pvs.h"
+#include "raster.h"
+#include "raycast.h"
+#include "render_graph.h"
+#include "rooms.h"
+#include "telemetry.h"
+
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "dxgi.lib")
 
 using namespace DirectX;
 
-#ifndef VALIDATE
-#define VALIDATE(x, msg)                                                  \
-    if (!(x)) {                                                           \
-        MessageBoxA(NULL, (msg), "OculusRoomTiny", MB_ICONERROR | MB_OK); \
-        exit(-1);                                                         \
-    }
-#endif
+// Cost of a log call on the calling thread. Runs on its own thread with a private logger that
+// formats records without writing them, flushing between batches so the ring never fills.
+void BenchmarkLogger(int batches = 200) {
+    Logger logger{false};
+    const auto perBatch = 512;
+    auto callSeconds = 0.0, flushSeconds = 0.0;
+    std::thread{[&] {
+        for (auto b = 0; b < batches; ++b) {
+            auto start = CpuSeconds();
+            for (auto i = 0; i < perBatch; ++i)
+                logger.Write(LogLevel::Info, "Frame %u: %.3fms, %zu draws\n", unsigned(i), 11.1,
+                             size_t(42));
+            callSeconds += CpuSeconds() - start;
+            start = CpuSeconds();
+            logger.Flush();
+            flushSeconds += CpuSeconds() - start;
+        }
+    }}.join();
+    const auto calls = double(batches) * perBatch;
+    LOG_INFO("Logger benchmark: %.1fns per log call, flushes %.1fns per record, disabled "
+             "levels compile out\n",
+             1e9 * callSeconds / calls, 1e9 * flushSeconds / calls);
+}
 
 // Define _com_ptr_t COM smart pointer typedefs for all the D3D and DXGI interfaces we use
 #define COM_SMARTPTR_TYPEDEF(x) _COM_SMARTPTR_TYPEDEF(x, __uuidof(x))
@@ -64,6 +109,7 @@ COM_SMARTPTR_TYPEDEF(ID3D11Device);
 COM_SMARTPTR_TYPEDEF(ID3D11DeviceContext);
 COM_SMARTPTR_TYPEDEF(ID3D11InputLayout);
 COM_SMARTPTR_TYPEDEF(ID3D11PixelShader);
+COM_SMARTPTR_TYPEDEF(ID3D11Query);
 COM_SMARTPTR_TYPEDEF(ID3D11RasterizerState);
 COM_SMARTPTR_TYPEDEF(ID3D11RenderTargetView);
 COM_SMARTPTR_TYPEDEF(ID3D11SamplerState);
@@ -76,60 +122,282 @@ COM_SMARTPTR_TYPEDEF(IDXGIDevice1);
 COM_SMARTPTR_TYPEDEF(IDXGIFactory);
 COM_SMARTPTR_TYPEDEF(IDXGISwapChain);
 
+// Command line options, e.g. "-multires -depthprepass -mirror=single -mirrorevery=4 -lights=1000"
+enum class MirrorMode { Off, Full, SingleEye };
+
+struct Options {
+    bool MultiRes = false;
+    bool DepthPrePass = false;
+    MirrorMode Mirror = MirrorMode::Full;
+    int MirrorEvery = 1;            // Update the mirror window every Nth frame
+    int MirrorDivisor = 1;          // Mirror resolution divisor
+    bool CheckAllocations = false;  // Fail if a frame allocates from the heap after warm up
+    int GpuBudgetMB = 0;            // Warn when tracked GPU memory exceeds this, 0 for no budget
+    bool Benchmark = false;         // Run startup benchmarks
+    int Rooms = 0;                  // Generated grid of Rooms x Rooms, 0 for the default room
+    int Lights = 0;                 // Clustered dynamic point lights, 0 for baked lighting
+    bool BakeAO = false;            // Bake ray traced ambient occlusion into vertex colors
+    int HlodPixels = 0;             // Draw cells smaller than this on screen as proxies, 0 off
+    bool Portals = false;           // Cull meshes in cells not seen through portals
+    bool Pvs = false;               // Cull meshes outside the camera cell's baked visible set
+    bool Telemetry = false;         // Publish per frame counters for telemetry_reader
+    bool Capture = false;           // Write the eye buffers and mirror to PNG files on F12
+    int CaptureEvery = 0;           // Also capture every Nth frame, 0 for only on F12
+
+    explicit Options(const char* cmdLine) {
+        auto has = [cmdLine](const char* opt) { return strstr(cmdLine, opt) != nullptr; };
+        auto value = [cmdLine](const char* opt, int def) {
+            const auto p = strstr(cmdLine, opt);
+            return p ? std::max(1, atoi(p + strlen(opt))) : def;
+        };
+        MultiRes = has("-multires");
+        DepthPrePass = has("-depthprepass");
+        Mirror = has("-mirror=off") ? MirrorMode::Off
+                                    : has("-mirror=single") ? MirrorMode::SingleEye : Mirror;
+        MirrorEvery = value("-mirrorevery=", MirrorEvery);
+        MirrorDivisor = value("-mirrorscale=", MirrorDivisor);
+        CheckAllocations = has("-checkallocs");
+        GpuBudgetMB = value("-gpubudget=", GpuBudgetMB);
+        Benchmark = has("-bench");
+        Rooms = has("-rooms=") ? value("-rooms=", 1) : 0;
+        Lights = has("-lights=") ? value("-lights=", 1) : 0;
+        BakeAO = has("-ao");
+        HlodPixels = has("-hlod") ? value("-hlod=", 100) : 0;
+        Portals = has("-portals");
+        Pvs = has("-pvs");
+        Telemetry = has("-telemetry");
+        Capture = has("-capture");
+        CaptureEvery = has("-capture=") ? value("-capture=", 1) : 0;
+    }
+};
+
+// Performance counters accumulated over a number of frames, Report() logs per frame averages
+struct FrameStats {
+    unsigned Frames = 0;
+    double EyeCpuSeconds = 0.0, EyeGpuSeconds = 0.0;
+    size_t Draws = 0, Layers = 0, ShadedPixels = 0, FullPixels = 0;
+    double MirrorCpuSeconds = 0.0, MirrorGpuSeconds = 0.0;
+    size_t MirrorPresents = 0;
+    size_t Allocations = 0, AllocatedBytes = 0;
+    double LightCpuSeconds = 0.0;
+    size_t LightAssignments = 0;
+    size_t HlodProxies = 0, HlodCells = 0;
+    double PortalCpuSeconds = 0.0;
+    size_t PortalVisibleCells = 0, PortalCells = 0;
+    size_t PvsHidden = 0, PvsModels = 0;
+    size_t InputEvents = 0;
+    double InputLatencySeconds = 0.0;
+    size_t CulledModels = 0, Models = 0, UploadedBytes = 0;
+    double FrameSeconds = 0.0;  // CPU time from frame start to the end of the frame
+    double CaptureCpuSeconds = 0.0, CaptureGpuSeconds = 0.0, CaptureFrameSeconds = 0.0;
+    size_t Captures = 0, CapturesDropped = 0, CaptureFrames = 0;
+
+    void Report() {
+        if (!Frames) return;
+        LOG_INFO("Frame stats: eye cpu %.3fms gpu %.3fms, %.1f draws, %.1f layers, %.1f%% of "
+                 "full resolution pixels shaded\n",
+                 1000.0 * EyeCpuSeconds / Frames, 1000.0 * EyeGpuSeconds / Frames,
+                 double(Draws) / Frames, double(Layers) / Frames,
+                 100.0 * double(ShadedPixels) / double(std::max<size_t>(FullPixels, 1)));
+        LOG_INFO("Mirror stats: cpu %.3fms gpu %.3fms per frame, %zu of %u frames presented\n",
+                 1000.0 * MirrorCpuSeconds / Frames, 1000.0 * MirrorGpuSeconds / Frames,
+                 MirrorPresents, Frames);
+        LOG_INFO("Heap stats: %.2f allocations, %.1f bytes per frame\n",
+                 double(Allocations) / Frames, double(AllocatedBytes) / Frames);
+        LOG_INFO("Upload stats: %.1f KB per frame, %.1f of %.1f models culled per frame\n",
+                 double(UploadedBytes) / 1024 / Frames, double(CulledModels) / Frames,
+                 double(Models) / Frames);
+        if (LightAssignments)
+            LOG_INFO("Light stats: cluster build and upload %.3fms, %.1f light assignments per "
+                     "frame\n",
+                     1000.0 * LightCpuSeconds / Frames, double(LightAssignments) / Frames);
+        if (HlodCells)
+            LOG_INFO("HLOD stats: %.1f%% of cells drawn as proxies\n",
+                     100.0 * double(HlodProxies) / double(HlodCells));
+        if (PortalCells)
+            LOG_INFO("Portal stats: traversal %.3fms per frame, %.1f%% of cells visible\n",
+                     1000.0 * PortalCpuSeconds / Frames,
+                     100.0 * double(PortalVisibleCells) / double(PortalCells));
+        if (InputEvents)
+            LOG_INFO("Input stats: %.2f key events per frame, %.3fms average queue latency\n",
+                     double(InputEvents) / Frames,
+                     1000.0 * InputLatencySeconds / double(InputEvents));
+        if (PvsModels)
+            LOG_INFO("PVS stats: %.1f%% of models culled\n",
+                     100.0 * double(PvsHidden) / double(PvsModels));
+        if (CaptureFrames)
+            LOG_INFO("Capture stats: %zu captured, %zu dropped, %.3fms cpu %.3fms gpu per capture "
+                     "frame, frame cpu %.3fms while capturing vs %.3fms otherwise\n",
+                     Captures, CapturesDropped, 1000.0 * CaptureCpuSeconds / double(CaptureFrames),
+                     1000.0 * CaptureGpuSeconds / double(CaptureFrames),
+                     1000.0 * CaptureFrameSeconds / double(CaptureFrames),
+                     Frames > CaptureFrames ? 1000.0 * (FrameSeconds - CaptureFrameSeconds) /
+                                                  double(Frames - CaptureFrames)
+                                            : 0.0);
+        *this = FrameStats{};
+    }
+};
+
+// Ctrl+Q or Escape
+bool QuitRequested(const KeyboardState& keyboard) {
+    const auto& keys = keyboard.Keys;
+    return (keys['Q'] && keys[VK_CONTROL]) || keys[VK_ESCAPE];
+}
+
+// Waiting for a lost HMD to come back. Presence is probed with ovr_GetHmdDesc(nullptr), which needs
+// no session or device, with exponentially growing waits between probes. Setting Wake, as the
+// window does on a device change, cuts the current wait short so a replug is seen at once.
+struct Reconnect {
+    HANDLE Wake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    double MinDelay = 0.01, MaxDelay = 2.0;
+    unsigned Probes = 0;
+
+    Reconnect() = default;
+    Reconnect(const Reconnect&) = delete;
+    Reconnect& operator=(const Reconnect&) = delete;
+    ~Reconnect() { CloseHandle(Wake); }
+
+    static bool HmdPresent() { return ovr_GetHmdDesc(nullptr).Type != ovrHmd_None; }
+
+    // Probe until present() or until keepWaiting() is false, returns whether it came back
+    template <typename Present, typename KeepWaiting>
+    bool Wait(Present present, KeepWaiting keepWaiting) {
+        Probes = 0;
+        for (auto delay = MinDelay;; delay = std::min(2 * delay, MaxDelay)) {
+            ++Probes;
+            if (present()) return true;
+            if (!keepWaiting()) return false;
+            WaitForSingleObject(Wake, DWORD(delay * 1000.0));
+        }
+    }
+};
+
+// Reconnect latency and CPU use against a stand-in runtime whose HMD is unplugged for a while and
+// then replugged. Compares the old loop, which paid for a full rebuild attempt every 10ms, with
+// backoff probing with and without the device change wake.
+void BenchmarkReconnect(double unpluggedSeconds = 0.5, double rebuildSeconds = 0.005) {
+    auto processSeconds = [] {
+        FILETIME creation, exited, kernel, user;
+        GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user);
+        auto seconds = [](const FILETIME& t) {
+            return double((ULONGLONG(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7;
+        };
+        return seconds(kernel) + seconds(user);
+    };
+    const char* names[] = {"retry every 10ms", "backoff", "backoff with wake"};
+    for (auto mode = 0; mode < 3; ++mode) {
+        Reconnect reconnect;
+        std::atomic<bool> plugged{false};
+        std::atomic<double> replugTime{0.0};
+        std::thread runtime{[&] {
+            std::this_thread::sleep_for(std::chrono::duration<double>(unpluggedSeconds));
+            replugTime = CpuSeconds();
+            plugged = true;
+            if (mode == 2) SetEvent(reconnect.Wake);
+        }};
+        const auto cpuStart = processSeconds();
+        auto attempts = 0u;
+        if (mode == 0) {
+            // Each attempt spins for the cost of building the device and swap chains, then fails
+            for (;; ++attempts) {
+                const auto end = CpuSeconds() + rebuildSeconds;
+                while (CpuSeconds() < end) {
+                }
+                if (plugged) break;
+                Sleep(10);
+            }
+        } else {
+            reconnect.Wait([&plugged] { return bool(plugged); }, [] { return true; });
+            attempts = reconnect.Probes;
+        }
+        const auto latency = CpuSeconds() - replugTime;
+        const auto cpu = processSeconds() - cpuStart;
+        runtime.join();
+        LOG_INFO("Reconnect benchmark, %s: %.1fms after replug, %u attempts, %.1fms CPU\n",
+                 names[mode], 1000.0 * latency, attempts, 1000.0 * cpu);
+    }
+}
+
+// The window and its message pump live on their own thread, so message bursts never stall
+// rendering. Key messages become timestamped events in Input for the render thread to drain, and
+// device changes wake a pending HMD reconnect.
 struct Window {
     HWND Hwnd = nullptr;
-    bool Running = false;
-    bool Keys[256] = {};
+    std::atomic<bool> Running{false};
+    KeyEventQueue Input;
+    KeyboardState PumpKeys;  // The message thread's own view, for the quit keys
+    Reconnect Reconnection;
+    std::thread Pump;
 
     static LRESULT CALLBACK WindowProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam) {
         auto p = reinterpret_cast<Window*>(GetWindowLongPtr(hWnd, 0));
         switch (Msg) {
             case WM_KEYDOWN:
-                p->Keys[wParam] = true;
-                break;
-            case WM_KEYUP:
-                p->Keys[wParam] = false;
+            case WM_KEYUP: {
+                const auto event =
+                    KeyEvent{ovr_GetTimeInSeconds(), unsigned(wParam), Msg == WM_KEYDOWN};
+                p->PumpKeys.Apply(event);
+                p->Input.Push(event);
                 break;
+            }
             case WM_DESTROY:
                 p->Running = false;
+                SetEvent(p->Reconnection.Wake);
+                PostQuitMessage(0);
                 break;
+            case WM_DEVICECHANGE:
+                SetEvent(p->Reconnection.Wake);
+                return DefWindowProcW(hWnd, Msg, wParam, lParam);
             default:
                 return DefWindowProcW(hWnd, Msg, wParam, lParam);
         }
-        if ((p->Keys['Q'] && p->Keys[VK_CONTROL]) || p->Keys[VK_ESCAPE]) {
+        if (QuitRequested(p->PumpKeys)) {
             p->Running = false;
+            SetEvent(p->Reconnection.Wake);
         }
         return 0;
     }
 
     Window(HINSTANCE hinst, LPCWSTR title) : Running{true} {
-        WNDCLASSW wc{};
-        wc.lpszClassName = L"App";
-        wc.style = CS_OWNDC;
-        wc.lpfnWndProc = WindowProc;
-        wc.cbWndExtra = sizeof(this);
-        RegisterClassW(&wc);
-
-        // adjust the window size and show at InitDevice time
-        Hwnd =
-            CreateWindowW(wc.lpszClassName, title, WS_OVERLAPPEDWINDOW, 0, 0, 0, 0, 0, 0, hinst, 0);
-
-        SetWindowLongPtr(Hwnd, 0, reinterpret_cast<LONG_PTR>(this));
+        std::promise<HWND> created;
+        auto hwnd = created.get_future();
+        Pump = std::thread{[this, hinst, title, &created] {
+            WNDCLASSW wc{};
+            wc.lpszClassName = L"App";
+            wc.style = CS_OWNDC;
+            wc.lpfnWndProc = WindowProc;
+            wc.cbWndExtra = sizeof(this);
+            RegisterClassW(&wc);
+
+            // adjust the window size and show at InitDevice time
+            const auto window = CreateWindowW(wc.lpszClassName, title, WS_OVERLAPPEDWINDOW, 0, 0,
+                                              0, 0, 0, 0, hinst, 0);
+            SetWindowLongPtr(window, 0, reinterpret_cast<LONG_PTR>(this));
+            created.set_value(window);
+
+            MSG msg{};
+            while (GetMessage(&msg, nullptr, 0U, 0U) > 0) {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+            Running = false;
+        }};
+        Hwnd = hwnd.get();
     }
 
-    auto HandleMessages() const {
-        MSG msg{};
-        while (PeekMessage(&msg, nullptr, 0U, 0U, PM_REMOVE)) {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
-        return Running;
+    ~Window() {
+        PostMessage(Hwnd, WM_CLOSE, 0, 0);
+        Pump.join();
     }
 
-    void Run(ovrResult (*MainLoop)(const Window& window)) const {
+    // Messages are handled on the pump thread, this only reports whether to keep going
+    bool HandleMessages() const { return Running; }
+
+    void Run(ovrResult (*MainLoop)(Window& window, const Options& options),
+             const Options& options) {
         auto tryReinit = false;
         while (HandleMessages()) {
-            auto res = MainLoop(*this);
+            auto res = MainLoop(*this, options);
             // Try and reinit if display lost, otherwise this is a hard error
             tryReinit = res == ovrError_DisplayLost ? true : tryReinit;
             if (!tryReinit) {
@@ -138,25 +406,161 @@ struct Window {
                 VALIDATE(OVR_SUCCESS(res), errorInfo.ErrorString);
                 break;
             }
-            // Sleep a bit before retrying to reduce CPU load while the HMD is disconnected
-            Sleep(10);
+            // Rebuild only once the HMD is back, probing for it without a session meanwhile
+            const auto lost = CpuSeconds();
+            if (!Reconnection.Wait(Reconnect::HmdPresent, [this] { return HandleMessages(); }))
+                break;
+            LOG_INFO("HMD reconnect: present after %.3fs and %u probes\n", CpuSeconds() - lost,
+                     Reconnection.Probes);
         }
     }
 };
 
+// Storage of the formats we create. Render targets and the other formats with a size per texel are
+// 1x1 blocks, block compressed formats are 4x4 blocks of 8 or 16 bytes.
+FormatBlock TextureFormatBlock(DXGI_FORMAT format) {
+    switch (format) {
+        case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        case DXGI_FORMAT_R32G32B32A32_UINT: return {1, 16};
+        case DXGI_FORMAT_R32G32B32_FLOAT: return {1, 12};
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        case DXGI_FORMAT_R32G32_FLOAT:
+        case DXGI_FORMAT_R32G32_UINT: return {1, 8};
+        case DXGI_FORMAT_R16_UINT: return {1, 2};
+        case DXGI_FORMAT_BC1_TYPELESS:
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC1_UNORM_SRGB:
+        case DXGI_FORMAT_BC4_TYPELESS:
+        case DXGI_FORMAT_BC4_UNORM:
+        case DXGI_FORMAT_BC4_SNORM: return {4, 8};
+        case DXGI_FORMAT_BC2_TYPELESS:
+        case DXGI_FORMAT_BC2_UNORM:
+        case DXGI_FORMAT_BC2_UNORM_SRGB:
+        case DXGI_FORMAT_BC3_TYPELESS:
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC3_UNORM_SRGB:
+        case DXGI_FORMAT_BC5_TYPELESS:
+        case DXGI_FORMAT_BC5_UNORM:
+        case DXGI_FORMAT_BC5_SNORM:
+        case DXGI_FORMAT_BC6H_TYPELESS:
+        case DXGI_FORMAT_BC6H_UF16:
+        case DXGI_FORMAT_BC6H_SF16:
+        case DXGI_FORMAT_BC7_TYPELESS:
+        case DXGI_FORMAT_BC7_UNORM:
+        case DXGI_FORMAT_BC7_UNORM_SRGB: return {4, 16};
+        default: return {1, 4};
+    }
+}
+
+// Accounted size of a texture created from desc
+size_t TextureBytes(const D3D11_TEXTURE2D_DESC& desc) {
+    return TextureBytes(desc.Width, desc.Height, desc.MipLevels, desc.ArraySize,
+                        desc.SampleDesc.Count, TextureFormatBlock(desc.Format));
+}
+
+GpuMemoryTracker& GpuMemory() {
+    static GpuMemoryTracker tracker;
+    return tracker;
+}
+
+// Attached to each tracked resource as private data. The resource holds the only reference so the
+// token is released, and the memory accounted as freed, when the resource is destroyed.
+struct GpuAllocationToken : IUnknown {
+    ULONG RefCount = 1;
+    GpuMemoryCategory Category;
+    const char* Owner;
+    size_t Bytes;
+
+    GpuAllocationToken(GpuMemoryCategory category, const char* owner, size_t bytes)
+        : Category{category}, Owner{owner}, Bytes{bytes} {
+        GpuMemory().Add(Category, Owner, Bytes);
+    }
+    virtual ~GpuAllocationToken() { GpuMemory().Remove(Category, Owner, Bytes); }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override {
+        *object = riid == __uuidof(IUnknown) ? this : nullptr;
+        if (!*object) return E_NOINTERFACE;
+        AddRef();
+        return S_OK;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return ++RefCount; }
+    ULONG STDMETHODCALLTYPE Release() override {
+        const auto res = --RefCount;
+        if (!res) delete this;
+        return res;
+    }
+};
+
+// {5B1D3A6E-2C7F-4E38-9A41-7D0C6F2E8B93}
+const GUID GpuAllocationTokenGuid = {
+    0x5b1d3a6e, 0x2c7f, 0x4e38, {0x9a, 0x41, 0x7d, 0x0c, 0x6f, 0x2e, 0x8b, 0x93}};
+
+void TrackGpuMemory(ID3D11DeviceChild* resource, GpuMemoryCategory category, const char* owner,
+                    size_t bytes) {
+    auto token = new GpuAllocationToken{category, owner, bytes};
+    resource->SetPrivateDataInterface(GpuAllocationTokenGuid, token);
+    token->Release();
+}
+
+auto CreateTrackedTexture2D(ID3D11Device* device, const D3D11_TEXTURE2D_DESC& desc,
+                            const D3D11_SUBRESOURCE_DATA* data, GpuMemoryCategory category,
+                            const char* owner) {
+    ID3D11Texture2DPtr tex;
+    VALIDATE(SUCCEEDED(device->CreateTexture2D(&desc, data, &tex)), "CreateTexture2D failed");
+    TrackGpuMemory(tex, category, owner, TextureBytes(desc));
+    return tex;
+}
+
+auto CreateTrackedBuffer(ID3D11Device* device, const D3D11_BUFFER_DESC& desc,
+                         const D3D11_SUBRESOURCE_DATA* data, GpuMemoryCategory category,
+                         const char* owner) {
+    ID3D11BufferPtr buffer;
+    VALIDATE(SUCCEEDED(device->CreateBuffer(&desc, data, &buffer)), "CreateBuffer failed");
+    TrackGpuMemory(buffer, category, owner, desc.ByteWidth);
+    return buffer;
+}
+
+// For textures created elsewhere (LibOVR swap textures, the swap chain)
+void TrackTexture2D(ID3D11Texture2D* tex, GpuMemoryCategory category, const char* owner,
+                    UINT count = 1) {
+    D3D11_TEXTURE2D_DESC desc;
+    tex->GetDesc(&desc);
+    TrackGpuMemory(tex, category, owner, TextureBytes(desc) * count);
+}
+
 struct DepthBuffer {
     ID3D11DepthStencilViewPtr TexDsv;
 
     DepthBuffer(ID3D11Device* Device, ovrSizei size) {
-        ID3D11Texture2DPtr Tex;
-        Device->CreateTexture2D(
-            std::begin({CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_D24_UNORM_S8_UINT, size.w, size.h, 1, 1,
-                                              D3D11_BIND_DEPTH_STENCIL)}),
-            NULL, &Tex);
+        const auto Tex = CreateTrackedTexture2D(
+            Device, CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_D24_UNORM_S8_UINT, size.w, size.h, 1, 1,
+                                          D3D11_BIND_DEPTH_STENCIL),
+            NULL, GpuMemoryCategory::DepthStencil, "Depth buffer");
         Device->CreateDepthStencilView(Tex, NULL, &TexDsv);
     }
 };
 
+auto ToFloat4(FXMVECTOR v) {
+    auto res = Float4{};
+    XMStoreFloat4(&res, v);
+    return res;
+}
+
+struct HiddenAreaMesh {
+    ID3D11BufferPtr VertexBuffer;
+    UINT NumVertices;
+
+    HiddenAreaMesh(ID3D11Device* device, const std::vector<Float3>& verts)
+        : NumVertices{UINT(size(verts))} {
+        VertexBuffer = CreateTrackedBuffer(
+            device, CD3D11_BUFFER_DESC{UINT(size(verts) * sizeof(verts.back())),
+                                       D3D11_BIND_VERTEX_BUFFER},
+            std::begin({D3D11_SUBRESOURCE_DATA{verts.data(), 0, 0}}), GpuMemoryCategory::Geometry,
+            "Hidden area mesh");
+    }
+};
+
 struct DirectX11 {
     int WinSizeW = 0;
     int WinSizeH = 0;
@@ -166,18 +570,28 @@ struct DirectX11 {
     ID3D11Texture2DPtr BackBuffer;
     ID3D11VertexShaderPtr D3DVert;
     ID3D11PixelShaderPtr D3DPix;
+    ID3D11PixelShaderPtr ClusteredPix;
     ID3D11InputLayoutPtr InputLayout;
     ID3D11SamplerStatePtr SamplerState;
     ID3D11BufferPtr ConstantBuffer;
+    ID3D11DepthStencilStatePtr SceneDepthState;
+    ID3D11DepthStencilStatePtr EqualDepthState;
+    ID3D11VertexShaderPtr MaskVert;
+    ID3D11VertexShaderPtr DepthVert;
+    ID3D11InputLayoutPtr PositionInputLayout;
+    ID3D11DepthStencilStatePtr MaskDepthState;
+    FrameStats Stats;
 
     DirectX11(HWND window, int vpW, int vpH, const LUID* pLuid);
 
-    void SetAndClearRenderTarget(ID3D11RenderTargetView* rendertarget,
-                                 DepthBuffer* depthbuffer) const {
+    void SetAndClearRenderTarget(ID3D11RenderTargetView* rendertarget, DepthBuffer* depthbuffer,
+                                 bool clearColor = true, bool clearDepth = true) const {
         Context->OMSetRenderTargets(1, &rendertarget, depthbuffer->TexDsv);
-        Context->ClearRenderTargetView(rendertarget, std::begin({0.0f, 0.0f, 0.0f, 0.0f}));
-        Context->ClearDepthStencilView(depthbuffer->TexDsv, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL,
-                                       1, 0);
+        if (clearColor)
+            Context->ClearRenderTargetView(rendertarget, std::begin({0.0f, 0.0f, 0.0f, 0.0f}));
+        if (clearDepth)
+            Context->ClearDepthStencilView(depthbuffer->TexDsv,
+                                           D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1, 0);
     }
 
     void SetViewport(const ovrRecti& vp) const {
@@ -185,117 +599,133 @@ struct DirectX11 {
             1, std::begin({D3D11_VIEWPORT{float(vp.Pos.x), float(vp.Pos.y), float(vp.Size.w),
                                           float(vp.Size.h), 0.0f, 1.0f}}));
     }
-};
 
-enum class TextureFill { AUTO_WHITE, AUTO_WALL, AUTO_FLOOR, AUTO_CEILING };
+    // The model view matrix is only read by the clustered lighting pixel shader
+    void SetConstants(const XMMATRIX& mat, const XMMATRIX& modelView = XMMatrixIdentity()) {
+        auto map = D3D11_MAPPED_SUBRESOURCE{};
+        Context->Map(ConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+        memcpy(map.pData, &mat, sizeof(mat));
+        memcpy(static_cast<XMMATRIX*>(map.pData) + 1, &modelView, sizeof(modelView));
+        Context->Unmap(ConstantBuffer, 0);
+        Stats.UploadedBytes += sizeof(mat) + sizeof(modelView);
+    }
+
+    // Write the hidden area mesh into depth (at the near plane) and stencil so later draws are
+    // rejected there before any pixel shading. Call after clearing and setting the viewport.
+    void ApplyHiddenAreaMask(const HiddenAreaMesh& mesh, const XMMATRIX& proj) {
+        SetConstants(proj);
+        Context->IASetInputLayout(PositionInputLayout);
+        const auto vbs = {mesh.VertexBuffer.GetInterfacePtr()};
+        Context->IASetVertexBuffers(0, UINT(size(vbs)), begin(vbs),
+                                    std::begin({UINT(sizeof(XMFLOAT3))}), std::begin({UINT(0)}));
+        Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        Context->VSSetShader(MaskVert, nullptr, 0);
+        Context->PSSetShader(nullptr, nullptr, 0);
+        Context->OMSetDepthStencilState(MaskDepthState, 1);
+        Context->Draw(mesh.NumVertices, 0);
+        Context->OMSetDepthStencilState(SceneDepthState, 0);
+    }
+};
 
 auto createTexture(ID3D11Device* device, ID3D11DeviceContext* context, TextureFill texFill) {
     auto texDesc = CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM, 256, 256, 1, 8,
                                          D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET);
     texDesc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS;
 
-    ID3D11Texture2DPtr tex;
-    device->CreateTexture2D(&texDesc, nullptr, &tex);
+    const auto tex = CreateTrackedTexture2D(device, texDesc, nullptr, GpuMemoryCategory::Texture,
+                                            "Scene textures");
     ID3D11ShaderResourceViewPtr texSrv;
     device->CreateShaderResourceView(tex, nullptr, &texSrv);
 
     // Fill texture with requested pattern
     std::vector<DWORD> pix(texDesc.Width * texDesc.Height);
     for (auto y = 0u; y < texDesc.Height; ++y)
-        for (auto x = 0u; x < texDesc.Width; ++x) {
-            auto& curr = pix[y * texDesc.Width + x];
-            switch (texFill) {
-                case (TextureFill::AUTO_WALL):
-                    curr =
-                        (((y / 4 & 15) == 0) ||
-                         (((x / 4 & 15) == 0) && ((((x / 4 & 31) == 0) ^ ((y / 4 >> 4) & 1)) == 0)))
-                            ? 0xff3c3c3c
-                            : 0xffb4b4b4;
-                    break;
-                case (TextureFill::AUTO_FLOOR):
-                    curr = (((x >> 7) ^ (y >> 7)) & 1) ? 0xffb4b4b4 : 0xff505050;
-                    break;
-                case (TextureFill::AUTO_CEILING):
-                    curr = (x / 4 == 0 || y / 4 == 0) ? 0xff505050 : 0xffb4b4b4;
-                    break;
-                case (TextureFill::AUTO_WHITE):
-                    curr = 0xffffffff;
-                    break;
-                default:
-                    curr = 0xffffffff;
-                    break;
-            }
-        }
+        for (auto x = 0u; x < texDesc.Width; ++x)
+            pix[y * texDesc.Width + x] = TexturePixel(texFill, x, y);
     context->UpdateSubresource(tex, 0, nullptr, pix.data(), texDesc.Width * 4, 0);
     context->GenerateMips(texSrv);
 
     return texSrv;
 }
 
-struct Vertex {
-    XMFLOAT3 Pos;
-    DWORD C;
-    float U, V;
-};
-
-struct TriangleSet {
-    std::vector<Vertex> Vertices;
-    std::vector<short> Indices;
+// Shared vertex, position and index buffers for all models. Models own ranges in the buffers and
+// draw with DrawIndexed start index and base vertex offsets, so indices stay 16 bit per model and
+// the buffers are bound once per pass rather than once per draw.
+struct GeometryPool {
+    struct Allocation {
+        RangeAllocator::Range Vertices, Indices;
+    };
+    RangeAllocator Vertices, Indices;
+    ID3D11BufferPtr VertexBuffer, PositionBuffer, IndexBuffer;
+    std::vector<Float3> Positions;  // Upload scratch, kept to avoid allocating per upload
+
+    GeometryPool(ID3D11Device* device, UINT maxVertices, UINT maxIndices)
+        : Vertices{maxVertices}, Indices{maxIndices} {
+        VertexBuffer = CreateTrackedBuffer(
+            device,
+            CD3D11_BUFFER_DESC{UINT(maxVertices * sizeof(Vertex)), D3D11_BIND_VERTEX_BUFFER},
+            nullptr, GpuMemoryCategory::Geometry, "Geometry pool");
+        PositionBuffer = CreateTrackedBuffer(
+            device,
+            CD3D11_BUFFER_DESC{UINT(maxVertices * sizeof(XMFLOAT3)), D3D11_BIND_VERTEX_BUFFER},
+            nullptr, GpuMemoryCategory::Geometry, "Geometry pool");
+        IndexBuffer = CreateTrackedBuffer(
+            device, CD3D11_BUFFER_DESC{UINT(maxIndices * sizeof(short)), D3D11_BIND_INDEX_BUFFER},
+            nullptr, GpuMemoryCategory::Geometry, "Geometry pool");
+    }
 
-    void AddBox(float x1, float y1, float z1, float x2, float y2, float z2, DWORD c) {
-        auto addQuad = [this](Vertex v0, Vertex v1, Vertex v2, Vertex v3) {
-            auto addTriangle = [this](const std::initializer_list<Vertex>& vs) {
-                for (const auto& v : vs) {
-                    Indices.push_back(static_cast<short>(size(Vertices)));
-                    Vertices.push_back(v);
-                }
-            };
+    Allocation Add(ID3D11DeviceContext* context, const TriangleSet& t) {
+        auto res = Allocation{};
+        VALIDATE(Vertices.Allocate(UINT(size(t.Vertices)), res.Vertices) &&
+                     Indices.Allocate(UINT(size(t.Indices)), res.Indices),
+                 "Geometry pool full.");
+        Upload(context, res, t, {0, res.Vertices.Count}, {0, res.Indices.Count});
+        return res;
+    }
 
-            addTriangle({v0, v1, v2});
-            addTriangle({v3, v2, v1});
+    // Upload part of a triangle set into its allocation, ranges are relative to the allocation
+    void Upload(ID3D11DeviceContext* context, const Allocation& allocation, const TriangleSet& t,
+                RangeAllocator::Range vertices, RangeAllocator::Range indices) {
+        auto upload = [context](ID3D11Buffer* buffer, UINT start, UINT count, const auto* data) {
+            const auto elementSize = UINT(sizeof(*data));
+            context->UpdateSubresource(
+                buffer, 0,
+                std::begin({D3D11_BOX{start * elementSize, 0, 0, (start + count) * elementSize,
+                                      1, 1}}),
+                data, 0, 0);
         };
+        const auto first = t.Vertices.data() + vertices.Start;
+        const auto vertexStart = allocation.Vertices.Start + vertices.Start;
+        upload(VertexBuffer, vertexStart, vertices.Count, first);
+        SplitPositions(first, vertices.Count, Positions);
+        upload(PositionBuffer, vertexStart, vertices.Count, Positions.data());
+        upload(IndexBuffer, allocation.Indices.Start + indices.Start, indices.Count,
+               t.Indices.data() + indices.Start);
+    }
 
-        auto modifyColor = [](DWORD c, XMFLOAT3 pos) {
-            const auto v = XMLoadFloat3(&pos);
-            auto length = [](const auto& v) { return XMVectorGetX(XMVector3Length(v)); };
-            const auto dist1 = length(XMVectorAdd(v, XMVectorSet(2.0f, -4.0f, 2.0f, 0.0f)));
-            const auto dist2 = length(XMVectorAdd(v, XMVectorSet(-3.0f, -4.0f, 3.0f, 0.0f)));
-            const auto dist3 = length(XMVectorAdd(v, XMVectorSet(4.0f, -3.0f, -25.0f, 0.0f)));
-            int bri = rand() % 160;
-            float r = ((c >> 16) & 0xff) *
-                      (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
-            float g = ((c >> 8) & 0xff) *
-                      (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
-            float b = ((c >> 0) & 0xff) *
-                      (bri + 192.0f * (0.65f + 8 / dist1 + 1 / dist2 + 4 / dist3)) / 255.0f;
-            return ((c & 0xff000000) + ((r > 255 ? 255 : (DWORD)r) << 16) +
-                    ((g > 255 ? 255 : (DWORD)g) << 8) + (b > 255 ? 255 : (DWORD)b));
-        };
+    void Remove(const Allocation& allocation) {
+        Vertices.Release(allocation.Vertices);
+        Indices.Release(allocation.Indices);
+    }
 
-        addQuad({{x1, y2, z1}, modifyColor(c, {x1, y2, z1}), z1, x1},
-                {{x2, y2, z1}, modifyColor(c, {x2, y2, z1}), z1, x2},
-                {{x1, y2, z2}, modifyColor(c, {x1, y2, z2}), z2, x1},
-                {{x2, y2, z2}, modifyColor(c, {x2, y2, z2}), z2, x2});
-        addQuad({{x2, y1, z1}, modifyColor(c, {x2, y1, z1}), z1, x2},
-                {{x1, y1, z1}, modifyColor(c, {x1, y1, z1}), z1, x1},
-                {{x2, y1, z2}, modifyColor(c, {x2, y1, z2}), z2, x2},
-                {{x1, y1, z2}, modifyColor(c, {x1, y1, z2}), z2, x1});
-        addQuad({{x1, y1, z2}, modifyColor(c, {x1, y1, z2}), z2, y1},
-                {{x1, y1, z1}, modifyColor(c, {x1, y1, z1}), z1, y1},
-                {{x1, y2, z2}, modifyColor(c, {x1, y2, z2}), z2, y2},
-                {{x1, y2, z1}, modifyColor(c, {x1, y2, z1}), z1, y2});
-        addQuad({{x2, y1, z1}, modifyColor(c, {x2, y1, z1}), z1, y1},
-                {{x2, y1, z2}, modifyColor(c, {x2, y1, z2}), z2, y1},
-                {{x2, y2, z1}, modifyColor(c, {x2, y2, z1}), z1, y2},
-                {{x2, y2, z2}, modifyColor(c, {x2, y2, z2}), z2, y2});
-        addQuad({{x1, y1, z1}, modifyColor(c, {x1, y1, z1}), x1, y1},
-                {{x2, y1, z1}, modifyColor(c, {x2, y1, z1}), x2, y1},
-                {{x1, y2, z1}, modifyColor(c, {x1, y2, z1}), x1, y2},
-                {{x2, y2, z1}, modifyColor(c, {x2, y2, z1}), x2, y2});
-        addQuad({{x2, y1, z2}, modifyColor(c, {x2, y1, z2}), x2, y1},
-                {{x1, y1, z2}, modifyColor(c, {x1, y1, z2}), x1, y1},
-                {{x2, y2, z2}, modifyColor(c, {x2, y2, z2}), x2, y2},
-                {{x1, y2, z2}, modifyColor(c, {x1, y2, z2}), x1, y2});
+    // Bind the full vertex stream, or the position only stream for depth only passes
+    void Bind(ID3D11DeviceContext* context, bool positionsOnly) const {
+        context->IASetIndexBuffer(IndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+        const auto vbs = {positionsOnly ? PositionBuffer.GetInterfacePtr()
+                                        : VertexBuffer.GetInterfacePtr()};
+        context->IASetVertexBuffers(
+            0, UINT(size(vbs)), begin(vbs),
+            std::begin({UINT(positionsOnly ? sizeof(XMFLOAT3) : sizeof(Vertex))}),
+            std::begin({UINT(0)}));
+        context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    }
+
+    void Report() const {
+        LOG_INFO("Geometry pool: %u of %u vertices and %u of %u indices used, fragmentation "
+                 "%.2f / %.2f\n",
+                 Vertices.Capacity - Vertices.FreeCount(), Vertices.Capacity,
+                 Indices.Capacity - Indices.FreeCount(), Indices.Capacity,
+                 Vertices.Fragmentation(), Indices.Fragmentation());
     }
 };
 
@@ -303,127 +733,292 @@ struct Model {
     XMFLOAT3 Pos;
     XMFLOAT4 Rot;
     ID3D11ShaderResourceViewPtr Tex;
-    ID3D11BufferPtr VertexBuffer;
-    ID3D11BufferPtr IndexBuffer;
-    std::size_t NumIndices;
-
-    Model(ID3D11Device* device, const TriangleSet& t, XMFLOAT3 argPos, XMFLOAT4 argRot,
-          ID3D11ShaderResourceView* tex)
-        : Pos(argPos), Rot(argRot), Tex(tex), NumIndices{size(t.Indices)} {
-        device->CreateBuffer(
-            std::begin({CD3D11_BUFFER_DESC{UINT(size(t.Vertices) * sizeof(t.Vertices.back())),
-                                           D3D11_BIND_VERTEX_BUFFER}}),
-            std::begin({D3D11_SUBRESOURCE_DATA{t.Vertices.data(), 0, 0}}), &VertexBuffer);
-
-        device->CreateBuffer(
-            std::begin({CD3D11_BUFFER_DESC{UINT(size(t.Indices) * sizeof(t.Indices.back())),
-                                           D3D11_BIND_INDEX_BUFFER}}),
-            std::begin({D3D11_SUBRESOURCE_DATA{t.Indices.data(), 0, 0}}), &IndexBuffer);
+    GeometryPool& Pool;
+    GeometryPool::Allocation Geometry;
+
+    Model(GeometryPool& pool, ID3D11DeviceContext* context, const TriangleSet& t, XMFLOAT3 argPos,
+          XMFLOAT4 argRot, ID3D11ShaderResourceView* tex)
+        : Pos(argPos), Rot(argRot), Tex(tex), Pool(pool), Geometry{pool.Add(context, t)} {}
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+    ~Model() { Pool.Remove(Geometry); }
+
+    // Flush the edited boxes of the triangle set this model was created from. Growing past the
+    // current allocation moves the model to a new allocation with a full upload.
+    void Update(ID3D11DeviceContext* context, TriangleSet& t) {
+        if (size(t.Vertices) != Geometry.Vertices.Count ||
+            size(t.Indices) != Geometry.Indices.Count) {
+            Pool.Remove(Geometry);
+            Geometry = Pool.Add(context, t);
+        } else {
+            for (const auto& range : t.Dirty) Pool.Upload(context, Geometry, t, range, range);
+        }
+        t.Dirty.clear();
     }
 
-    void Render(DirectX11& directx, const XMMATRIX& projView) const {
-        const auto modelMat = XMMatrixMultiply(XMMatrixRotationQuaternion(XMLoadFloat4(&Rot)),
-                                               XMMatrixTranslationFromVector(XMLoadFloat3(&Pos)));
-        const auto mat = XMMatrixMultiply(modelMat, projView);
-
-        auto map = D3D11_MAPPED_SUBRESOURCE{};
-        directx.Context->Map(directx.ConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
-        memcpy(map.pData, &mat, sizeof(mat));
-        directx.Context->Unmap(directx.ConstantBuffer, 0);
+    auto ModelMatrix() const {
+        return XMMatrixMultiply(XMMatrixRotationQuaternion(XMLoadFloat4(&Rot)),
+                                XMMatrixTranslationFromVector(XMLoadFloat3(&Pos)));
+    }
 
-        directx.Context->IASetInputLayout(directx.InputLayout);
-        directx.Context->IASetIndexBuffer(IndexBuffer, DXGI_FORMAT_R16_UINT, 0);
-        const auto vbs = {VertexBuffer.GetInterfacePtr()};
-        directx.Context->IASetVertexBuffers(0, UINT(size(vbs)), begin(vbs),
-                                            std::begin({UINT(sizeof(Vertex))}),
-                                            std::begin({UINT(0)}));
-        directx.Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    // Draw from the geometry pool, the pool buffers, shaders and states are set up by the caller
+    void Draw(DirectX11& directx) const {
+        directx.Context->DrawIndexed(Geometry.Indices.Count, Geometry.Indices.Start,
+                                     INT(Geometry.Vertices.Start));
+        ++directx.Stats.Draws;
+    }
 
-        directx.Context->VSSetShader(directx.D3DVert, nullptr, 0);
-        directx.Context->PSSetShader(directx.D3DPix, nullptr, 0);
+    // Depth only draw from the position stream with no pixel shader
+    void RenderDepth(DirectX11& directx, const XMMATRIX& projView) const {
+        directx.SetConstants(XMMatrixMultiply(ModelMatrix(), projView));
+        Draw(directx);
+    }
 
-        const auto samplerStates = {directx.SamplerState.GetInterfacePtr()};
-        directx.Context->PSSetSamplers(0, UINT(size(samplerStates)), begin(samplerStates));
+    // The model view projection is formed exactly as in RenderDepth so depth is invariant
+    void Render(DirectX11& directx, const XMMATRIX& view, const XMMATRIX& projView) const {
+        const auto model = ModelMatrix();
+        directx.SetConstants(XMMatrixMultiply(model, projView), XMMatrixMultiply(model, view));
 
         const auto texSrvs = {Tex.GetInterfacePtr()};
         directx.Context->PSSetShaderResources(0, UINT(size(texSrvs)), begin(texSrvs));
-        directx.Context->DrawIndexed(UINT(NumIndices), 0, 0);
+        Draw(directx);
     }
 };
 
+// Bake throughput with increasing thread counts, showing how the work stealing scales
+void BenchmarkAmbientOcclusion(const std::vector<MeshDesc>& meshes) {
+    auto baseSeconds = 0.0;
+    const auto maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (auto threads = 1u;; threads = std::min(threads * 2, maxThreads)) {
+        AmbientOcclusion ao;
+        ao.Compute(meshes, threads);
+        if (threads == 1) baseSeconds = ao.Seconds;
+        LOG_INFO("AO benchmark: %u threads %.3fs, %.2f Mrays/s, %.2fx speedup\n", threads,
+                 ao.Seconds, double(ao.RaysCast) / ao.Seconds * 1e-6, baseSeconds / ao.Seconds);
+        if (threads == maxThreads) break;
+    }
+}
+
+// Bake scaling with one thread against all of them, and the fraction of models each walkable cell
+// hides, from the sets themselves
+void BenchmarkPvs(const std::vector<MeshDesc>& meshes) {
+    const auto maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    auto baseSeconds = 0.0;
+    for (auto threads = 1u;; threads = maxThreads) {
+        Pvs pvs;
+        const auto contents = pvs.Bake(meshes, threads);
+        if (threads == 1) baseSeconds = pvs.BakeSeconds;
+        auto header = Pvs::Header{};
+        memcpy(&header, contents.data(), sizeof(header));
+        const auto rowOfCell = contents.data() + sizeof(header) / sizeof(UINT);
+        const auto cells = size_t(header.CellsX) * header.CellsZ;
+        auto hidden = size_t{0}, walkable = size_t{0};
+        for (auto cell = size_t{0}; cell < cells; ++cell) {
+            const auto row = rowOfCell + cells + size_t(rowOfCell[cell]) * header.Words;
+            auto seen = size_t{0};
+            for (auto m = 0u; m < header.Models; ++m) seen += (row[m / 32] >> (m % 32)) & 1;
+            if (seen == header.Models) continue;  // Unwalkable, or sees everything
+            ++walkable;
+            hidden += header.Models - seen;
+        }
+        LOG_INFO("PVS benchmark: %u threads %.3fs, %.2fx speedup, %zu of %zu cells cull, "
+                 "hiding %.1f of %u models on average\n",
+                 threads, pvs.BakeSeconds, baseSeconds / pvs.BakeSeconds, walkable, cells,
+                 walkable ? double(hidden) / walkable : 0.0, header.Models);
+        if (threads == maxThreads) break;
+    }
+}
+
+// Portal traversal against per box frustum culling on generated grids, from random positions and
+// headings inside the rooms. Boxes count as portal visible when their center is in a reached cell.
+void BenchmarkPortals(const ovrFovPort& fov, int samples = 1000) {
+    for (auto rooms : {4, 8, 16}) {
+        auto cells = CellGraph{};
+        const auto meshes = CreateRoomGrid(rooms, false, &cells);
+        cells.AssignMeshes(meshes);
+        const auto boxes = StaticBoxes(meshes);
+        std::vector<int> boxCells;
+        for (const auto& b : boxes)
+            boxCells.push_back(cells.Locate({(b.Min.x + b.Max.x) / 2, (b.Min.y + b.Max.y) / 2,
+                                             (b.Min.z + b.Max.z) / 2}));
+        const float planes[4][3] = {{1.0f, 0.0f, fov.LeftTan},
+                                    {-1.0f, 0.0f, fov.RightTan},
+                                    {0.0f, 1.0f, fov.DownTan},
+                                    {0.0f, -1.0f, fov.UpTan}};
+        auto portalSeconds = 0.0, frustumSeconds = 0.0;
+        auto visibleCells = size_t{0}, cellVisits = size_t{0};
+        auto frustumBoxes = size_t{0}, portalBoxes = size_t{0};
+        for (auto s = 0; s < samples; ++s) {
+            const auto& cell = cells.Cells[size_t(rand()) % size(cells.Cells)];
+            auto random = [](float a, float b) { return a + (b - a) * float(rand()) / RAND_MAX; };
+            const auto eye = XMFLOAT3{random(cell.Min.x + 0.5f, cell.Max.x - 0.5f), 1.6f,
+                                      random(cell.Min.z + 0.5f, cell.Max.z - 0.5f)};
+            const auto yaw = random(0.0f, XM_2PI);
+            const auto eyePos = XMLoadFloat3(&eye);
+            const auto view = XMMatrixLookAtRH(
+                eyePos, XMVectorAdd(eyePos, XMVectorSet(std::sin(yaw), 0, -std::cos(yaw), 0)),
+                XMVectorSet(0, 1, 0, 0));
+
+            auto start = ovr_GetTimeInSeconds();
+            cells.Traverse({eye, {0.0f, -std::sin(yaw / 2), 0.0f, std::cos(yaw / 2)}}, fov);
+            portalSeconds += ovr_GetTimeInSeconds() - start;
+            cellVisits += cells.CellsVisited;
+            visibleCells += size_t(std::count(begin(cells.VisibleCells), end(cells.VisibleCells),
+                                              true));
+
+            start = ovr_GetTimeInSeconds();
+            for (const auto& b : boxes) {
+                const auto center = XMVector3TransformCoord(
+                    XMVectorScale(XMVectorAdd(XMLoadFloat3(&b.Min), XMLoadFloat3(&b.Max)), 0.5f),
+                    view);
+                const auto radius = 0.5f * XMVectorGetX(XMVector3Length(
+                                               XMVectorSubtract(XMLoadFloat3(&b.Max),
+                                                                XMLoadFloat3(&b.Min))));
+                auto c = XMFLOAT3{};
+                XMStoreFloat3(&c, center);
+                auto inside = -c.z >= -radius;
+                for (const auto& p : planes)
+                    inside = inside && (p[0] * c.x + p[1] * c.y + p[2] * -c.z) /
+                                               std::sqrt(1.0f + p[2] * p[2]) >=
+                                           -radius;
+                frustumBoxes += inside ? 1 : 0;
+            }
+            frustumSeconds += ovr_GetTimeInSeconds() - start;
+            for (auto c : boxCells) portalBoxes += c < 0 || cells.VisibleCells[c] ? 1 : 0;
+        }
+        LOG_INFO("Portal benchmark %dx%d rooms: traversal %.2fus, %.1f visits, %.1f of %zu cells "
+                 "visible, %.0f of %zu boxes; frustum culling %.2fus, %.0f boxes\n",
+                 rooms, rooms, 1e6 * portalSeconds / samples, double(cellVisits) / samples,
+                 double(visibleCells) / samples, size(cells.Cells), double(portalBoxes) / samples,
+                 size(boxes),
+                 1e6 * frustumSeconds / samples, double(frustumBoxes) / samples);
+    }
+}
+
+// Shaded fragments for drawing the meshes in order on the CPU, optionally after a depth pre-pass.
+// Returns the rasterizer so callers can also read coverage.
+auto MeasureShading(const std::vector<MeshDesc>& meshes, const XMMATRIX& projView, int w, int h,
+                    bool depthPrePass) {
+    auto raster = CoverageRasterizer{w, h};
+    auto drawAll = [&meshes, &projView, &raster](bool depthEqual) {
+        for (const auto& mesh : meshes) {
+            const auto modelViewProj = XMMatrixMultiply(
+                XMMatrixTranslationFromVector(XMLoadFloat3(&mesh.Pos)), projView);
+            const auto& vertices = mesh.Mesh.Vertices;
+            auto clip = [&vertices, &modelViewProj](uint16_t i) {
+                return ToFloat4(XMVector3Transform(XMLoadFloat3(&vertices[i].Pos), modelViewProj));
+            };
+            const auto& indices = mesh.Mesh.Indices;
+            for (auto i = 0u; i < size(indices); i += 3)
+                raster.DrawTriangle(clip(indices[i]), clip(indices[i + 1]), clip(indices[i + 2]),
+                                    depthEqual);
+        }
+    };
+    drawAll(false);
+    if (depthPrePass) {
+        raster.Fragments = raster.Passed = 0;
+        drawAll(true);
+    }
+    return raster;
+}
+
 struct Scene {
+    GeometryPool Pool;
+    std::vector<MeshDesc> Meshes;  // CPU copies for editing, Models[i] draws Meshes[i]
     std::vector<std::unique_ptr<Model>> Models;
+    std::vector<bool> Visible;  // Models drawn by Render, set per eye by visibility and LOD
+
+    // Flush edits made to Meshes[i] to the GPU
+    void UpdateModel(ID3D11DeviceContext* context, size_t i) {
+        Models[i]->Update(context, Meshes[i].Mesh);
+    }
+
+    // With a depth pre-pass all models first lay down depth, then the color pass shades only the
+    // front most surface of each pixel with an equal depth test. With clustered lighting the
+    // caller has already uploaded the eye's light clusters.
+    void Render(DirectX11& directx, const XMMATRIX& view, const XMMATRIX& proj,
+                const Options& options) const {
+        const auto context = directx.Context.GetInterfacePtr();
+        const auto projView = XMMatrixMultiply(view, proj);
+        if (options.DepthPrePass) {
+            Pool.Bind(context, true);
+            context->IASetInputLayout(directx.PositionInputLayout);
+            context->VSSetShader(directx.DepthVert, nullptr, 0);
+            context->PSSetShader(nullptr, nullptr, 0);
+            for (auto i = 0u; i < size(Models); ++i)
+                if (Visible[i]) Models[i]->RenderDepth(directx, projView);
+            context->OMSetDepthStencilState(directx.EqualDepthState, 0);
+        }
 
-    void Render(DirectX11& directx, const XMMATRIX& projView) const {
-        for (const auto& model : Models) model->Render(directx, projView);
-    }
-
-    Scene(ID3D11Device* device, ID3D11DeviceContext* context) {
-        auto add = [this](Model* n) { Models.emplace_back(n); };
-
-        TriangleSet cube;
-        cube.AddBox(0.5f, -0.5f, 0.5f, -0.5f, 0.5f, -0.5f, 0xff404040);
-        add(new Model(device, cube, {0, 0, 0}, {0, 0, 0, 1},
-                      createTexture(device, context, TextureFill::AUTO_CEILING)));
-
-        TriangleSet spareCube;
-        spareCube.AddBox(0.1f, -0.1f, 0.1f, -0.1f, +0.1f, -0.1f, 0xffff0000);
-        add(new Model(device, spareCube, {0, -10, 0}, {0, 0, 0, 1},
-                      createTexture(device, context, TextureFill::AUTO_CEILING)));
-
-        TriangleSet walls;
-        walls.AddBox(10.1f, 0.0f, 20.0f, 10.0f, 4.0f, -20.0f, 0xff808080);     // Left Wall
-        walls.AddBox(10.0f, -0.1f, 20.1f, -10.0f, 4.0f, 20.0f, 0xff808080);    // Back Wall
-        walls.AddBox(-10.0f, -0.1f, 20.0f, -10.1f, 4.0f, -20.0f, 0xff808080);  // Right Wall
-        add(new Model(device, walls, {0, 0, 0}, {0, 0, 0, 1},
-                      createTexture(device, context, TextureFill::AUTO_WALL)));
-
-        TriangleSet floors;
-        floors.AddBox(10.0f, -0.1f, 20.0f, -10.0f, 0.0f, -20.1f, 0xff808080);    // Main floor
-        floors.AddBox(15.0f, -6.1f, -18.0f, -15.0f, -6.0f, -30.0f, 0xff808080);  // Bottom floor
-        add(new Model(device, floors, {0, 0, 0}, {0, 0, 0, 1},
-                      createTexture(device, context, TextureFill::AUTO_FLOOR)));  // Floors
-
-        TriangleSet ceiling;
-        ceiling.AddBox(10.0f, 4.0f, 20.0f, -10.0f, 4.1f, -20.1f, 0xff808080);
-        add(new Model(device, ceiling, {0, 0, 0}, {0, 0, 0, 1},
-                      createTexture(device, context, TextureFill::AUTO_CEILING)));  // Ceiling
-
-        TriangleSet furniture;
-        furniture.AddBox(-9.5f, 0.75f, -3.0f, -10.1f, 2.5f, -3.1f,
-                         0xff383838);  // Right side shelf// Verticals
-        furniture.AddBox(-9.5f, 0.95f, -3.7f, -10.1f, 2.75f, -3.8f,
-                         0xff383838);  // Right side shelf
-        furniture.AddBox(-9.55f, 1.20f, -2.5f, -10.1f, 1.30f, -3.75f,
-                         0xff383838);  // Right side shelf// Horizontals
-        furniture.AddBox(-9.55f, 2.00f, -3.05f, -10.1f, 2.10f, -4.2f,
-                         0xff383838);  // Right side shelf
-        furniture.AddBox(-5.0f, 1.1f, -20.0f, -10.0f, 1.2f, -20.1f, 0xff383838);  // Right railing
-        furniture.AddBox(10.0f, 1.1f, -20.0f, 5.0f, 1.2f, -20.1f, 0xff383838);    // Left railing
-        for (float f = 5; f <= 9; f += 1)
-            furniture.AddBox(-f, 0.0f, -20.0f, -f - 0.1f, 1.1f, -20.1f, 0xff505050);  // Left Bars
-        for (float f = 5; f <= 9; f += 1)
-            furniture.AddBox(f, 1.1f, -20.0f, f + 0.1f, 0.0f, -20.1f, 0xff505050);  // Right Bars
-        furniture.AddBox(1.8f, 0.8f, -1.0f, 0.0f, 0.7f, 0.0f, 0xff505000);          // Table
-        furniture.AddBox(1.8f, 0.0f, 0.0f, 1.7f, 0.7f, -0.1f, 0xff505000);          // Table Leg
-        furniture.AddBox(1.8f, 0.7f, -1.0f, 1.7f, 0.0f, -0.9f, 0xff505000);         // Table Leg
-        furniture.AddBox(0.0f, 0.0f, -1.0f, 0.1f, 0.7f, -0.9f, 0xff505000);         // Table Leg
-        furniture.AddBox(0.0f, 0.7f, 0.0f, 0.1f, 0.0f, -0.1f, 0xff505000);          // Table Leg
-        furniture.AddBox(1.4f, 0.5f, 1.1f, 0.8f, 0.55f, 0.5f, 0xff202050);          // Chair Set
-        furniture.AddBox(1.401f, 0.0f, 1.101f, 1.339f, 1.0f, 1.039f, 0xff202050);   // Chair Leg 1
-        furniture.AddBox(1.401f, 0.5f, 0.499f, 1.339f, 0.0f, 0.561f, 0xff202050);   // Chair Leg 2
-        furniture.AddBox(0.799f, 0.0f, 0.499f, 0.861f, 0.5f, 0.561f, 0xff202050);   // Chair Leg 2
-        furniture.AddBox(0.799f, 1.0f, 1.101f, 0.861f, 0.0f, 1.039f, 0xff202050);   // Chair Leg 2
-        furniture.AddBox(1.4f, 0.97f, 1.05f, 0.8f, 0.92f, 1.10f,
-                         0xff202050);  // Chair Back high bar
-        for (float f = 3.0f; f <= 6.6f; f += 0.4f)
-            furniture.AddBox(3, 0.0f, -f, 2.9f, 1.3f, -f - 0.1f, 0xff404040);  // Posts
-        add(new Model(
-            device, furniture, {0, 0, 0}, {0, 0, 0, 1},
-            createTexture(device, context, TextureFill::AUTO_WHITE)));  // Fixtures & furniture
+        Pool.Bind(context, false);
+        context->IASetInputLayout(directx.InputLayout);
+        context->VSSetShader(directx.D3DVert, nullptr, 0);
+        context->PSSetShader(options.Lights ? directx.ClusteredPix : directx.D3DPix, nullptr, 0);
+        const auto samplerStates = {directx.SamplerState.GetInterfacePtr()};
+        context->PSSetSamplers(0, UINT(size(samplerStates)), begin(samplerStates));
+        for (auto i = 0u; i < size(Models); ++i)
+            if (Visible[i]) Models[i]->Render(directx, view, projView);
+        context->OMSetDepthStencilState(directx.SceneDepthState, 0);
+    }
+
+    // The pool is sized with headroom over the initial meshes for later edits
+    static UINT PoolCapacity(const std::vector<MeshDesc>& meshes, bool indices) {
+        auto res = size_t{0};
+        for (const auto& mesh : meshes)
+            res += indices ? size(mesh.Mesh.Indices) : size(mesh.Mesh.Vertices);
+        return UINT(std::max(2 * res, size_t{65536}));
+    }
+
+    Scene(ID3D11Device* device, ID3D11DeviceContext* context, const std::vector<MeshDesc>& meshes)
+        : Pool{device, PoolCapacity(meshes, false), PoolCapacity(meshes, true)}, Meshes{meshes} {
+        for (auto& mesh : Meshes) {
+            Models.emplace_back(new Model(Pool, context, mesh.Mesh, mesh.Pos, {0, 0, 0, 1},
+                                          createTexture(device, context, mesh.Fill)));
+            mesh.Mesh.Dirty.clear();
+        }
+        Visible.assign(size(Models), true);
+        Pool.Report();
     }
 };
 
+// Compare flushing a single edited box against re-uploading the whole mesh, as a full rebuild
+// would. Runs on a scratch model in the pool. Times are CPU submission cost, the context is
+// flushed each iteration so the driver does the copy work inside the timed region.
+void BenchmarkGeometryUpdates(GeometryPool& pool, ID3D11DeviceContext* context, TriangleSet mesh,
+                              int iterations = 200) {
+    Model model{pool, context, mesh, {}, {0, 0, 0, 1}, nullptr};
+    mesh.Dirty.clear();
+    const auto numBoxes = UINT(size(mesh.Vertices) / TriangleSet::VerticesPerBox);
+    auto time = [&](bool partial) {
+        const auto start = ovr_GetTimeInSeconds();
+        for (auto i = 0; i < iterations; ++i) {
+            const auto box = UINT(i) % numBoxes;
+            const auto& v = mesh.Vertices[box * TriangleSet::VerticesPerBox];
+            // Rewrite the box with its original extents, only the vertex colors change
+            auto lo = v.Pos, hi = v.Pos;
+            for (auto j = 0u; j < TriangleSet::VerticesPerBox; ++j) {
+                const auto& p = mesh.Vertices[box * TriangleSet::VerticesPerBox + j].Pos;
+                lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+                hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+            }
+            mesh.ModifyBox(box, lo.x, lo.y, lo.z, hi.x, hi.y, hi.z, 0xff808080);
+            if (partial) {
+                model.Update(context, mesh);
+            } else {
+                mesh.Dirty.clear();
+                model.Pool.Remove(model.Geometry);
+                model.Geometry = model.Pool.Add(context, mesh);
+            }
+            context->Flush();
+        }
+        return 1000.0 * (ovr_GetTimeInSeconds() - start) / iterations;
+    };
+    const auto partialMs = time(true);
+    const auto fullMs = time(false);
+    LOG_INFO("Geometry update benchmark (%u boxes): partial %.4fms, full %.4fms per edit\n",
+             numBoxes, partialMs, fullMs);
+}
+
 struct Camera {
     XMVECTOR Pos;
     XMVECTOR Rot;
@@ -432,12 +1027,24 @@ struct Camera {
         return XMMatrixLookAtRH(Pos, XMVectorAdd(Pos, forward),
                                 XMVector3Rotate(XMVectorSet(0, 1, 0, 0), Rot));
     }
+    // The same view for the portable CPU code
+    Pose GetPose() const {
+        auto res = Pose{};
+        XMStoreFloat3(&res.Pos, Pos);
+        XMStoreFloat4(&res.Rot, Rot);
+        return res;
+    }
 };
 
 // ovrSwapTextureSet wrapper class that also maintains the render target views needed for D3D11
 // rendering.
 struct OculusTexture {
-    std::unique_ptr<ovrSwapTextureSet, std::function<void(ovrSwapTextureSet*)>> TextureSet;
+    // unique_ptr Deleter to clean up the swap texture set
+    struct Deleter {
+        ovrHmd Hmd;
+        void operator()(ovrSwapTextureSet* ts) const { ovr_DestroySwapTextureSet(Hmd, ts); }
+    };
+    std::unique_ptr<ovrSwapTextureSet, Deleter> TextureSet;
     ID3D11RenderTargetViewPtr TexRtvs[2];
 
     OculusTexture(ID3D11Device* device, ovrHmd hmd, ovrSizei size)
@@ -454,14 +1061,17 @@ struct OculusTexture {
                   VALIDATE(size_t(ts->TextureCount) == std::size(texRtv), "TextureCount mismatch.");
                   return ts;
               }(),
-              // unique_ptr Deleter lambda to clean up the swap texture set
-              [hmd](ovrSwapTextureSet* ts) { ovr_DestroySwapTextureSet(hmd, ts); }} {
+              Deleter{hmd}} {
         // Create render target views for each of the textures in the swap texture set
         std::transform(TextureSet->Textures, TextureSet->Textures + TextureSet->TextureCount,
                        TexRtvs, [device](auto tex) {
+                           const auto d3dTex =
+                               reinterpret_cast<ovrD3D11Texture&>(tex).D3D11.pTexture;
+                           TrackTexture2D(d3dTex, GpuMemoryCategory::RenderTarget,
+                                          "Eye swap textures");
                            ID3D11RenderTargetViewPtr rtv;
                            device->CreateRenderTargetView(
-                               reinterpret_cast<ovrD3D11Texture&>(tex).D3D11.pTexture,
+                               d3dTex,
                                std::begin({CD3D11_RENDER_TARGET_VIEW_DESC{
                                    D3D11_RTV_DIMENSION_TEXTURE2D, DXGI_FORMAT_R8G8B8A8_UNORM}}),
                                &rtv);
@@ -520,11 +1130,13 @@ DirectX11::DirectX11(HWND window, int vpW, int vpH, const LUID* pLuid)
                                             reinterpret_cast<void**>(&BackBuffer))),
              "IDXGISwapChain::GetBuffer() failed");
 
+    TrackTexture2D(BackBuffer, GpuMemoryCategory::RenderTarget, "Swap chain", 2);
+
     // Buffer for shader constants
-    Device->CreateBuffer(
-        std::begin({CD3D11_BUFFER_DESC(sizeof(XMMATRIX), D3D11_BIND_CONSTANT_BUFFER,
-                                       D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE)}),
-        nullptr, &ConstantBuffer);
+    ConstantBuffer = CreateTrackedBuffer(
+        Device, CD3D11_BUFFER_DESC(2 * sizeof(XMMATRIX), D3D11_BIND_CONSTANT_BUFFER,
+                                   D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE),
+        nullptr, GpuMemoryCategory::Constants, "Constant buffer");
     auto buffs = {ConstantBuffer.GetInterfacePtr()};
     Context->VSSetConstantBuffers(0, UINT(size(buffs)), begin(buffs));
 
@@ -540,10 +1152,27 @@ DirectX11::DirectX11(HWND window, int vpW, int vpH, const LUID* pLuid)
     Device->CreateRasterizerState(std::begin({CD3D11_RASTERIZER_DESC{D3D11_DEFAULT}}), &rss);
     Context->RSSetState(rss);
 
-    // Create and set depth stencil state
-    ID3D11DepthStencilStatePtr dss;
-    Device->CreateDepthStencilState(std::begin({CD3D11_DEPTH_STENCIL_DESC{D3D11_DEFAULT}}), &dss);
-    Context->OMSetDepthStencilState(dss, 0);
+    // Create and set depth stencil state, scene pixels only pass where the hidden area mask left
+    // the stencil clear
+    auto sceneDss = CD3D11_DEPTH_STENCIL_DESC{D3D11_DEFAULT};
+    sceneDss.StencilEnable = TRUE;
+    sceneDss.FrontFace.StencilFunc = sceneDss.BackFace.StencilFunc = D3D11_COMPARISON_EQUAL;
+    Device->CreateDepthStencilState(&sceneDss, &SceneDepthState);
+    Context->OMSetDepthStencilState(SceneDepthState, 0);
+
+    // After a depth pre-pass only the front most surface is shaded and depth is already final
+    auto equalDss = sceneDss;
+    equalDss.DepthFunc = D3D11_COMPARISON_EQUAL;
+    equalDss.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+    Device->CreateDepthStencilState(&equalDss, &EqualDepthState);
+
+    // Hidden area mask always writes depth and replaces stencil with its reference value
+    auto maskDss = CD3D11_DEPTH_STENCIL_DESC{D3D11_DEFAULT};
+    maskDss.DepthFunc = D3D11_COMPARISON_ALWAYS;
+    maskDss.StencilEnable = TRUE;
+    maskDss.FrontFace.StencilFunc = maskDss.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+    maskDss.FrontFace.StencilPassOp = maskDss.BackFace.StencilPassOp = D3D11_STENCIL_OP_REPLACE;
+    Device->CreateDepthStencilState(&maskDss, &MaskDepthState);
 
     // Create and set blend state
     ID3D11BlendStatePtr bs;
@@ -557,19 +1186,31 @@ DirectX11::DirectX11(HWND window, int vpW, int vpH, const LUID* pLuid)
         return blob;
     };
 
+    // Clip space position shared by the default and depth pre-pass vertex shaders. The color pass
+    // after a pre-pass tests depth for equality, so both must compute bit identical positions:
+    // precise stops the compiler from fusing or reordering the math differently in each shader.
+    const std::string clipPositionSrc = R"(float4x4 ProjView;
+                                           float4 ClipPosition(float4 pos) {
+                                               precise float4 res = mul(ProjView, pos);
+                                               return res;
+                                           }
+                                           )";
+
     // Create vertex shader and input layout
-    auto defaultVertexShaderSrc = R"(float4x4 ProjView;
+    const auto defaultVertexShaderSrc = clipPositionSrc + R"(float4x4 ModelView;
                                          void main(in float4 pos : POSITION,
                                                    in float4 col : COLOR0,
                                                    in float2 tex : TEXCOORD0,
                                                    out float4 oPos : SV_Position,
                                                    out float4 oCol : COLOR0,
-                                                   out float2 oTex : TEXCOORD0) {
-                                             oPos = mul(ProjView, pos);
+                                                   out float2 oTex : TEXCOORD0,
+                                                   out float3 oViewPos : TEXCOORD1) {
+                                             oPos = ClipPosition(pos);
                                              oTex = tex;
                                              oCol = col;
+                                             oViewPos = mul(ModelView, pos).xyz;
                                          })";
-    auto vsBlob = compileShader(defaultVertexShaderSrc, "vs_4_0");
+    auto vsBlob = compileShader(defaultVertexShaderSrc.c_str(), "vs_4_0");
     Device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), nullptr,
                                &D3DVert);
     D3D11_INPUT_ELEMENT_DESC defaultVertexDesc[] = {
@@ -593,6 +1234,85 @@ DirectX11::DirectX11(HWND window, int vpW, int vpH, const LUID* pLuid)
     Device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), nullptr,
                               &D3DPix);
 
+    // Create clustered lighting pixel shader, it looks up the lights of the froxel containing the
+    // pixel (see LightClusters) and lights the unlit vertex color with a face normal
+    auto clusteredPixelShaderSrc = R"(Texture2D Texture : register(t0);
+                                          Buffer<float4> Lights : register(t1);
+                                          Buffer<uint2> Ranges : register(t2);
+                                          Buffer<uint> Indices : register(t3);
+                                          SamplerState Linear : register(s0);
+                                          cbuffer Clusters : register(b1) {
+                                              float4 FovTan;
+                                              float4 Grid;
+                                              float4 Depth;
+                                          };
+                                          float4 main(in float4 Position : SV_Position,
+                                                      in float4 Color : COLOR0,
+                                                      in float2 TexCoord : TEXCOORD0,
+                                                      in float3 ViewPos : TEXCOORD1) : SV_Target {
+                                              float depth = -ViewPos.z;
+                                              float2 t = ViewPos.xy / depth;
+                                              int x = clamp(int((t.x + FovTan.x) * Grid.x /
+                                                                (FovTan.x + FovTan.y)),
+                                                            0, int(Grid.x) - 1);
+                                              int y = clamp(int((t.y + FovTan.z) * Grid.y /
+                                                                (FovTan.z + FovTan.w)),
+                                                            0, int(Grid.y) - 1);
+                                              int s = clamp(int(log(depth / Depth.x) * Grid.w),
+                                                            0, int(Grid.z) - 1);
+                                              uint2 range =
+                                                  Ranges.Load((s * int(Grid.y) + y) *
+                                                              int(Grid.x) + x);
+                                              float3 n = normalize(cross(ddx(ViewPos),
+                                                                         ddy(ViewPos)));
+                                              n = dot(n, ViewPos) > 0 ? -n : n;
+                                              float3 light = Depth.yyy;
+                                              [loop] for (uint i = 0; i < range.y; ++i) {
+                                                  uint index = Indices.Load(range.x + i);
+                                                  float4 posRadius = Lights.Load(2 * index);
+                                                  float3 l = posRadius.xyz - ViewPos;
+                                                  float d = length(l);
+                                                  float atten = saturate(1 - d / posRadius.w);
+                                                  light += Lights.Load(2 * index + 1).rgb *
+                                                           atten * atten *
+                                                           saturate(dot(n, l / d));
+                                              }
+                                              float4 TexCol = Texture.Sample(Linear, TexCoord);
+                                              return float4(Color.rgb * TexCol.rgb * light,
+                                                            Color.a * TexCol.a);
+                                          })";
+    auto clusteredPsBlob = compileShader(clusteredPixelShaderSrc, "ps_4_0");
+    Device->CreatePixelShader(clusteredPsBlob->GetBufferPointer(),
+                              clusteredPsBlob->GetBufferSize(), nullptr, &ClusteredPix);
+
+    // Create hidden area mask vertex shader and input layout, it is drawn with no pixel shader and
+    // outputs depth 0 so masked pixels fail the depth test for everything rendered after it
+    auto maskVertexShaderSrc = R"(float4x4 Proj;
+                                      float4 main(in float4 pos : POSITION) : SV_Position {
+                                          float4 oPos = mul(Proj, pos);
+                                          oPos.z = 0;
+                                          return oPos;
+                                      })";
+    auto maskVsBlob = compileShader(maskVertexShaderSrc, "vs_4_0");
+    Device->CreateVertexShader(maskVsBlob->GetBufferPointer(), maskVsBlob->GetBufferSize(),
+                               nullptr, &MaskVert);
+    D3D11_INPUT_ELEMENT_DESC positionVertexDesc[] = {
+        {"Position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+    };
+    Device->CreateInputLayout(positionVertexDesc, UINT(std::size(positionVertexDesc)),
+                              maskVsBlob->GetBufferPointer(), maskVsBlob->GetBufferSize(),
+                              &PositionInputLayout);
+
+    // Create depth pre-pass vertex shader, it reads the position only vertex stream and transforms
+    // with the default vertex shader's ClipPosition so the color pass can depth test for equality
+    const auto depthVertexShaderSrc = clipPositionSrc + R"(float4 main(in float4 pos : POSITION)
+                                                               : SV_Position {
+                                           return ClipPosition(pos);
+                                       })";
+    auto depthVsBlob = compileShader(depthVertexShaderSrc.c_str(), "vs_4_0");
+    Device->CreateVertexShader(depthVsBlob->GetBufferPointer(), depthVsBlob->GetBufferSize(),
+                               nullptr, &DepthVert);
+
     // Create sampler state
     auto ss = CD3D11_SAMPLER_DESC{D3D11_DEFAULT};
     ss.Filter = D3D11_FILTER_ANISOTROPIC;
@@ -601,13 +1321,285 @@ DirectX11::DirectX11(HWND window, int vpW, int vpH, const LUID* pLuid)
     Device->CreateSamplerState(&ss, &SamplerState);
 }
 
+// Measures GPU time between Begin() and End() with timestamp queries. Results are read back a few
+// frames later so the CPU never waits on the GPU, Poll() returns the latest completed measurement.
+struct GpuTimer {
+    struct Queries {
+        ID3D11QueryPtr Disjoint, Start, Stop;
+    };
+    std::array<Queries, 4> Frames;
+    unsigned Issued = 0, Retired = 0;
+    double LastSeconds = 0.0;
+
+    GpuTimer(ID3D11Device* device) {
+        for (auto& f : Frames) {
+            device->CreateQuery(std::begin({CD3D11_QUERY_DESC{D3D11_QUERY_TIMESTAMP_DISJOINT}}),
+                                &f.Disjoint);
+            device->CreateQuery(std::begin({CD3D11_QUERY_DESC{D3D11_QUERY_TIMESTAMP}}), &f.Start);
+            device->CreateQuery(std::begin({CD3D11_QUERY_DESC{D3D11_QUERY_TIMESTAMP}}), &f.Stop);
+        }
+    }
+
+    void Begin(ID3D11DeviceContext* context) {
+        // Drop the oldest measurement rather than stall if the GPU is a full ring behind
+        if (Issued - Retired == size(Frames)) ++Retired;
+        const auto& f = Frames[Issued % size(Frames)];
+        context->Begin(f.Disjoint);
+        context->End(f.Start);
+    }
+
+    void End(ID3D11DeviceContext* context) {
+        const auto& f = Frames[Issued++ % size(Frames)];
+        context->End(f.Stop);
+        context->End(f.Disjoint);
+    }
+
+    auto Poll(ID3D11DeviceContext* context) {
+        for (; Retired != Issued; ++Retired) {
+            const auto& f = Frames[Retired % size(Frames)];
+            auto disjoint = D3D11_QUERY_DATA_TIMESTAMP_DISJOINT{};
+            UINT64 start = 0, stop = 0;
+            if (context->GetData(f.Disjoint, &disjoint, sizeof(disjoint),
+                                 D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+                context->GetData(f.Start, &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) !=
+                    S_OK ||
+                context->GetData(f.Stop, &stop, sizeof(stop), D3D11_ASYNC_GETDATA_DONOTFLUSH) !=
+                    S_OK)
+                break;
+            if (!disjoint.Disjoint) LastSeconds = double(stop - start) / double(disjoint.Frequency);
+        }
+        return LastSeconds;
+    }
+};
+
+// Eye buffer and mirror captures without stalling the frame. A request copies the texture into the
+// next staging texture of the ring, which is mapped Latency frames later once the GPU has finished
+// the copy. Staging textures are all created up front at the largest capture size.
+struct FrameCapture {
+    std::vector<ID3D11Texture2DPtr> Staging;
+    CaptureQueue Queue;
+
+    FrameCapture(ID3D11Device* device, int maxW, int maxH, unsigned slots = 8,
+                 unsigned latency = 2, unsigned workers = 2)
+        : Queue{slots, size_t(maxW) * maxH, latency, workers} {
+        for (auto i = 0u; i < slots; ++i)
+            Staging.push_back(CreateTrackedTexture2D(
+                device, CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM, UINT(maxW), UINT(maxH),
+                                              1, 1, 0, D3D11_USAGE_STAGING,
+                                              D3D11_CPU_ACCESS_READ),
+                nullptr, GpuMemoryCategory::Texture, "Capture staging"));
+    }
+
+    // Copy the top left w x h of an R8G8B8A8 texture, false if the capture was dropped
+    bool Request(ID3D11DeviceContext* context, ID3D11Texture2D* source, int w, int h,
+                 unsigned frame, const char* path) {
+        const auto slot = Queue.Issue(frame, w, h, path);
+        if (slot < 0) return false;
+        context->CopySubresourceRegion(Staging[size_t(slot)], 0, 0, 0, 0, source, 0,
+                                       std::begin({D3D11_BOX{0, 0, 0, UINT(w), UINT(h), 1}}));
+        return true;
+    }
+
+    // Read back the captures that are old enough and whose copies have finished, never waits
+    void Poll(ID3D11DeviceContext* context, unsigned frame) {
+        for (auto slot = Queue.Oldest(frame); slot >= 0; slot = Queue.Oldest(frame)) {
+            const auto staging = Staging[size_t(slot)].GetInterfacePtr();
+            auto map = D3D11_MAPPED_SUBRESOURCE{};
+            if (FAILED(context->Map(staging, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &map)))
+                return;
+            auto& s = Queue.Slots[size_t(slot)];
+            const auto rowBytes = size_t(s.W) * sizeof(uint32_t);
+            s.Pixels.resize(size_t(s.W) * s.H);
+            for (auto y = 0; y < s.H; ++y)
+                memcpy(s.Pixels.data() + size_t(y) * s.W,
+                       static_cast<const char*>(map.pData) + size_t(y) * map.RowPitch, rowBytes);
+            context->Unmap(staging, 0);
+            Queue.Retire();
+        }
+    }
+};
+
+// Encode times for eye buffer sized captures of the ray cast room, kept in memory
+void BenchmarkCapture(int w = 1344, int h = 1600, unsigned captures = 12) {
+    const auto meshes = CreateRoomMeshes();
+    const auto caster = RayCaster{meshes};
+    const auto image = caster.Render(Pose{{0.0f, 1.6f, 5.0f}, {0.0f, 0.0f, 0.0f, 1.0f}},
+                                     FovTangents{1.0f, 1.0f, 1.0f, 1.0f}, w, h,
+                                     std::thread::hardware_concurrency());
+    const auto encodeStart = CpuSeconds();
+    const auto png = EncodePng(image, w, h);
+    LOG_INFO("Capture: %dx%d PNG encoded in %.1fms, %zu KB, %.1f%% of raw RGB\n", w, h,
+             1000.0 * (CpuSeconds() - encodeStart), size(png) / 1024,
+             100.0 * double(size(png)) / (3.0 * double(size(image))));
+    for (auto workers : {1u, 2u, 4u}) {
+        const auto start = CpuSeconds();
+        {
+            CaptureQueue queue{captures, size(image), 0, workers};
+            for (auto i = 0u; i < captures; ++i) {
+                const auto slot = queue.Issue(0, w, h, "");
+                VALIDATE(slot >= 0, "Capture benchmark slot busy.");
+                queue.Slots[size_t(slot)].Pixels.assign(begin(image), end(image));
+                queue.Retire();
+            }
+        }
+        const auto seconds = CpuSeconds() - start;
+        LOG_INFO("Capture: %u PNGs on %u workers in %.3fs, %.1fms per capture\n", captures,
+                 workers, seconds, 1000.0 * seconds / captures);
+    }
+}
+
+static_assert(VisibilityThrottle::NotVisible == ovrSuccess_NotVisible, "Result code changed.");
+
+// Right handed projection matrix for an eye fov in XM format
+auto ProjectionMatrix(const ovrFovPort& fov) {
+    const auto p = ovrMatrix4f_Projection(fov, 0.2f, 1000.0f, ovrProjection_RightHanded);
+    return XMMatrixTranspose(XMLoadFloat4x4(std::begin({XMFLOAT4X4{&p.M[0][0]}})));
+}
+
+// An eye is rendered as one or more regions, each a sub-frustum of the eye fov with its own
+// viewport in the eye buffer. Every region is submitted to the compositor as a separate layer.
+struct EyeRegion {
+    ovrFovPort Fov;
+    ovrRecti Viewport;
+};
+
+struct EyeLayout {
+    static constexpr int MaxRegions = 9;
+    std::array<EyeRegion, MaxRegions> Regions;
+    int NumRegions = 0;
+};
+
+// Without multi-resolution the layout is the whole eye. With it the fov is split into a 3x3 grid in
+// tangent space, the center cell covering centerFraction of each axis at full density and the
+// outer cells at outerDensity, where lens distortion makes extra pixels least valuable. Cells are
+// packed from the top left of the eye viewport with a small gutter so that compositor filtering
+// never bleeds between neighbouring cells.
+auto CreateEyeLayout(const ovrFovPort& fov, const ovrRecti& vp, bool multiRes,
+                     float centerFraction = 0.5f, float outerDensity = 0.5f) {
+    auto res = EyeLayout{};
+    if (!multiRes) {
+        res.Regions[res.NumRegions++] = {fov, vp};
+        return res;
+    }
+    const auto gutter = 2;
+    const auto outerX = (fov.LeftTan + fov.RightTan) * (1.0f - centerFraction) / 2;
+    const auto outerY = (fov.UpTan + fov.DownTan) * (1.0f - centerFraction) / 2;
+    // Cell edges in tangent space, x from left to right and y from top to bottom
+    const float xs[] = {-fov.LeftTan, -fov.LeftTan + outerX, fov.RightTan - outerX, fov.RightTan};
+    const float ys[] = {fov.UpTan, fov.UpTan - outerY, -fov.DownTan + outerY, -fov.DownTan};
+    auto cellSize = [outerDensity](const float* edges, int i, float pixelsPerTan) {
+        const auto density = i == 1 ? 1.0f : outerDensity;
+        return std::max(1, int(std::abs(edges[i + 1] - edges[i]) * pixelsPerTan * density + 0.5f));
+    };
+    auto y = vp.Pos.y;
+    for (auto row = 0; row < 3; ++row) {
+        const auto h = cellSize(ys, row, vp.Size.h / (fov.UpTan + fov.DownTan));
+        auto x = vp.Pos.x;
+        for (auto col = 0; col < 3; ++col) {
+            const auto w = cellSize(xs, col, vp.Size.w / (fov.LeftTan + fov.RightTan));
+            res.Regions[res.NumRegions++] = {{ys[row], -ys[row + 1], -xs[col], xs[col + 1]},
+                                             {{x, y}, {w, h}}};
+            x += w + gutter;
+        }
+        y += h + gutter;
+    }
+    return res;
+}
+
+// GPU copies of one eye's clusters for the clustered pixel shader: light positions and colors,
+// an offset and count per cluster and the light index list, plus the grid parameters in a
+// constant buffer. The buffers are dynamic and rewritten for each eye.
+struct ClusteredLighting {
+    struct Constants {
+        XMFLOAT4 FovTan;  // Left, right, down, up
+        XMFLOAT4 Grid;    // Tiles x, tiles y, slices, slice scale
+        XMFLOAT4 Depth;   // Near, ambient
+    };
+
+    ID3D11BufferPtr Lights, Ranges, Indices, ConstantBuffer;
+    ID3D11ShaderResourceViewPtr LightsSrv, RangesSrv, IndicesSrv;
+    float Ambient = 0.25f;
+
+    ClusteredLighting(ID3D11Device* device, UINT maxLights) {
+        auto create = [device](UINT count, DXGI_FORMAT format, UINT elementBytes,
+                               ID3D11BufferPtr& buffer, ID3D11ShaderResourceViewPtr& srv) {
+            buffer = CreateTrackedBuffer(
+                device, CD3D11_BUFFER_DESC(count * elementBytes, D3D11_BIND_SHADER_RESOURCE,
+                                           D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE),
+                nullptr, GpuMemoryCategory::Constants, "Light clusters");
+            device->CreateShaderResourceView(
+                buffer, std::begin({CD3D11_SHADER_RESOURCE_VIEW_DESC(buffer, format, 0, count)}),
+                &srv);
+        };
+        create(2 * maxLights, DXGI_FORMAT_R32G32B32A32_FLOAT, sizeof(XMFLOAT4), Lights, LightsSrv);
+        create(LightClusters::Count, DXGI_FORMAT_R32G32_UINT, sizeof(LightClusters::Range), Ranges,
+               RangesSrv);
+        create(LightClusters::IndexCapacity, DXGI_FORMAT_R32_UINT, sizeof(UINT), Indices,
+               IndicesSrv);
+        ConstantBuffer = CreateTrackedBuffer(
+            device, CD3D11_BUFFER_DESC(sizeof(Constants), D3D11_BIND_CONSTANT_BUFFER,
+                                       D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE),
+            nullptr, GpuMemoryCategory::Constants, "Light clusters");
+    }
+
+    // Upload the built clusters and bind them to the pixel shader after the scene texture
+    // Returns the bytes written
+    size_t Upload(ID3D11DeviceContext* context, const LightClusters& clusters) const {
+        auto written = size_t{0};
+        auto write = [context, &written](ID3D11Buffer* buffer, const void* data, size_t bytes) {
+            auto map = D3D11_MAPPED_SUBRESOURCE{};
+            context->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+            memcpy(map.pData, data, bytes);
+            context->Unmap(buffer, 0);
+            written += bytes;
+        };
+        const auto& fov = clusters.Fov;
+        const auto constants = Constants{
+            {fov.LeftTan, fov.RightTan, fov.DownTan, fov.UpTan},
+            {float(LightClusters::TilesX), float(LightClusters::TilesY),
+             float(LightClusters::Slices), clusters.SliceScale()},
+            {clusters.Near, Ambient, 0.0f, 0.0f}};
+        write(ConstantBuffer, &constants, sizeof(constants));
+        write(Lights, clusters.ViewLights.data(), size(clusters.ViewLights) * sizeof(XMFLOAT4));
+        write(Ranges, clusters.Ranges.data(), size(clusters.Ranges) * sizeof(LightClusters::Range));
+        write(Indices, clusters.Indices.data(), clusters.Assigned * sizeof(UINT));
+
+        const auto srvs = {LightsSrv.GetInterfacePtr(), RangesSrv.GetInterfacePtr(),
+                           IndicesSrv.GetInterfacePtr()};
+        context->PSSetShaderResources(1, UINT(size(srvs)), begin(srvs));
+        const auto buffs = {ConstantBuffer.GetInterfacePtr()};
+        context->PSSetConstantBuffers(1, UINT(size(buffs)), begin(buffs));
+        return written;
+    }
+};
+
+// Time cluster assignment for increasing numbers of lights spread through a volume in front of the
+// camera, the cost the CPU pays per eye per frame
+void BenchmarkLightClusters(const ovrFovPort& fov, int iterations = 50) {
+    auto clusters = LightClusters{fov};
+    std::vector<MeshDesc> volume(1);
+    volume[0].Mesh.AddBox(-20.0f, -2.0f, 0.0f, 20.0f, 6.0f, -60.0f, 0xff808080);
+    for (auto count : {1000, 2000, 5000, 10000}) {
+        auto lights = CreateLights(count, volume);
+        const auto start = ovr_GetTimeInSeconds();
+        for (auto i = 0; i < iterations; ++i) {
+            AnimateLights(lights, 0.1f * i);
+            clusters.Build(lights, Pose{{0, 0, 0}, {0, 0, 0, 1}});
+        }
+        const auto ms = 1000.0 * (ovr_GetTimeInSeconds() - start) / iterations;
+        LOG_INFO("Light cluster benchmark: %d lights %.3fms per eye, %.1f lights per cluster, "
+                 "%zu dropped\n",
+                 count, ms, double(clusters.Assigned) / LightClusters::Count, clusters.Dropped);
+    }
+}
+
 // Helper to wrap ovr types like ovrHmd and ovrTexture* in a unique_ptr with custom create / destroy
 auto create_unique = [](auto createFunc, auto destroyFunc) {
     return std::unique_ptr<std::remove_reference_t<decltype(*createFunc())>, decltype(destroyFunc)>{
         createFunc(), destroyFunc};
 };
 
-ovrResult MainLoop(const Window& window) {
+ovrResult MainLoop(Window& window, const Options& options) {
     auto result = ovrResult{};
     auto luid = ovrGraphicsLuid{};
     // Initialize the HMD, stash it in a unique_ptr for automatic cleanup.
@@ -621,11 +1613,16 @@ ovrResult MainLoop(const Window& window) {
     if (OVR_FAILURE(result)) return result;
 
     auto hmdDesc = ovr_GetHmdDesc(HMD.get());
+    GpuMemory().Budget = size_t(options.GpuBudgetMB) << 20;
 
     // Setup Device and shared D3D objects (shaders, state objects, etc.)
     // Note: the mirror window can be any size, for this sample we use 1/2 the HMD resolution
-    auto directx = DirectX11{window.Hwnd, hmdDesc.Resolution.w / 2, hmdDesc.Resolution.h / 2,
-                             reinterpret_cast<LUID*>(&luid)};
+    // reduced by the mirror divisor, showing only the left half of the mirror in single eye mode.
+    const auto mirrorW = std::max(2, hmdDesc.Resolution.w / 2 / options.MirrorDivisor);
+    const auto mirrorH = std::max(1, hmdDesc.Resolution.h / 2 / options.MirrorDivisor);
+    auto directx =
+        DirectX11{window.Hwnd, options.Mirror == MirrorMode::SingleEye ? mirrorW / 2 : mirrorW,
+                  mirrorH, reinterpret_cast<LUID*>(&luid)};
 
     // Initialize the sensor which tracks the Rift's position and orientation
     result = ovr_ConfigureTracking(
@@ -633,51 +1630,386 @@ ovrResult MainLoop(const Window& window) {
         ovrTrackingCap_Orientation | ovrTrackingCap_MagYawCorrection | ovrTrackingCap_Position, 0);
     if (OVR_FAILURE(result)) return result;
 
-    // Create the eye render buffers (caution if actual size < requested due to HW limits).
+    // Create the eye render buffers (caution if actual size < requested due to HW limits). They
+    // are allocated at the maximum pixel density, dynamic resolution renders into a sub-rectangle.
+    const auto maxPixelDensity = 1.25f;
     const ovrSizei idealSizes[] = {
-        ovr_GetFovTextureSize(HMD.get(), ovrEye_Left, hmdDesc.DefaultEyeFov[ovrEye_Left], 1.0f),
-        ovr_GetFovTextureSize(HMD.get(), ovrEye_Right, hmdDesc.DefaultEyeFov[ovrEye_Right], 1.0f)};
+        ovr_GetFovTextureSize(HMD.get(), ovrEye_Left, hmdDesc.DefaultEyeFov[ovrEye_Left],
+                              maxPixelDensity),
+        ovr_GetFovTextureSize(HMD.get(), ovrEye_Right, hmdDesc.DefaultEyeFov[ovrEye_Right],
+                              maxPixelDensity)};
     OculusTexture eyeRenderTextures[] = {{directx.Device, HMD.get(), idealSizes[ovrEye_Left]},
                                          {directx.Device, HMD.get(), idealSizes[ovrEye_Right]}};
-    DepthBuffer eyeDepthBuffers[] = {{directx.Device, idealSizes[ovrEye_Left]},
-                                     {directx.Device, idealSizes[ovrEye_Right]}};
-    const ovrRecti eyeRenderViewports[] = {{{0, 0}, idealSizes[ovrEye_Left]},
-                                           {{0, 0}, idealSizes[ovrEye_Right]}};
+    ovrRecti eyeRenderViewports[] = {{{0, 0}, idealSizes[ovrEye_Left]},
+                                     {{0, 0}, idealSizes[ovrEye_Right]}};
+
+    // Create the hidden area masks and report how many eye buffer pixels they save shading
+    const HiddenAreaMesh hiddenAreaMeshes[] = {
+        {directx.Device, CreateHiddenAreaMesh(hmdDesc.DefaultEyeFov[ovrEye_Left])},
+        {directx.Device, CreateHiddenAreaMesh(hmdDesc.DefaultEyeFov[ovrEye_Right])}};
+    for (auto eye : {ovrEye_Left, ovrEye_Right}) {
+        const auto proj = ProjectionMatrix(hmdDesc.DefaultEyeFov[eye]);
+        const auto verts = CreateHiddenAreaMesh(hmdDesc.DefaultEyeFov[eye]);
+        auto raster = CoverageRasterizer{idealSizes[eye].w, idealSizes[eye].h};
+        auto clip = [&verts, &proj](size_t i) {
+            return ToFloat4(XMVector3TransformCoord(XMLoadFloat3(&verts[i]), proj));
+        };
+        for (auto i = 0u; i < size(verts); i += 3)
+            raster.DrawTriangle(clip(i), clip(i + 1), clip(i + 2));
+        const auto total = size_t(idealSizes[eye].w) * idealSizes[eye].h;
+        const auto masked = size_t(raster.CountCovered());
+        LOG_INFO("Hidden area mask eye %d: %zu of %zu pixels masked (%.1f%%)\n", int(eye), masked,
+                 total, 100.0 * masked / total);
+    }
 
     // Create mirror texture to see on the monitor, stash it in a unique_ptr for automatic cleanup.
+    // With the mirror off there is no mirror texture and the compositor skips mirroring entirely.
     auto mirrorTexture = create_unique(
-        [&result, hmd = HMD.get(), &directx] {
+        [&result, hmd = HMD.get(), &directx, &options, mirrorW, mirrorH] {
             ovrTexture* mirrorTexture{};
+            if (options.Mirror == MirrorMode::Off) return mirrorTexture;
             result = ovr_CreateMirrorTextureD3D11(
                 hmd, directx.Device,
-                std::begin({CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, directx.WinSizeW,
-                                                  directx.WinSizeH, 1, 1)}),
+                std::begin({CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, mirrorW,
+                                                  mirrorH, 1, 1)}),
                 0, &mirrorTexture);
+            if (OVR_SUCCESS(result))
+                TrackTexture2D(
+                    reinterpret_cast<ovrD3D11Texture*>(mirrorTexture)->D3D11.pTexture,
+                    GpuMemoryCategory::RenderTarget, "Mirror texture");
             return mirrorTexture;
         },
         [hmd = HMD.get()](ovrTexture* mt) { ovr_DestroyMirrorTexture(hmd, mt); });
     if (OVR_FAILURE(result)) return result;
 
+    // Dynamic resolution starts at pixel density 1.0 and is driven by GPU time for the eye buffers
+    auto eyeGpuTimer = GpuTimer{directx.Device};
+    auto mirrorGpuTimer = GpuTimer{directx.Device};
+    auto frameIndex = 0u;
+    auto dynamicRes = DynamicResolution{0.5f / maxPixelDensity, 1.0f, 1.0f / maxPixelDensity};
+    const auto frameBudget =
+        1.0 / (hmdDesc.DisplayRefreshRate > 0.0f ? hmdDesc.DisplayRefreshRate : 75.0f);
+
     // Initialize the scene and camera
-    auto roomScene = Scene{directx.Device, directx.Context};
+    // Built with flat colors so coplanar faces can be merged, lighting is baked in afterwards
+    // unless dynamic lights replace it
+    auto cells = CellGraph{};
+    auto roomMeshes = options.Rooms ? CreateRoomGrid(options.Rooms, false, &cells)
+                                    : CreateRoomMeshes(false, &cells);
+    auto editableMesh = roomMeshes.back().Mesh;
+    editableMesh.BakeLighting = !options.Lights;
+    if (options.Benchmark) BenchmarkAmbientOcclusion(roomMeshes);
+    if (options.BakeAO) BakeAmbientOcclusion(roomMeshes);
+    if (options.Benchmark && !options.Rooms) {
+        // Hidden face removal savings on a generated venue for comparison with the default room
+        auto grid = CreateRoomGrid(8, false);
+        RemoveHiddenFaces(grid);
+        MergeCoplanarFaces(grid);
+    }
+    auto hlod = Hlod{};
+    if (options.HlodPixels) hlod.Build(roomMeshes);
+    RemoveHiddenFaces(roomMeshes);
+    MergeCoplanarFaces(roomMeshes);
+    hlod.AppendProxies(roomMeshes);
+    if (!options.Lights) BakeVertexLighting(roomMeshes);
+    auto roomScene = Scene{directx.Device, directx.Context, roomMeshes};
+    cells.AssignMeshes(roomMeshes);
     auto mainCam = Camera{XMVectorSet(0.0f, 1.6f, 5.0f, 0), XMQuaternionIdentity()};
+    // Baked visible sets, memory mapped from the cache file
+    Pvs pvs;
+    if (options.Benchmark) BenchmarkPvs(roomMeshes);
+    if (options.Benchmark) BenchmarkReconnect();
+    if (options.Benchmark) BenchmarkLogger();
+    if (options.Pvs && pvs.Load(roomMeshes)) {
+        auto startPos = XMFLOAT3{};
+        XMStoreFloat3(&startPos, mainCam.Pos);
+        auto visible = std::vector<bool>(size(roomMeshes), true);
+        const auto hidden = pvs.Cull(startPos, visible);
+        auto triangles = size_t{0}, culledTriangles = size_t{0};
+        for (auto m = 0u; m < size(roomMeshes); ++m) {
+            triangles += size(roomMeshes[m].Mesh.Indices) / 3;
+            if (!visible[m]) culledTriangles += size(roomMeshes[m].Mesh.Indices) / 3;
+        }
+        LOG_INFO("PVS from the start position: %zu of %zu models, %zu of %zu triangles culled\n",
+                 hidden, size(roomMeshes), culledTriangles, triangles);
+    }
+    // Projected sizes are measured in eye buffer pixels at full resolution
+    const auto hlodPixelsPerTan =
+        float(idealSizes[ovrEye_Left].h) / (hmdDesc.DefaultEyeFov[ovrEye_Left].UpTan +
+                                            hmdDesc.DefaultEyeFov[ovrEye_Left].DownTan);
+    if (options.HlodPixels)
+        hlod.ReportSavings(roomScene.Meshes, roomScene.Visible, mainCam.GetPose().Pos,
+                           hlodPixelsPerTan, float(options.HlodPixels));
+    if (options.Benchmark) BenchmarkGeometryUpdates(roomScene.Pool, directx.Context, editableMesh);
+
+    // Clustered dynamic lights are binned per eye each frame and uploaded for the pixel shader
+    auto lights =
+        options.Lights ? CreateLights(options.Lights, roomMeshes) : std::vector<PointLight>{};
+    std::array<LightClusters, 2> lightClusters = {
+        {LightClusters{hmdDesc.DefaultEyeFov[ovrEye_Left]},
+         LightClusters{hmdDesc.DefaultEyeFov[ovrEye_Right]}}};
+    const auto clusteredLighting =
+        options.Lights ? std::make_unique<ClusteredLighting>(directx.Device, UINT(size(lights)))
+                       : nullptr;
+    if (options.Benchmark) BenchmarkLightClusters(hmdDesc.DefaultEyeFov[ovrEye_Left]);
+    if (options.Benchmark) BenchmarkPortals(hmdDesc.DefaultEyeFov[ovrEye_Left]);
+    if (options.Benchmark) BenchmarkCapture(idealSizes[ovrEye_Left].w, idealSizes[ovrEye_Left].h);
+
+    // Report overdraw from the starting view with and without a depth pre-pass
+    for (auto prePass : {false, true}) {
+        const auto proj = ProjectionMatrix(hmdDesc.DefaultEyeFov[ovrEye_Left]);
+        const auto projView = XMMatrixMultiply(mainCam.GetViewMatrix(), proj);
+        const auto raster = MeasureShading(roomMeshes, projView, idealSizes[ovrEye_Left].w,
+                                           idealSizes[ovrEye_Left].h, prePass);
+        const auto covered = std::max(size_t(raster.CountCovered()), size_t(1));
+        LOG_INFO("Depth pre-pass %s: %zu fragments rasterized, %zu shaded, overdraw %.2f\n",
+                 prePass ? "on" : "off", raster.Fragments, raster.Passed,
+                 double(raster.Passed) / covered);
+    }
+
+    // Transient per frame data. Layers submitted to the compositor live in the frame arena and are
+    // kept across frames for resubmission while not visible.
+    auto frameArena = FrameArena{64 * 1024};
+    auto layerData = frameArena.MakeVector<ovrLayerEyeFov>();
+    auto layers = frameArena.MakeVector<const ovrLayerHeader*>();
+    auto visibility = VisibilityThrottle{};
+
+    // Per frame eye state shared by the frame graph passes
+    std::array<ovrPosef, 2> eyeRenderPoses;
+    std::array<EyeLayout, 2> eyeLayouts;
+    auto eyeCpuStart = 0.0;
+    auto poseSampleTime = 0.0, poseAge = 0.0;
+
+    // The frame graph. The eyes render one after the other so their depth buffers are transient
+    // and alias onto a single physical depth buffer. Graph resources are never block compressed so
+    // their format blocks are single pixels.
+    auto frameGraph =
+        RenderGraph{[](unsigned format) { return TextureFormatBlock(DXGI_FORMAT(format)).Bytes; }};
+    const int eyeColors[] = {
+        frameGraph.Import("Left eye color", {idealSizes[ovrEye_Left].w, idealSizes[ovrEye_Left].h},
+                          DXGI_FORMAT_R8G8B8A8_UNORM_SRGB),
+        frameGraph.Import("Right eye color",
+                          {idealSizes[ovrEye_Right].w, idealSizes[ovrEye_Right].h},
+                          DXGI_FORMAT_R8G8B8A8_UNORM_SRGB)};
+    const int eyeDepths[] = {
+        frameGraph.CreateTransient("Left eye depth",
+                                   {idealSizes[ovrEye_Left].w, idealSizes[ovrEye_Left].h},
+                                   DXGI_FORMAT_D24_UNORM_S8_UINT),
+        frameGraph.CreateTransient("Right eye depth",
+                                   {idealSizes[ovrEye_Right].w, idealSizes[ovrEye_Right].h},
+                                   DXGI_FORMAT_D24_UNORM_S8_UINT)};
+    const auto mirrorColor = frameGraph.Import("Mirror texture", {mirrorW, mirrorH},
+                                               DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
+    const auto backBuffer = frameGraph.Import(
+        "Back buffer", {directx.WinSizeW, directx.WinSizeH}, DXGI_FORMAT_R8G8B8A8_UNORM);
+    std::vector<DepthBuffer> graphDepthBuffers;
+
+    for (auto eye : {ovrEye_Left, ovrEye_Right})
+        frameGraph.AddPass(
+            eye == ovrEye_Left ? "Left eye" : "Right eye", {},
+            {eyeColors[eye], eyeDepths[eye]}, [&, eye](const RenderGraph::Pass& pass) {
+                if (eye == ovrEye_Left) {
+                    eyeCpuStart = ovr_GetTimeInSeconds();
+                    eyeGpuTimer.Begin(directx.Context);
+                }
+
+                // Increment to use next texture, just before rendering
+                const auto texIndex = eyeRenderTextures[eye].AdvanceToNextTexture();
+                auto& depthBuffer =
+                    graphDepthBuffers[frameGraph.Resources[eyeDepths[eye]].Physical];
+                directx.SetAndClearRenderTarget(eyeRenderTextures[eye].TexRtvs[texIndex],
+                                                &depthBuffer, pass.ShouldClear(eyeColors[eye]),
+                                                pass.ShouldClear(eyeDepths[eye]));
+
+                // Get the pose information in XM format
+                const auto eyeQuat =
+                    XMLoadFloat4(std::begin({XMFLOAT4{&eyeRenderPoses[eye].Orientation.x}}));
+                const auto eyePos =
+                    XMLoadFloat3(std::begin({XMFLOAT3{&eyeRenderPoses[eye].Position.x}}));
+
+                // Get view and projection matrices for the eye camera
+                const auto CombinedPos =
+                    XMVectorAdd(mainCam.Pos, XMVector3Rotate(eyePos, mainCam.Rot));
+                const auto finalCam =
+                    Camera{CombinedPos, XMQuaternionMultiply(eyeQuat, mainCam.Rot)};
+
+                const auto view = finalCam.GetViewMatrix();
+                std::fill(begin(roomScene.Visible), end(roomScene.Visible), true);
+                if (options.HlodPixels) {
+                    directx.Stats.HlodProxies +=
+                        hlod.Select(roomScene.Visible, finalCam.GetPose().Pos, hlodPixelsPerTan,
+                                    float(options.HlodPixels));
+                    directx.Stats.HlodCells += size(hlod.Clusters);
+                }
+                if (options.Portals) {
+                    const auto portalCpuStart = ovr_GetTimeInSeconds();
+                    if (cells.Traverse(finalCam.GetPose(), hmdDesc.DefaultEyeFov[eye]))
+                        cells.Cull(roomScene.Visible);
+                    directx.Stats.PortalCpuSeconds += ovr_GetTimeInSeconds() - portalCpuStart;
+                    directx.Stats.PortalVisibleCells += size_t(std::count(
+                        begin(cells.VisibleCells), end(cells.VisibleCells), true));
+                    directx.Stats.PortalCells += size(cells.Cells);
+                }
+                if (options.Pvs) {
+                    auto eyeFloat3 = XMFLOAT3{};
+                    XMStoreFloat3(&eyeFloat3, CombinedPos);
+                    directx.Stats.PvsHidden += pvs.Cull(eyeFloat3, roomScene.Visible);
+                    directx.Stats.PvsModels += size(roomScene.Visible);
+                }
+                directx.Stats.CulledModels += size_t(
+                    std::count(begin(roomScene.Visible), end(roomScene.Visible), false));
+                directx.Stats.Models += size(roomScene.Visible);
+
+                if (clusteredLighting) {
+                    const auto lightCpuStart = ovr_GetTimeInSeconds();
+                    lightClusters[eye].Build(lights, finalCam.GetPose());
+                    directx.Stats.UploadedBytes +=
+                        clusteredLighting->Upload(directx.Context, lightClusters[eye]);
+                    directx.Stats.LightCpuSeconds += ovr_GetTimeInSeconds() - lightCpuStart;
+                    directx.Stats.LightAssignments += lightClusters[eye].Assigned;
+                }
+
+                // Render the scene into each region of the eye with its own sub-frustum
+                const auto& layout = eyeLayouts[eye];
+                for (auto i = 0; i < layout.NumRegions; ++i) {
+                    const auto& region = layout.Regions[i];
+                    directx.SetViewport(region.Viewport);
+                    const auto proj = ProjectionMatrix(region.Fov);
+                    directx.ApplyHiddenAreaMask(hiddenAreaMeshes[eye], proj);
+                    roomScene.Render(directx, view, proj, options);
+                    directx.Stats.ShadedPixels +=
+                        size_t(region.Viewport.Size.w) * region.Viewport.Size.h;
+                }
+                directx.Stats.FullPixels +=
+                    size_t(eyeRenderViewports[eye].Size.w) * eyeRenderViewports[eye].Size.h;
+
+                if (eye == ovrEye_Right) {
+                    eyeGpuTimer.End(directx.Context);
+                    directx.Stats.EyeCpuSeconds += ovr_GetTimeInSeconds() - eyeCpuStart;
+                }
+                return true;
+            });
+
+    // The compositor reads the eye buffers and writes the mirror texture
+    frameGraph.AddPass(
+        "Submit", {eyeColors[ovrEye_Left], eyeColors[ovrEye_Right]}, {mirrorColor},
+        [&](const RenderGraph::Pass&) {
+            // One Fov layer per eye region, a single full screen layer without multi-res
+            const auto numLayers = size_t(eyeLayouts[ovrEye_Left].NumRegions);
+            layerData = frameArena.MakeVector<ovrLayerEyeFov>();
+            layers = frameArena.MakeVector<const ovrLayerHeader*>();
+            layerData.reserve(numLayers);
+            layers.reserve(numLayers);
+            for (auto i = 0u; i < numLayers; ++i) {
+                auto ld = ovrLayerEyeFov{{ovrLayerType_EyeFov, 0}};
+                for (auto eye : {ovrEye_Left, ovrEye_Right}) {
+                    ld.ColorTexture[eye] = eyeRenderTextures[eye].TextureSet.get();
+                    ld.Viewport[eye] = eyeLayouts[eye].Regions[i].Viewport;
+                    ld.Fov[eye] = eyeLayouts[eye].Regions[i].Fov;
+                    ld.RenderPose[eye] = eyeRenderPoses[eye];
+                }
+                layerData.push_back(ld);
+                layers.push_back(&layerData.back().Header);
+            }
+            poseAge = ovr_GetTimeInSeconds() - poseSampleTime;
+            result = ovr_SubmitFrame(HMD.get(), 0, nullptr, layers.data(), unsigned(size(layers)));
+            // exit the rendering loop on error, will retry on ovrError_DisplayLost
+            if (OVR_FAILURE(result)) return false;
+            visibility.OnSubmit(result, ovr_GetTimeInSeconds());
+            return true;
+        });
+
+    // Display mirror texture on monitor. Present doesn't wait for the swap chain, if it is still
+    // busy this mirror update is dropped rather than delaying the next eye frame.
+    frameGraph.AddPass("Mirror", {mirrorColor}, {backBuffer}, [&](const RenderGraph::Pass&) {
+        if (!mirrorTexture || frameIndex % unsigned(options.MirrorEvery) != 0) return true;
+        const auto mirrorCpuStart = ovr_GetTimeInSeconds();
+        const auto mirrorTex =
+            reinterpret_cast<ovrD3D11Texture*>(mirrorTexture.get())->D3D11.pTexture;
+        directx.Stats.MirrorGpuSeconds += mirrorGpuTimer.Poll(directx.Context);
+        mirrorGpuTimer.Begin(directx.Context);
+        if (options.Mirror == MirrorMode::SingleEye)
+            directx.Context->CopySubresourceRegion(
+                directx.BackBuffer, 0, 0, 0, 0, mirrorTex, 0,
+                std::begin({D3D11_BOX{0, 0, 0, UINT(directx.WinSizeW), UINT(mirrorH), 1}}));
+        else
+            directx.Context->CopyResource(directx.BackBuffer, mirrorTex);
+        mirrorGpuTimer.End(directx.Context);
+        if (directx.SwapChain->Present(0, DXGI_PRESENT_DO_NOT_WAIT) !=
+            DXGI_ERROR_WAS_STILL_DRAWING)
+            ++directx.Stats.MirrorPresents;
+        directx.Stats.MirrorCpuSeconds += ovr_GetTimeInSeconds() - mirrorCpuStart;
+        return true;
+    });
+
+    frameGraph.Compile();
+    for (const auto& physical : frameGraph.Physical)
+        graphDepthBuffers.emplace_back(directx.Device, ovrSizei{physical.Size.w, physical.Size.h});
+    LOG_INFO("Frame graph transient memory: %zu KB before aliasing, %zu KB after\n",
+             frameGraph.TransientBytes() / 1024, frameGraph.PhysicalBytes() / 1024);
+    GpuMemory().Report();
+
+    // Per frame counters for telemetry_reader
+    Telemetry telemetry;
+    if (options.Telemetry && !telemetry.Open(true))
+        LOG_WARNING("Telemetry: failed to create the shared memory ring\n");
+    auto lastFrameStart = ovr_GetTimeInSeconds();
+
+    // Eye buffer and mirror captures, read back and written a few frames after they are requested
+    const auto capture =
+        options.Capture
+            ? std::make_unique<FrameCapture>(
+                  directx.Device, std::max({idealSizes[ovrEye_Left].w,
+                                            idealSizes[ovrEye_Right].w, mirrorW}),
+                  std::max({idealSizes[ovrEye_Left].h, idealSizes[ovrEye_Right].h, mirrorH}))
+            : nullptr;
+    auto captureGpuTimer = GpuTimer{directx.Device};
+    auto captureKeyDown = false;
 
     // Main loop
+    auto keyboard = KeyboardState{};
     while (window.HandleMessages()) {
+        // Rebuild the key state from the events queued since the last pass, even while hidden, so
+        // the ring never fills and a key released meanwhile doesn't stay down
+        keyboard.Drain(window.Input, ovr_GetTimeInSeconds());
+
+        // Low power mode while the compositor isn't showing us: no rendering, just poll
+        const auto action = visibility.NextAction(ovr_GetTimeInSeconds());
+        if (action == VisibilityThrottle::Action::Wait) {
+            // Sleep until the next poll, window messages are handled on their own thread
+            const auto wait = visibility.NextPoll - ovr_GetTimeInSeconds();
+            Sleep(DWORD(std::max(0.0, wait) * 1000.0));
+            continue;
+        }
+        if (action == VisibilityThrottle::Action::Poll) {
+            result = ovr_SubmitFrame(HMD.get(), 0, nullptr, layers.data(), unsigned(size(layers)));
+            if (OVR_FAILURE(result)) return result;
+            visibility.OnSubmit(result, ovr_GetTimeInSeconds());
+            continue;
+        }
+
+        frameArena.BeginFrame();
+        const auto frameStart = ovr_GetTimeInSeconds();
+        const auto frameStartStats = directx.Stats;
+        const auto frameStartAllocations = AllocationTracker::Count;
+        const auto frameStartAllocatedBytes = AllocationTracker::Bytes;
+
         // Handle input
-        [&mainCam, &window] {
+        directx.Stats.InputEvents += keyboard.Events;
+        directx.Stats.InputLatencySeconds += keyboard.Latency;
+        [&mainCam, &keys = keyboard.Keys] {
             const auto forward = XMVector3Rotate(XMVectorSet(0, 0, -0.05f, 0), mainCam.Rot);
             const auto right = XMVector3Rotate(XMVectorSet(0.05f, 0, 0, 0), mainCam.Rot);
-            if (window.Keys['W'] || window.Keys[VK_UP])
+            if (keys['W'] || keys[VK_UP])
                 mainCam.Pos = XMVectorAdd(mainCam.Pos, forward);
-            if (window.Keys['S'] || window.Keys[VK_DOWN])
+            if (keys['S'] || keys[VK_DOWN])
                 mainCam.Pos = XMVectorSubtract(mainCam.Pos, forward);
-            if (window.Keys['D']) mainCam.Pos = XMVectorAdd(mainCam.Pos, right);
-            if (window.Keys['A']) mainCam.Pos = XMVectorSubtract(mainCam.Pos, right);
+            if (keys['D']) mainCam.Pos = XMVectorAdd(mainCam.Pos, right);
+            if (keys['A']) mainCam.Pos = XMVectorSubtract(mainCam.Pos, right);
             static auto Yaw = 0.0f;
-            if (window.Keys[VK_LEFT])
+            if (keys[VK_LEFT])
                 mainCam.Rot = XMQuaternionRotationRollPitchYaw(0, Yaw += 0.02f, 0);
-            if (window.Keys[VK_RIGHT])
+            if (keys[VK_RIGHT])
                 mainCam.Rot = XMQuaternionRotationRollPitchYaw(0, Yaw -= 0.02f, 0);
         }();
 
@@ -686,14 +2018,19 @@ ovrResult MainLoop(const Window& window) {
             static auto cubeClock = 0.0f;
             cube->Pos = XMFLOAT3(9 * sin(cubeClock), 3, 9 * cos(cubeClock += 0.015f));
         }();
+        [&lights] {
+            static auto lightClock = 0.0f;
+            AnimateLights(lights, lightClock += 0.01f);
+        }();
 
         // Get both eye poses simultaneously, with IPD offset already included.
         const ovrEyeRenderDesc eyeRenderDesc[] = {
             ovr_GetRenderDesc(HMD.get(), ovrEye_Left, hmdDesc.DefaultEyeFov[ovrEye_Left]),
             ovr_GetRenderDesc(HMD.get(), ovrEye_Right, hmdDesc.DefaultEyeFov[ovrEye_Right])};
-        const auto eyeRenderPoses = [hmd = HMD.get(), &eyeRenderDesc] {
+        eyeRenderPoses = [hmd = HMD.get(), &eyeRenderDesc, &poseSampleTime] {
             std::array<ovrPosef, 2> res;
             const auto ftiming = ovr_GetFrameTiming(hmd, 0);
+            poseSampleTime = ovr_GetTimeInSeconds();
             const auto hmdState = ovr_GetTrackingState(hmd, ftiming.DisplayMidpointSeconds);
             const ovrVector3f HmdToEyeViewOffset[] = {
                 eyeRenderDesc[ovrEye_Left].HmdToEyeViewOffset,
@@ -702,67 +2039,102 @@ ovrResult MainLoop(const Window& window) {
             return res;
         }();
 
-        // Render Scene to Eye Buffers
-        for (auto eye : {ovrEye_Left, ovrEye_Right}) {
-            // Increment to use next texture, just before rendering
-            const auto texIndex = eyeRenderTextures[eye].AdvanceToNextTexture();
-            directx.SetAndClearRenderTarget(eyeRenderTextures[eye].TexRtvs[texIndex],
-                                            &eyeDepthBuffers[eye]);
-            directx.SetViewport(eyeRenderViewports[eye]);
-
-            // Get the pose information in XM format
-            const auto eyeQuat =
-                XMLoadFloat4(std::begin({XMFLOAT4{&eyeRenderPoses[eye].Orientation.x}}));
-            const auto eyePos =
-                XMLoadFloat3(std::begin({XMFLOAT3{&eyeRenderPoses[eye].Position.x}}));
-
-            // Get view and projection matrices for the eye camera
-            const auto CombinedPos =
-                XMVectorAdd(mainCam.Pos, XMVector3Rotate(eyePos, mainCam.Rot));
-            const auto finalCam =
-                Camera{CombinedPos, XMQuaternionMultiply(eyeQuat, mainCam.Rot)};
-            const auto p = ovrMatrix4f_Projection(eyeRenderDesc[eye].Fov, 0.2f, 1000.0f,
-                                                    ovrProjection_RightHanded);
-            const auto proj =
-                XMMatrixTranspose(XMLoadFloat4x4(std::begin({XMFLOAT4X4{&p.M[0][0]}})));
-
-            // Render the scene
-            roomScene.Render(directx, XMMatrixMultiply(finalCam.GetViewMatrix(), proj));
+        // Pick this frame's eye viewports, the eye buffers themselves are never reallocated
+        const auto scale = dynamicRes.Update(eyeGpuTimer.Poll(directx.Context), frameBudget);
+        for (auto eye : {ovrEye_Left, ovrEye_Right})
+            eyeRenderViewports[eye].Size = {std::max(1, int(idealSizes[eye].w * scale)),
+                                            std::max(1, int(idealSizes[eye].h * scale))};
+
+        eyeLayouts = {
+            CreateEyeLayout(eyeRenderDesc[ovrEye_Left].Fov, eyeRenderViewports[ovrEye_Left],
+                            options.MultiRes),
+            CreateEyeLayout(eyeRenderDesc[ovrEye_Right].Fov, eyeRenderViewports[ovrEye_Right],
+                            options.MultiRes)};
+
+        // Render the eyes, submit and update the mirror
+        if (!frameGraph.Execute()) return result;
+        ++frameIndex;
+
+        directx.Stats.EyeGpuSeconds += eyeGpuTimer.LastSeconds;
+        directx.Stats.Layers += size(layers);
+        if (telemetry.Mapped) {
+            const auto& stats = directx.Stats;
+            telemetry.Publish({frameIndex, frameStart, frameStart - lastFrameStart,
+                               stats.EyeCpuSeconds - frameStartStats.EyeCpuSeconds,
+                               eyeGpuTimer.LastSeconds, poseAge,
+                               UINT(stats.Draws - frameStartStats.Draws),
+                               UINT(stats.CulledModels - frameStartStats.CulledModels),
+                               UINT(stats.Models - frameStartStats.Models),
+                               UINT(stats.UploadedBytes - frameStartStats.UploadedBytes)});
         }
-
-        // Initialize our single full screen Fov layer.
-        const auto ld = [&eyeRenderTextures, &eyeRenderViewports, &hmdDesc, &eyeRenderPoses] {
-            auto res = ovrLayerEyeFov{{ovrLayerType_EyeFov, 0}};
-            for (auto eye : {ovrEye_Left, ovrEye_Right}) {
-                res.ColorTexture[eye] = eyeRenderTextures[eye].TextureSet.get();
-                res.Viewport[eye] = eyeRenderViewports[eye];
-                res.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
-                res.RenderPose[eye] = eyeRenderPoses[eye];
+        lastFrameStart = frameStart;
+
+        // Read back earlier captures before copying this frame's eye buffers and mirror
+        const auto captureKey = keyboard.Keys[VK_F12] && !captureKeyDown;
+        captureKeyDown = keyboard.Keys[VK_F12];
+        if (capture) {
+            const auto captureCpuStart = ovr_GetTimeInSeconds();
+            const auto retired = capture->Queue.Retired;
+            capture->Poll(directx.Context, frameIndex);
+            auto capturing = capture->Queue.Retired != retired;
+            if (captureKey ||
+                (options.CaptureEvery && frameIndex % unsigned(options.CaptureEvery) == 0)) {
+                directx.Stats.CaptureGpuSeconds += captureGpuTimer.Poll(directx.Context);
+                captureGpuTimer.Begin(directx.Context);
+                auto request = [&](ID3D11Texture2D* tex, int w, int h, const char* name) {
+                    char path[64];
+                    snprintf(path, sizeof(path), "capture_%05u_%s.png", frameIndex, name);
+                    if (capture->Request(directx.Context, tex, w, h, frameIndex, path))
+                        ++directx.Stats.Captures;
+                    else
+                        ++directx.Stats.CapturesDropped;
+                };
+                for (auto eye : {ovrEye_Left, ovrEye_Right}) {
+                    const auto& ts = *eyeRenderTextures[eye].TextureSet;
+                    request(reinterpret_cast<const ovrD3D11Texture&>(ts.Textures[ts.CurrentIndex])
+                                .D3D11.pTexture,
+                            eyeRenderViewports[eye].Size.w, eyeRenderViewports[eye].Size.h,
+                            eye == ovrEye_Left ? "left" : "right");
+                }
+                if (mirrorTexture)
+                    request(reinterpret_cast<ovrD3D11Texture*>(mirrorTexture.get())->D3D11.pTexture,
+                            mirrorW, mirrorH, "mirror");
+                captureGpuTimer.End(directx.Context);
+                capturing = true;
             }
-            return res;
-        }();
-        const auto layers = &ld.Header;
-        result = ovr_SubmitFrame(HMD.get(), 0, nullptr, &layers, 1);
-        // exit the rendering loop if submit returns an error, will retry on ovrError_DisplayLost
-        if (OVR_FAILURE(result)) return result;
-
-        // Display mirror texture on monitor
-        directx.Context->CopyResource(
-            directx.BackBuffer,
-            reinterpret_cast<ovrD3D11Texture*>(mirrorTexture.get())->D3D11.pTexture);
-        directx.SwapChain->Present(0, 0);
+            directx.Stats.CaptureCpuSeconds += ovr_GetTimeInSeconds() - captureCpuStart;
+            if (capturing) {
+                ++directx.Stats.CaptureFrames;
+                directx.Stats.CaptureFrameSeconds += ovr_GetTimeInSeconds() - frameStart;
+            }
+        }
+        directx.Stats.FrameSeconds += ovr_GetTimeInSeconds() - frameStart;
+
+        // After warm up a frame should never touch the heap, transient data goes in the arena
+        const auto frameAllocations = AllocationTracker::Count - frameStartAllocations;
+        directx.Stats.Allocations += frameAllocations;
+        directx.Stats.AllocatedBytes += AllocationTracker::Bytes - frameStartAllocatedBytes;
+        if (options.CheckAllocations && frameIndex > 300)
+            VALIDATE(frameAllocations == 0, "Heap allocation in a steady state frame.");
+        if (++directx.Stats.Frames == 300) {
+            directx.Stats.Report();
+            GpuMemory().Report();
+            if (capture) capture->Queue.Report();
+        }
     }
 
     return result;
 }
 
 //-------------------------------------------------------------------------------------
-int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR, int) {
+int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR cmdLine, int) {
+    const auto options = Options{cmdLine};
+
     // Initializes LibOVR, and the Rift
     VALIDATE(OVR_SUCCESS(ovr_Initialize(nullptr)), "Failed to initialize libOVR.");
 
     Window window{hinst, L"Oculus Room Tiny (DX11)"};
-    window.Run(MainLoop);
+    window.Run(MainLoop, options);
 
     ovr_Shutdown();
 
@@ -0,0 +1,66 @@
+// Frame pacing decisions made from measured timings, independent of the GPU and the runtime
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "core.h"
+
+// Chooses the eye viewport scale (relative to the allocated eye buffer size) from measured frame
+// time against the display frame budget. Shading cost scales with pixel count, i.e. with the square
+// of the viewport scale, so each change aims for the scale predicted to bring the load to Target.
+// Over budget it jumps straight there. Under budget it grows by at most GrowStep per change and
+// never past that prediction, so it doesn't overshoot into the shrink band and a steady load
+// settles on one scale rather than oscillating. Measurements arrive a few frames late so changes
+// are followed by a cooldown covering that latency.
+struct DynamicResolution {
+    float MinScale, MaxScale, Scale;
+    int Cooldown = 0;
+    static constexpr float ShrinkAbove = 0.9f, GrowBelow = 0.75f, Target = 0.8f;
+    static constexpr float GrowStep = 1.05f;
+    static constexpr int LatencyFrames = 4;
+
+    float Update(double frameSeconds, double budgetSeconds) {
+        if (Cooldown > 0) {
+            --Cooldown;
+            return Scale;
+        }
+        if (frameSeconds <= 0.0) return Scale;
+        const auto load = float(frameSeconds / budgetSeconds);
+        const auto targetScale = Scale * std::sqrt(Target / load);
+        auto newScale = Scale;
+        if (load > ShrinkAbove)
+            newScale = targetScale;
+        else if (load < GrowBelow)
+            newScale = std::min(targetScale, Scale * GrowStep);
+        newScale = std::min(MaxScale, std::max(MinScale, newScale));
+        if (newScale != Scale) Cooldown = LatencyFrames;
+        return Scale = newScale;
+    }
+};
+
+// Tracks whether the compositor is showing the app from ovr_SubmitFrame results. While not visible
+// (HMD not worn, another app has focus) scene rendering is skipped and the last layers are only
+// resubmitted every PollInterval to find out when visibility returns, rendering then resumes on
+// the following frame.
+struct VisibilityThrottle {
+    enum class Action { Render, Poll, Wait };
+    static constexpr double PollInterval = 0.05;
+    static constexpr int NotVisible = 1000;  // ovrSuccess_NotVisible
+    bool Visible = true;
+    double NextPoll = 0.0;
+
+    Action NextAction(double now) const {
+        return Visible ? Action::Render : now >= NextPoll ? Action::Poll : Action::Wait;
+    }
+
+    // Result of ovr_SubmitFrame
+    void OnSubmit(int result, double now) {
+        const auto visible = result != NotVisible;
+        if (visible != Visible)
+            LOG_INFO(visible ? "App visible, resuming rendering\n"
+                             : "App not visible, entering low power mode\n");
+        Visible = visible;
+        NextPoll = now + PollInterval;
+    }
+};
@@ -0,0 +1,309 @@
+// Potentially visible sets baked per cell of a grid and memory mapped at runtime, independent of
+// the graphics API
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "core.h"
+#include "geometry.h"
+#include "raycast.h"
+#include "vectors.h"
+
+// Potentially visible sets baked per cell of a grid over the static geometry: a bitset of the
+// scene models seen from eye height sample points in the cell. Cells with identical sets share one
+// row, so the file is a header, a row index per cell and the distinct rows. At runtime the file is
+// memory mapped and a lookup is the cell's row index then a bit per model, with no parsing.
+struct Pvs {
+    struct Header {
+        uint32_t Magic, CellsX, CellsZ, Models, Rows, Words;  // Words per row
+        float OriginX, OriginZ;
+        unsigned long long Key;
+    };
+    enum { EyeSamples = 3, TargetSamples = 128 };  // Eye samples per cell side, points per model
+    static constexpr float CellSize = 4.0f, EyeHeight = 1.6f;
+    static constexpr uint32_t Magic = 0x31535650u;  // "PVS1"
+
+#ifdef _WIN32
+    HANDLE File = INVALID_HANDLE_VALUE, Mapping = nullptr;
+#else
+    int File = -1;
+#endif
+    const Header* Mapped = nullptr;
+    size_t Bytes = 0;
+    double BakeSeconds = 0.0;
+    std::atomic<size_t> RaysCast{0};
+
+    Pvs() = default;
+    Pvs(const Pvs&) = delete;
+    Pvs& operator=(const Pvs&) = delete;
+    ~Pvs() { Unmap(); }
+
+    // Cache key over the model list and the bake settings (FNV-1a)
+    static unsigned long long Key(const std::vector<MeshDesc>& meshes) {
+        const float settings[] = {float(EyeSamples), float(TargetSamples), CellSize, EyeHeight,
+                                  float(meshes.size())};
+        auto key = Fnv1a(settings, sizeof(settings));
+        for (const auto& mesh : meshes) {
+            key = Fnv1a(&mesh.Dynamic, sizeof(mesh.Dynamic), key);
+            if (mesh.Dynamic) continue;
+            key = Fnv1a(&mesh.Pos, sizeof(mesh.Pos), key);
+            for (const auto& v : mesh.Mesh.Vertices) key = Fnv1a(&v.Pos, sizeof(v.Pos), key);
+        }
+        return key;
+    }
+
+    // The file contents for the meshes. A model is visible from a cell if a ray between any eye
+    // sample and any of its target points is unoccluded. Cells with no eye sample standing over a
+    // floor and clear of the boxes are not walkable and see everything.
+    std::vector<uint32_t> Bake(const std::vector<MeshDesc>& meshes, unsigned threads) {
+        const auto start = CpuSeconds();
+        RaysCast = 0;
+        const auto boxes = StaticBoxes(meshes);
+        const auto bvh = BoxBvh{boxes};
+        const auto models = uint32_t(meshes.size());
+        auto header =
+            Header{Magic, 1, 1, models, 0, (models + 31) / 32, 0.0f, 0.0f, Key(meshes)};
+        if (!boxes.empty()) {
+            auto lo = boxes[0].Min, hi = boxes[0].Max;
+            for (const auto& b : boxes) {
+                lo = {std::min(lo.x, b.Min.x), 0.0f, std::min(lo.z, b.Min.z)};
+                hi = {std::max(hi.x, b.Max.x), 0.0f, std::max(hi.z, b.Max.z)};
+            }
+            header.OriginX = lo.x;
+            header.OriginZ = lo.z;
+            header.CellsX = uint32_t(std::max(1.0f, std::ceil((hi.x - lo.x) / CellSize)));
+            header.CellsZ = uint32_t(std::max(1.0f, std::ceil((hi.z - lo.z) / CellSize)));
+        }
+
+        // Points spread over each static model's box faces by area, nudged off the surface
+        struct Target {
+            Float3 Pos, Normal;
+        };
+        std::vector<std::vector<Target>> targets(models);
+        auto seed = 1u;
+        auto random = [&seed] {
+            seed = seed * 1664525u + 1013904223u;
+            return float(seed >> 8) / 16777216.0f;
+        };
+        for (auto m = 0u; m < models; ++m) {
+            const auto& mesh = meshes[m];
+            if (mesh.Dynamic) continue;
+            std::vector<TriangleSet::Box> world;
+            std::vector<float> areas;  // Running total over the faces, six per box
+            auto total = 0.0f;
+            for (const auto& b : mesh.Mesh.Boxes) {
+                if (b.Empty()) continue;
+                const auto& pos = mesh.Pos;
+                world.push_back({{b.Min.x + pos.x, b.Min.y + pos.y, b.Min.z + pos.z},
+                                 {b.Max.x + pos.x, b.Max.y + pos.y, b.Max.z + pos.z}});
+                const float extents[] = {b.Max.x - b.Min.x, b.Max.y - b.Min.y, b.Max.z - b.Min.z};
+                for (auto face = 0; face < 6; ++face) {
+                    const auto axis = face / 2;
+                    total += extents[(axis + 1) % 3] * extents[(axis + 2) % 3];
+                    areas.push_back(total);
+                }
+            }
+            if (total <= 0.0f) continue;
+            for (auto t = 0; t < TargetSamples; ++t) {
+                const auto face = std::min(
+                    size_t(std::upper_bound(begin(areas), end(areas), random() * total) -
+                           begin(areas)),
+                    areas.size() - 1);
+                const auto& b = world[face / 6];
+                const auto axis = int(face % 6) / 2;
+                const auto positive = face % 2 == 1;
+                auto target = Target{};
+                for (auto k = 0; k < 3; ++k)
+                    (&target.Pos.x)[k] = (&b.Min.x)[k] + random() * ((&b.Max.x)[k] - (&b.Min.x)[k]);
+                (&target.Pos.x)[axis] = positive ? (&b.Max.x)[axis] + 0.01f
+                                                 : (&b.Min.x)[axis] - 0.01f;
+                (&target.Normal.x)[axis] = positive ? 1.0f : -1.0f;
+                targets[m].push_back(target);
+            }
+        }
+
+        const auto cells = size_t(header.CellsX) * header.CellsZ;
+        std::vector<uint32_t> bits(cells * header.Words);
+        ParallelFor(cells, 1, [&](size_t cell) {
+            const auto row = &bits[cell * header.Words];
+            const auto x0 = header.OriginX + float(cell % header.CellsX) * CellSize;
+            const auto z0 = header.OriginZ + float(cell / header.CellsX) * CellSize;
+            std::vector<Float3> eyes;
+            for (auto i = 0; i < EyeSamples; ++i)
+                for (auto j = 0; j < EyeSamples; ++j) {
+                    const auto eye = Float3{x0 + (i + 0.5f) / EyeSamples * CellSize, EyeHeight,
+                                              z0 + (j + 0.5f) / EyeSamples * CellSize};
+                    const auto inside =
+                        std::any_of(begin(boxes), end(boxes), [&eye](const TriangleSet::Box& b) {
+                            return eye.x > b.Min.x && eye.x < b.Max.x && eye.y > b.Min.y &&
+                                   eye.y < b.Max.y && eye.z > b.Min.z && eye.z < b.Max.z;
+                        });
+                    const auto floor = bvh.Occluded(BoxBvh::MakeRay(eye, {0, -1, 0}, 10.0f));
+                    if (!inside && floor) eyes.push_back(eye);
+                }
+            if (eyes.empty()) {
+                std::fill(row, row + header.Words, ~0u);
+                return;
+            }
+            auto rays = size_t{0};
+            auto visible = [&](uint32_t m) {
+                if (meshes[m].Dynamic) return true;
+                for (const auto& target : targets[m]) {
+                    for (const auto& eye : eyes) {
+                        const auto toEye = Subtract(eye, target.Pos);
+                        // The target's face points away from this eye
+                        if (Dot(toEye, target.Normal) <= 0) continue;
+                        const auto distance = Length(toEye);
+                        ++rays;
+                        if (!bvh.Occluded(
+                                BoxBvh::MakeRay(target.Pos, Scale(toEye, 1 / distance), distance)))
+                            return true;
+                    }
+                }
+                return false;
+            };
+            for (auto m = 0u; m < models; ++m)
+                if (visible(m)) row[m / 32] |= 1u << (m % 32);
+            RaysCast += rays;
+        }, threads);
+
+        // Share identical rows between cells
+        std::vector<uint32_t> rowOfCell(cells), rows;
+        for (auto cell = size_t{0}; cell < cells; ++cell) {
+            const auto row = begin(bits) + ptrdiff_t(cell * header.Words);
+            auto r = size_t{0};
+            while (r < header.Rows &&
+                   !std::equal(row, row + header.Words, begin(rows) + ptrdiff_t(r * header.Words)))
+                ++r;
+            if (r == header.Rows) {
+                rows.insert(end(rows), row, row + header.Words);
+                ++header.Rows;
+            }
+            rowOfCell[cell] = uint32_t(r);
+        }
+        std::vector<uint32_t> res(sizeof(Header) / sizeof(uint32_t));
+        memcpy(res.data(), &header, sizeof(header));
+        res.insert(end(res), begin(rowOfCell), end(rowOfCell));
+        res.insert(end(res), begin(rows), end(rows));
+        BakeSeconds = CpuSeconds() - start;
+        return res;
+    }
+
+    // Map a baked file read only, false if it is missing, truncated or for other geometry
+    bool Map(const char* path, unsigned long long key) {
+        Unmap();
+#ifdef _WIN32
+        File = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (File == INVALID_HANDLE_VALUE) return false;
+        auto bytes = LARGE_INTEGER{};
+        Mapping = GetFileSizeEx(File, &bytes) && bytes.QuadPart >= LONGLONG(sizeof(Header))
+                      ? CreateFileMappingW(File, nullptr, PAGE_READONLY, 0, 0, nullptr)
+                      : nullptr;
+        Mapped = Mapping ? static_cast<const Header*>(
+                               MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0))
+                         : nullptr;
+        Bytes = size_t(bytes.QuadPart);
+#else
+        File = open(path, O_RDONLY);
+        if (File < 0) return false;
+        struct stat info = {};
+        const auto view = fstat(File, &info) == 0 && size_t(info.st_size) >= sizeof(Header)
+                              ? mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, File, 0)
+                              : MAP_FAILED;
+        Mapped = view != MAP_FAILED ? static_cast<const Header*>(view) : nullptr;
+        Bytes = Mapped ? size_t(info.st_size) : 0;
+#endif
+        if (!Mapped || Mapped->Magic != Magic || Mapped->Key != key ||
+            Bytes != sizeof(Header) + sizeof(uint32_t) * (size_t(Mapped->CellsX) * Mapped->CellsZ +
+                                                          size_t(Mapped->Rows) * Mapped->Words)) {
+            Unmap();
+            return false;
+        }
+        return true;
+    }
+
+    void Unmap() {
+#ifdef _WIN32
+        if (Mapped) UnmapViewOfFile(Mapped);
+        if (Mapping) CloseHandle(Mapping);
+        if (File != INVALID_HANDLE_VALUE) CloseHandle(File);
+        File = INVALID_HANDLE_VALUE;
+        Mapping = nullptr;
+#else
+        if (Mapped) munmap(const_cast<Header*>(Mapped), Bytes);
+        if (File >= 0) close(File);
+        File = -1;
+#endif
+        Mapped = nullptr;
+        Bytes = 0;
+    }
+
+    // Map the cached sets for the meshes, baking and writing them first if the cache is stale
+    bool Load(const std::vector<MeshDesc>& meshes, const char* path = "pvs_cache.bin") {
+        const auto key = Key(meshes);
+        if (Map(path, key)) {
+            LOG_INFO("PVS: %u x %u cells mapped from the cache\n", Mapped->CellsX,
+                     Mapped->CellsZ);
+        } else {
+            const auto contents = Bake(meshes, std::thread::hardware_concurrency());
+            LOG_INFO("PVS bake: %zu rays in %.3fs, %.2f Mrays/s\n", size_t(RaysCast),
+                     BakeSeconds, double(RaysCast) / BakeSeconds * 1e-6);
+            if (const auto file = OpenFile(path, "wb")) {
+                fwrite(contents.data(), sizeof(uint32_t), contents.size(), file);
+                fclose(file);
+            }
+            if (!Map(path, key)) {
+                LOG_WARNING("PVS: failed to write and map the cache\n");
+                return false;
+            }
+        }
+        const auto cells = size_t(Mapped->CellsX) * Mapped->CellsZ;
+        LOG_INFO("PVS: %zu cells, %u distinct sets of %u models, %zu bytes mapped, %zu bytes with "
+                 "a set per cell\n",
+                 cells, Mapped->Rows, Mapped->Models, Bytes,
+                 sizeof(Header) + sizeof(uint32_t) * cells * Mapped->Words);
+        return true;
+    }
+
+    // The visible set of the cell containing a position, nullptr outside the grid
+    const uint32_t* Lookup(const Float3& p) const {
+        if (!Mapped) return nullptr;
+        const auto x = std::floor((p.x - Mapped->OriginX) / CellSize);
+        const auto z = std::floor((p.z - Mapped->OriginZ) / CellSize);
+        if (x < 0.0f || z < 0.0f || x >= float(Mapped->CellsX) || z >= float(Mapped->CellsZ))
+            return nullptr;
+        const auto rowOfCell = reinterpret_cast<const uint32_t*>(Mapped + 1);
+        const auto rows = rowOfCell + size_t(Mapped->CellsX) * Mapped->CellsZ;
+        return rows + size_t(rowOfCell[uint32_t(z) * Mapped->CellsX + uint32_t(x)]) * Mapped->Words;
+    }
+
+    // Hide the models outside the set for a position, returns the number hidden
+    size_t Cull(const Float3& p, std::vector<bool>& visible) const {
+        const auto row = Lookup(p);
+        if (!row) return 0;
+        auto hidden = size_t{0};
+        for (auto m = 0u; m < std::min(uint32_t(visible.size()), Mapped->Models); ++m)
+            if (visible[m] && !((row[m / 32] >> (m % 32)) & 1)) {
+                visible[m] = false;
+                ++hidden;
+            }
+        return hidden;
+    }
+};
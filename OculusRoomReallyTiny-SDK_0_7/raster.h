@@ -0,0 +1,99 @@
+// CPU coverage measurement: the hidden area mesh and a minimal software rasterizer
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "vectors.h"
+
+// Generate the hidden area mesh for an eye: the parts of the eye buffer the lens never shows. The
+// visible area is approximated by a circle in tangent space around the optical axis and the mesh is
+// a ring of quads from that circle out past the corners of the fov. Vertices lie on the z = -1
+// plane in view space so the eye projection matrix maps them directly onto the eye viewport. Fov is
+// an ovrFovPort or anything else with the same tangents.
+template <typename Fov>
+std::vector<Float3> CreateHiddenAreaMesh(const Fov& fov, int segments = 32) {
+    const auto radius = std::max({fov.UpTan, fov.DownTan, fov.LeftTan, fov.RightTan});
+    // Circumscribe the circle so polygon edges never cut into the visible area
+    const auto inner = radius / std::cos(Pi / segments);
+    const auto outer = 2.0f * std::hypot(std::max(fov.LeftTan, fov.RightTan),
+                                         std::max(fov.UpTan, fov.DownTan));
+    auto ringPoint = [segments](float r, int i) {
+        const auto a = 2.0f * Pi * i / segments;
+        return Float3{r * std::cos(a), r * std::sin(a), -1.0f};
+    };
+    std::vector<Float3> res;
+    for (auto i = 0; i < segments; ++i) {
+        const auto p0 = ringPoint(inner, i), p1 = ringPoint(inner, i + 1);
+        const auto q0 = ringPoint(outer, i), q1 = ringPoint(outer, i + 1);
+        // Clockwise winding as seen by the viewer so the default rasterizer state keeps them
+        res.insert(end(res), {p0, p1, q0, p1, q1, q0});
+    }
+    return res;
+}
+
+// Minimal software rasterizer for measuring pixel coverage and overdraw on the CPU. Samples pixel
+// centers of a W x H target, culling back faces and clipping to the near plane like the default
+// D3D11 rasterizer state. Depth testing is less-than with writes, or equal without writes to model
+// the color pass after a depth pre-pass. Fragments counts every rasterized sample, Passed those
+// that also passed the depth test.
+struct CoverageRasterizer {
+    int W, H;
+    std::vector<float> Depth;
+    size_t Fragments = 0, Passed = 0;
+
+    CoverageRasterizer(int w, int h) : W{w}, H{h}, Depth(size_t(w) * h, 1.0f) {}
+
+    // Vertices in D3D clip space
+    void DrawTriangle(const Float4& a, const Float4& b, const Float4& c, bool depthEqual = false) {
+        // Clip against the near plane (z >= 0 in D3D clip space), leaving at most a quad
+        const Float4 in[] = {a, b, c};
+        Float4 out[4];
+        auto n = 0;
+        for (auto i = 0; i < 3; ++i) {
+            const auto p = in[i], q = in[(i + 1) % 3];
+            if (p.z >= 0.0f) out[n++] = p;
+            if ((p.z >= 0.0f) != (q.z >= 0.0f)) {
+                const auto t = p.z / (p.z - q.z);
+                out[n++] = {p.x + t * (q.x - p.x), p.y + t * (q.y - p.y), p.z + t * (q.z - p.z),
+                            p.w + t * (q.w - p.w)};
+            }
+        }
+        for (auto i = 2; i < n; ++i) RasterizeTriangle(out[0], out[i - 1], out[i], depthEqual);
+    }
+
+    void RasterizeTriangle(const Float4& a, const Float4& b, const Float4& c, bool depthEqual) {
+        auto toScreen = [this](const Float4& v) {
+            return Float3{(v.x / v.w * 0.5f + 0.5f) * W, (0.5f - v.y / v.w * 0.5f) * H, v.z / v.w};
+        };
+        const auto v0 = toScreen(a), v1 = toScreen(b), v2 = toScreen(c);
+        // Front faces are clockwise on screen
+        const auto area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (area <= 0.0f) return;
+        const auto minX = std::max(0, int(std::floor(std::min({v0.x, v1.x, v2.x}))));
+        const auto maxX = std::min(W - 1, int(std::ceil(std::max({v0.x, v1.x, v2.x}))));
+        const auto minY = std::max(0, int(std::floor(std::min({v0.y, v1.y, v2.y}))));
+        const auto maxY = std::min(H - 1, int(std::ceil(std::max({v0.y, v1.y, v2.y}))));
+        auto edge = [](const Float3& p, const Float3& q, float x, float y) {
+            return (q.x - p.x) * (y - p.y) - (x - p.x) * (q.y - p.y);
+        };
+        for (auto y = minY; y <= maxY; ++y)
+            for (auto x = minX; x <= maxX; ++x) {
+                const auto px = x + 0.5f, py = y + 0.5f;
+                const auto w0 = edge(v1, v2, px, py) / area, w1 = edge(v2, v0, px, py) / area;
+                const auto w2 = 1.0f - w0 - w1;
+                if (w0 < 0 || w1 < 0 || w2 < 0) continue;
+                ++Fragments;
+                const auto z = w0 * v0.z + w1 * v1.z + w2 * v2.z;
+                auto& d = Depth[size_t(y) * W + x];
+                if (depthEqual ? z != d : z >= d) continue;
+                ++Passed;
+                if (!depthEqual) d = z;
+            }
+    }
+
+    auto CountCovered() const {
+        return std::count_if(begin(Depth), end(Depth), [](float d) { return d < 1.0f; });
+    }
+};
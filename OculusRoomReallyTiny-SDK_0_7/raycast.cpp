@@ -0,0 +1,58 @@
+// Renders the starting view of the app's scene on the CPU to a PPM, timing one thread against all
+// of them. Needs no GPU or HMD, so it makes reference images on any build machine:
+//   raycast [-width=1280] [-rooms=N] [-ao] [-out=raycast.ppm]
+// -rooms=N uses the generated N x N grid of rooms instead of the default room and -ao bakes ambient
+// occlusion into the vertex colors first, as the app's options of the same names do.
+// Builds on any platform from the CMakeLists.txt at the repository root.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "core.h"
+#include "raycast.h"
+#include "rooms.h"
+
+int main(int argc, char** argv) {
+    auto w = 1280, rooms = 0;
+    auto ao = false;
+    const char* out = "raycast.ppm";
+    for (auto i = 1; i < argc; ++i) {
+        if (!strncmp(argv[i], "-width=", 7)) {
+            w = std::max(1, atoi(argv[i] + 7));
+        } else if (!strncmp(argv[i], "-rooms=", 7)) {
+            rooms = std::max(1, atoi(argv[i] + 7));
+        } else if (!strcmp(argv[i], "-ao")) {
+            ao = true;
+        } else if (!strncmp(argv[i], "-out=", 5)) {
+            out = argv[i] + 5;
+        } else {
+            fprintf(stderr, "Usage: raycast [-width=1280] [-rooms=N] [-ao] [-out=raycast.ppm]\n");
+            return 2;
+        }
+    }
+    auto meshes = rooms ? CreateRoomGrid(rooms) : CreateRoomMeshes();
+    if (ao) BakeAmbientOcclusion(meshes);
+    const auto caster = RayCaster{meshes};
+    const auto h = std::max(1, w * 9 / 16);
+    const auto fov = FovTangents{float(h) / w, float(h) / w, 1.0f, 1.0f};
+    const auto eye = Pose{{0.0f, 1.6f, 5.0f}, {0.0f, 0.0f, 0.0f, 1.0f}};
+    const auto maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> image;
+    for (auto threads : {1u, maxThreads}) {
+        const auto start = CpuSeconds();
+        image = caster.Render(eye, fov, w, h, threads);
+        const auto seconds = CpuSeconds() - start;
+        printf("Ray cast %dx%d on %u threads: %.3fs, %.2f Mrays/s\n", w, h, threads, seconds,
+               double(w) * h / seconds * 1e-6);
+    }
+    if (!WritePpm(out, image, w, h)) {
+        fprintf(stderr, "Failed to write %s\n", out);
+        return 1;
+    }
+    printf("Wrote %s\n", out);
+    return 0;
+}
@@ -0,0 +1,577 @@
+// Ray queries against the scene's boxes on the CPU: a BVH, the ambient occlusion bake and a
+// reference renderer, independent of the graphics API
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core.h"
+#include "geometry.h"
+#include "vectors.h"
+
+// Runs body(i) for i in [0, count) on a number of threads, the calling thread included. Each
+// worker starts with an equal share of the range and takes grain sized chunks from its front.
+// A worker that runs dry steals the back half of another worker's remaining share, so uneven
+// work still balances without a shared queue.
+template <typename Body>
+void ParallelFor(size_t count, size_t grain, Body body,
+                 unsigned threads = std::thread::hardware_concurrency()) {
+    threads = unsigned(std::max<size_t>(1, std::min(size_t(threads), (count + grain - 1) / grain)));
+    struct Share {
+        std::mutex Lock;
+        size_t Begin = 0, End = 0;
+    };
+    std::unique_ptr<Share[]> shares{new Share[threads]};
+    for (auto t = 0u; t < threads; ++t) {
+        shares[t].Begin = count * t / threads;
+        shares[t].End = count * (t + 1) / threads;
+    }
+    auto worker = [&shares, &body, threads, grain](unsigned self) {
+        auto& own = shares[self];
+        for (;;) {
+            auto begin = size_t{0}, end = size_t{0};
+            {
+                std::lock_guard<std::mutex> lock{own.Lock};
+                begin = own.Begin;
+                end = own.Begin = std::min(own.End, own.Begin + grain);
+            }
+            if (begin != end) {
+                for (auto i = begin; i < end; ++i) body(i);
+                continue;
+            }
+            auto stolen = false;
+            for (auto v = 1u; v < threads && !stolen; ++v) {
+                auto& victim = shares[(self + v) % threads];
+                std::lock_guard<std::mutex> lock{victim.Lock};
+                if (victim.End - victim.Begin < 2) continue;
+                begin = victim.Begin + (victim.End - victim.Begin) / 2;
+                end = victim.End;
+                victim.End = begin;
+                stolen = true;
+            }
+            if (!stolen) return;
+            std::lock_guard<std::mutex> lock{own.Lock};
+            own.Begin = begin;
+            own.End = end;
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (auto t = 1u; t < threads; ++t) helpers.emplace_back(worker, t);
+    worker(0);
+    for (auto& helper : helpers) helper.join();
+}
+
+// Bounding volume hierarchy over axis aligned boxes for ray queries. Leaves hold up to four boxes
+// laid out across lanes so a ray is tested against a whole leaf with one slab test. The lane loops
+// are independent so the compiler vectorizes them.
+struct BoxBvh {
+    struct Node {
+        Float3 Min;
+        uint32_t Index;  // Pack for a leaf, otherwise the second child, the first follows the node
+        Float3 Max;
+        uint32_t Leaf;
+    };
+    // Four boxes in structure of arrays form, Min[axis] holds that axis of each box. Unused lanes
+    // hold a point far outside the scene.
+    struct Pack {
+        float Min[3][4], Max[3][4];
+        uint32_t Boxes[4];  // Index into the source boxes, UINT32_MAX for unused lanes
+    };
+    // Ray with precomputed reciprocal direction for the slab tests
+    struct Ray {
+        Float3 Origin, InvDir;
+        float TMax;
+    };
+
+    std::vector<Node> Nodes;
+    std::vector<Pack> Packs;
+
+    explicit BoxBvh(const std::vector<TriangleSet::Box>& boxes) {
+        std::vector<uint32_t> order(boxes.size());
+        for (auto i = 0u; i < order.size(); ++i) order[i] = i;
+        if (!order.empty()) Build(boxes, order.data(), order.data() + order.size());
+    }
+
+    // Four rays in structure of arrays form, lanes are rays, traced together through the tree
+    struct RayPacket {
+        float Origin[3][4], InvDir[3][4];
+        float TMax[4];    // Shrinks to the closest hit in each lane
+        uint32_t Box[4];  // Closest box hit in each lane, UINT32_MAX for a miss
+    };
+
+    // Keep zero direction components finite so 0 * inf never turns a slab test into NaN
+    static float SafeReciprocal(float d) { return 1.0f / (std::abs(d) < 1e-8f ? 1e-8f : d); }
+
+    static Ray MakeRay(const Float3& origin, const Float3& dir, float tMax) {
+        return {origin, {SafeReciprocal(dir.x), SafeReciprocal(dir.y), SafeReciprocal(dir.z)},
+                tMax};
+    }
+
+    // Closest hits for a packet. A node is visited if any ray in the packet hits it, so coherent
+    // rays share the traversal and each leaf box is tested against all four rays at once.
+    void Intersect(RayPacket& packet) const {
+        if (Nodes.empty()) return;
+        uint32_t stack[64];
+        auto top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const auto& node = Nodes[stack[--top]];
+            float tNear[4], tFar[4];
+            SlabTest(&node.Min.x, &node.Max.x, packet, tNear, tFar);
+            if (!Any(tNear, tFar)) continue;
+            if (!node.Leaf) {
+                stack[top++] = node.Index;
+                stack[top++] = uint32_t(&node - Nodes.data()) + 1;
+                continue;
+            }
+            const auto& pack = Packs[node.Index];
+            for (auto lane = 0; lane < 4 && pack.Boxes[lane] != UINT32_MAX; ++lane) {
+                const float mins[] = {pack.Min[0][lane], pack.Min[1][lane], pack.Min[2][lane]};
+                const float maxs[] = {pack.Max[0][lane], pack.Max[1][lane], pack.Max[2][lane]};
+                SlabTest(mins, maxs, packet, tNear, tFar);
+                for (auto ray = 0; ray < 4; ++ray)
+                    if (tNear[ray] <= tFar[ray]) {
+                        packet.TMax[ray] = tNear[ray];
+                        packet.Box[ray] = pack.Boxes[lane];
+                    }
+            }
+        }
+    }
+
+    // Intersect a packet with one box, each ray's [tNear, tFar] within [0, TMax]
+    static void SlabTest(const float* min, const float* max, const RayPacket& packet,
+                         float* tNear, float* tFar) {
+        for (auto ray = 0; ray < 4; ++ray) {
+            tNear[ray] = 0.0f;
+            tFar[ray] = packet.TMax[ray];
+        }
+        for (auto axis = 0; axis < 3; ++axis)
+            for (auto ray = 0; ray < 4; ++ray) {
+                const auto t1 = (min[axis] - packet.Origin[axis][ray]) * packet.InvDir[axis][ray];
+                const auto t2 = (max[axis] - packet.Origin[axis][ray]) * packet.InvDir[axis][ray];
+                tNear[ray] = std::max(tNear[ray], std::min(t1, t2));
+                tFar[ray] = std::min(tFar[ray], std::max(t1, t2));
+            }
+    }
+
+    static bool Any(const float* tNear, const float* tFar) {
+        return tNear[0] <= tFar[0] || tNear[1] <= tFar[1] || tNear[2] <= tFar[2] ||
+               tNear[3] <= tFar[3];
+    }
+
+    // True if any box is hit within (0, TMax]
+    bool Occluded(const Ray& ray) const {
+        if (Nodes.empty()) return false;
+        uint32_t stack[64];
+        auto top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const auto& node = Nodes[stack[--top]];
+            if (!HitsNode(node, ray)) continue;
+            if (!node.Leaf) {
+                stack[top++] = node.Index;
+                stack[top++] = uint32_t(&node - Nodes.data()) + 1;
+                continue;
+            }
+            float tNear[4], tFar[4];
+            SlabTest(Packs[node.Index], ray, tNear, tFar);
+            if (Any(tNear, tFar)) return true;
+        }
+        return false;
+    }
+
+    // Intersect the ray with the four boxes of a pack, each lane's [tNear, tFar] within [0, TMax]
+    static void SlabTest(const Pack& pack, const Ray& ray, float* tNear, float* tFar) {
+        for (auto lane = 0; lane < 4; ++lane) {
+            tNear[lane] = 0.0f;
+            tFar[lane] = ray.TMax;
+        }
+        for (auto axis = 0; axis < 3; ++axis) {
+            const auto o = (&ray.Origin.x)[axis], inv = (&ray.InvDir.x)[axis];
+            for (auto lane = 0; lane < 4; ++lane) {
+                const auto t1 = (pack.Min[axis][lane] - o) * inv;
+                const auto t2 = (pack.Max[axis][lane] - o) * inv;
+                tNear[lane] = std::max(tNear[lane], std::min(t1, t2));
+                tFar[lane] = std::min(tFar[lane], std::max(t1, t2));
+            }
+        }
+    }
+
+    static bool HitsNode(const Node& node, const Ray& ray) {
+        auto tNear = 0.0f, tFar = ray.TMax;
+        for (auto axis = 0; axis < 3; ++axis) {
+            const auto o = (&ray.Origin.x)[axis], inv = (&ray.InvDir.x)[axis];
+            const auto t1 = ((&node.Min.x)[axis] - o) * inv;
+            const auto t2 = ((&node.Max.x)[axis] - o) * inv;
+            tNear = std::max(tNear, std::min(t1, t2));
+            tFar = std::min(tFar, std::max(t1, t2));
+        }
+        return tNear <= tFar;
+    }
+
+    // Median split on the longest axis of the box centers
+    void Build(const std::vector<TriangleSet::Box>& boxes, uint32_t* first, uint32_t* last) {
+        auto lo = boxes[*first].Min, hi = boxes[*first].Max;
+        auto cLo = Float3{FLT_MAX, FLT_MAX, FLT_MAX}, cHi = Float3{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (auto it = first; it != last; ++it) {
+            const auto& b = boxes[*it];
+            lo = {std::min(lo.x, b.Min.x), std::min(lo.y, b.Min.y), std::min(lo.z, b.Min.z)};
+            hi = {std::max(hi.x, b.Max.x), std::max(hi.y, b.Max.y), std::max(hi.z, b.Max.z)};
+            const auto c = Add(b.Min, b.Max);
+            cLo = {std::min(cLo.x, c.x), std::min(cLo.y, c.y), std::min(cLo.z, c.z)};
+            cHi = {std::max(cHi.x, c.x), std::max(cHi.y, c.y), std::max(cHi.z, c.z)};
+        }
+        const auto node = Nodes.size();
+        Nodes.push_back({lo, 0, hi, 0});
+        if (last - first <= 4) {
+            auto pack = Pack{};
+            for (auto lane = 0; lane < 4; ++lane) {
+                const auto used = first + lane < last;
+                const auto& b = boxes[used ? first[lane] : *first];
+                const auto far = 1e30f;
+                for (auto axis = 0; axis < 3; ++axis) {
+                    pack.Min[axis][lane] = used ? (&b.Min.x)[axis] : far;
+                    pack.Max[axis][lane] = used ? (&b.Max.x)[axis] : far;
+                }
+                pack.Boxes[lane] = used ? first[lane] : UINT32_MAX;
+            }
+            Nodes[node].Index = uint32_t(Packs.size());
+            Nodes[node].Leaf = 1;
+            Packs.push_back(pack);
+            return;
+        }
+        const auto extent = Subtract(cHi, cLo);
+        const auto axis = extent.x >= extent.y && extent.x >= extent.z ? 0
+                                                                       : extent.y >= extent.z ? 1
+                                                                                              : 2;
+        const auto mid = first + (last - first) / 2;
+        std::nth_element(first, mid, last, [&boxes, axis](uint32_t a, uint32_t b) {
+            return (&boxes[a].Min.x)[axis] + (&boxes[a].Max.x)[axis] <
+                   (&boxes[b].Min.x)[axis] + (&boxes[b].Max.x)[axis];
+        });
+        Build(boxes, first, mid);
+        Nodes[node].Index = uint32_t(Nodes.size());
+        Build(boxes, mid, last);
+    }
+};
+
+// World space boxes of the static meshes, the occluders for ray queries
+inline std::vector<TriangleSet::Box> StaticBoxes(const std::vector<MeshDesc>& meshes) {
+    std::vector<TriangleSet::Box> res;
+    for (const auto& mesh : meshes) {
+        if (mesh.Dynamic) continue;
+        for (const auto& b : mesh.Mesh.Boxes)
+            if (!b.Empty()) res.push_back({Add(b.Min, mesh.Pos), Add(b.Max, mesh.Pos)});
+    }
+    return res;
+}
+
+// Per vertex ambient occlusion: the fraction of cosine weighted hemisphere rays from each vertex
+// that escape the static boxes within Distance. Every vertex uses the same sample directions, so
+// vertices shared by neighbouring triangles agree and faces show no seams.
+struct AmbientOcclusion {
+    enum { Rays = 64 };
+    static constexpr float Distance = 1.5f;
+
+    double Seconds = 0.0;
+    std::atomic<size_t> RaysCast{0};
+
+    // Visibility of every static vertex, in mesh then vertex order
+    std::vector<float> Compute(const std::vector<MeshDesc>& meshes, unsigned threads) {
+        const auto start = CpuSeconds();
+        const auto bvh = BoxBvh{StaticBoxes(meshes)};
+        const auto distance = Distance;
+        std::vector<const Vertex*> triangles;
+        for (const auto& mesh : meshes)
+            if (!mesh.Dynamic)
+                for (auto i = size_t{0}; i + 2 < mesh.Mesh.Vertices.size(); i += 3)
+                    triangles.push_back(&mesh.Mesh.Vertices[i]);
+        std::vector<Float3> offsets;
+        for (const auto& mesh : meshes)
+            if (!mesh.Dynamic)
+                offsets.insert(end(offsets), mesh.Mesh.Vertices.size() / 3, mesh.Pos);
+
+        // Hammersley points mapped to a cosine weighted hemisphere around +z
+        Float3 samples[Rays];
+        for (auto i = 0u; i < unsigned(Rays); ++i) {
+            auto bits = i;
+            bits = (bits << 16u) | (bits >> 16u);
+            bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+            bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+            bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+            bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+            const auto u = (i + 0.5f) / Rays, phi = 2.0f * Pi * float(bits) * 2.3283064e-10f;
+            samples[i] = {std::sqrt(u) * std::cos(phi), std::sqrt(u) * std::sin(phi),
+                          std::sqrt(1.0f - u)};
+        }
+
+        std::vector<float> res(3 * triangles.size(), 1.0f);
+        ParallelFor(triangles.size(), 64, [&](size_t t) {
+            const auto v = triangles[t];
+            // Box triangles wind clockwise seen from outside
+            const auto cross =
+                Cross(Subtract(v[2].Pos, v[0].Pos), Subtract(v[1].Pos, v[0].Pos));
+            if (Length(cross) == 0.0f) return;  // Removed box
+            RaysCast += 3 * Rays;
+            const auto n = Normalize(cross);
+            const auto up = std::abs(n.y) < 0.99f ? Float3{0, 1, 0} : Float3{1, 0, 0};
+            const auto tangent = Normalize(Cross(up, n));
+            const auto bitangent = Cross(n, tangent);
+            for (auto corner = 0; corner < 3; ++corner) {
+                const auto origin = Add(Add(v[corner].Pos, offsets[t]), Scale(n, 1e-3f));
+                auto open = 0;
+                for (const auto& s : samples) {
+                    const auto dir =
+                        Add(Add(Scale(tangent, s.x), Scale(bitangent, s.y)), Scale(n, s.z));
+                    open += bvh.Occluded(BoxBvh::MakeRay(origin, dir, distance)) ? 0 : 1;
+                }
+                res[3 * t + corner] = float(open) / Rays;
+            }
+        }, threads);
+        Seconds = CpuSeconds() - start;
+        return res;
+    }
+
+    // Cache key over the static geometry and the bake settings (FNV-1a)
+    static unsigned long long Key(const std::vector<MeshDesc>& meshes) {
+        const float settings[] = {float(Rays), Distance};
+        auto key = Fnv1a(settings, sizeof(settings));
+        for (const auto& mesh : meshes) {
+            if (mesh.Dynamic) continue;
+            key = Fnv1a(&mesh.Pos, sizeof(mesh.Pos), key);
+            for (const auto& v : mesh.Mesh.Vertices) key = Fnv1a(&v.Pos, sizeof(v.Pos), key);
+        }
+        return key;
+    }
+};
+
+// Darken the static vertex colors by their ambient occlusion. The result is cached on disk keyed
+// by the geometry, so only the first run with a given scene pays for the bake. A cache is only used
+// if it holds a value for every static vertex.
+inline void BakeAmbientOcclusion(std::vector<MeshDesc>& meshes,
+                                 const char* cachePath = "ao_cache.bin") {
+    const auto magic = 0x31434f41u;  // "AOC1"
+    struct Header {
+        uint32_t Magic;
+        uint32_t Count;
+        unsigned long long Key;
+    };
+    const auto key = AmbientOcclusion::Key(meshes);
+    auto count = size_t{0};
+    for (const auto& mesh : meshes)
+        if (!mesh.Dynamic) count += mesh.Mesh.Vertices.size();
+    std::vector<float> visibility;
+    if (const auto file = OpenFile(cachePath, "rb")) {
+        auto header = Header{};
+        if (fread(&header, sizeof(header), 1, file) == 1 && header.Magic == magic &&
+            header.Key == key && header.Count == count) {
+            visibility.resize(header.Count);
+            if (fread(visibility.data(), sizeof(float), header.Count, file) != header.Count)
+                visibility.clear();
+        }
+        fclose(file);
+    }
+    if (visibility.empty()) {
+        AmbientOcclusion ao;
+        visibility = ao.Compute(meshes, std::thread::hardware_concurrency());
+        LOG_INFO("AO bake: %zu vertices, %zu rays in %.3fs, %.2f Mrays/s\n", visibility.size(),
+                 size_t(ao.RaysCast), ao.Seconds, double(ao.RaysCast) / ao.Seconds * 1e-6);
+        if (const auto file = OpenFile(cachePath, "wb")) {
+            const auto header = Header{magic, uint32_t(visibility.size()), key};
+            fwrite(&header, sizeof(header), 1, file);
+            fwrite(visibility.data(), sizeof(float), visibility.size(), file);
+            fclose(file);
+        } else {
+            LOG_WARNING("AO bake: failed to write cache %s\n", cachePath);
+        }
+    } else {
+        LOG_INFO("AO bake: %zu vertices loaded from %s\n", visibility.size(), cachePath);
+    }
+
+    auto next = begin(visibility);
+    for (auto& mesh : meshes) {
+        if (mesh.Dynamic) continue;
+        for (auto& v : mesh.Mesh.Vertices) {
+            const auto scale = *next++;
+            auto channel = [&v, scale](int shift) {
+                return uint32_t(((v.C >> shift) & 0xff) * scale) << shift;
+            };
+            v.C = (v.C & 0xff000000) | channel(16) | channel(8) | channel(0);
+        }
+    }
+}
+
+// CPU reference renderer for the scene's boxes, shading like the default shaders: interpolated
+// vertex color times the procedural texture. The eye buffers are sRGB textures viewed through
+// UNORM render targets, so the shaders' output is stored unconverted and the pixels here are too.
+// Needs no GPU, so it also makes reference images and thumbnails on build machines. Primary rays
+// are traced in 2x2 pixel packets and the image is split into tiles for ParallelFor.
+struct RayCaster {
+    struct BoxRef {
+        uint32_t Mesh, Box;
+    };
+    enum { TextureSize = 256, TileSize = 16 };
+
+    const std::vector<MeshDesc>& Meshes;
+    std::vector<BoxRef> Refs;
+    BoxBvh Bvh;
+    std::vector<uint32_t> Textures[4];  // Indexed by TextureFill
+
+    explicit RayCaster(const std::vector<MeshDesc>& meshes)
+        : Meshes(meshes), Bvh{CollectBoxes(meshes, Refs)} {
+        for (auto fill = 0; fill < 4; ++fill)
+            for (auto y = 0u; y < unsigned(TextureSize); ++y)
+                for (auto x = 0u; x < unsigned(TextureSize); ++x)
+                    Textures[fill].push_back(TexturePixel(TextureFill(fill), x, y));
+    }
+
+    // All boxes in world space, including dynamic meshes at their current position
+    static std::vector<TriangleSet::Box> CollectBoxes(const std::vector<MeshDesc>& meshes,
+                                                      std::vector<BoxRef>& refs) {
+        std::vector<TriangleSet::Box> res;
+        for (auto m = 0u; m < meshes.size(); ++m) {
+            const auto& mesh = meshes[m];
+            for (auto b = 0u; b < mesh.Mesh.Boxes.size(); ++b) {
+                const auto& box = mesh.Mesh.Boxes[b];
+                if (box.Empty()) continue;
+                res.push_back({Add(box.Min, mesh.Pos), Add(box.Max, mesh.Pos)});
+                refs.push_back({m, b});
+            }
+        }
+        return res;
+    }
+
+    // Color of the hit point on a box, from the vertices of the face that contains it
+    Float3 Shade(const Float3& hit, uint32_t box) const {
+        const auto& mesh = Meshes[Refs[box].Mesh];
+        const auto& b = mesh.Mesh.Boxes[Refs[box].Box];
+        const auto local = Subtract(hit, mesh.Pos);
+        auto component = [](const Float3& v, int axis) { return (&v.x)[axis]; };
+        // The face is the box plane closest to the hit point
+        auto axis = 0;
+        auto plane = 0.0f, best = FLT_MAX;
+        for (auto a = 0; a < 3; ++a)
+            for (auto value : {component(b.Min, a), component(b.Max, a)})
+                if (std::abs(component(local, a) - value) < best) {
+                    best = std::abs(component(local, a) - value);
+                    axis = a;
+                    plane = value;
+                }
+        const auto verticesPerBox = size_t{TriangleSet::VerticesPerBox};
+        const auto first = &mesh.Mesh.Vertices[Refs[box].Box * verticesPerBox];
+        const Vertex* quad = nullptr;
+        for (auto f = 0u; f < 6 && !quad; ++f)
+            if (std::all_of(first + 6 * f, first + 6 * f + 4,
+                            [&](const Vertex& v) { return component(v.Pos, axis) == plane; }))
+                quad = first + 6 * f;
+        if (!quad) return {0.0f, 0.0f, 0.0f};
+
+        // Interpolate over whichever of the quad's triangles, (0, 1, 2) or (3, 2, 1), holds the
+        // point, as the rasterizer would
+        const auto a0 = (axis + 1) % 3, a1 = (axis + 2) % 3;
+        auto weights = [&](const Vertex& v0, const Vertex& v1, const Vertex& v2, float* w) {
+            const auto x0 = component(v0.Pos, a0), y0 = component(v0.Pos, a1);
+            const auto x1 = component(v1.Pos, a0) - x0, y1 = component(v1.Pos, a1) - y0;
+            const auto x2 = component(v2.Pos, a0) - x0, y2 = component(v2.Pos, a1) - y0;
+            const auto px = component(local, a0) - x0, py = component(local, a1) - y0;
+            const auto det = x1 * y2 - x2 * y1;
+            w[1] = (px * y2 - x2 * py) / det;
+            w[2] = (x1 * py - px * y1) / det;
+            w[0] = 1.0f - w[1] - w[2];
+            return w[0] >= 0.0f && w[1] >= 0.0f && w[2] >= 0.0f;
+        };
+        float w[3];
+        const Vertex* tri[] = {&quad[0], &quad[1], &quad[2]};
+        if (!weights(quad[0], quad[1], quad[2], w)) {
+            tri[0] = &quad[3];
+            weights(quad[3], quad[2], quad[1], w);
+        }
+        auto channel = [](uint32_t c, int shift) { return float((c >> shift) & 0xff) / 255.0f; };
+        auto u = 0.0f, v = 0.0f;
+        float color[3] = {};
+        for (auto i = 0; i < 3; ++i) {
+            u += w[i] * tri[i]->U;
+            v += w[i] * tri[i]->V;
+            for (auto c = 0; c < 3; ++c) color[c] += w[i] * channel(tri[i]->C, 16 - 8 * c);
+        }
+        // Nearest texel with wrapping, textures are R8G8B8A8 so red is the low byte
+        const auto tx = int(std::floor(u * TextureSize)) & (TextureSize - 1);
+        const auto ty = int(std::floor(v * TextureSize)) & (TextureSize - 1);
+        const auto texel = Textures[int(mesh.Fill)][ty * TextureSize + tx];
+        return {color[0] * channel(texel, 0), color[1] * channel(texel, 8),
+                color[2] * channel(texel, 16)};
+    }
+
+    // Render from an eye pose with an ovrFovPort or anything else with the same tangents into
+    // 0xffRRGGBB pixels
+    template <typename Fov>
+    std::vector<uint32_t> Render(const Pose& eye, const Fov& fov, int w, int h,
+                                 unsigned threads) const {
+        std::vector<uint32_t> res(size_t(w) * h);
+        const auto tilesX = (w + TileSize - 1) / TileSize, tilesY = (h + TileSize - 1) / TileSize;
+        ParallelFor(size_t(tilesX) * tilesY, 1, [&](size_t tile) {
+            const auto tileX = int(tile % tilesX) * TileSize, tileY = int(tile / tilesX) * TileSize;
+            for (auto y = tileY; y < std::min(tileY + TileSize, h); y += 2)
+                for (auto x = tileX; x < std::min(tileX + TileSize, w); x += 2) {
+                    // A 2x2 packet, lanes outside the image repeat a valid pixel
+                    auto packet = BoxBvh::RayPacket{};
+                    Float3 dirs[4];
+                    for (auto lane = 0; lane < 4; ++lane) {
+                        const auto px = std::min(x + (lane & 1), w - 1);
+                        const auto py = std::min(y + (lane >> 1), h - 1);
+                        const auto tanX = -fov.LeftTan + (fov.LeftTan + fov.RightTan) *
+                                                             (px + 0.5f) / float(w);
+                        const auto tanY =
+                            fov.UpTan - (fov.UpTan + fov.DownTan) * (py + 0.5f) / float(h);
+                        dirs[lane] = Rotate(eye.Rot, {tanX, tanY, -1.0f});
+                        for (auto axis = 0; axis < 3; ++axis) {
+                            packet.Origin[axis][lane] = (&eye.Pos.x)[axis];
+                            packet.InvDir[axis][lane] =
+                                BoxBvh::SafeReciprocal((&dirs[lane].x)[axis]);
+                        }
+                        packet.TMax[lane] = 1000.0f;
+                        packet.Box[lane] = UINT32_MAX;
+                    }
+                    Bvh.Intersect(packet);
+
+                    for (auto lane = 0; lane < 4; ++lane) {
+                        const auto px = x + (lane & 1), py = y + (lane >> 1);
+                        if (px >= w || py >= h) continue;
+                        auto& pixel = res[size_t(py) * w + px];
+                        pixel = 0xff000000;
+                        if (packet.Box[lane] == UINT32_MAX) continue;
+                        const auto hit = Add(eye.Pos, Scale(dirs[lane], packet.TMax[lane]));
+                        const auto color = Shade(hit, packet.Box[lane]);
+                        auto unorm = [](float c) {
+                            return uint32_t(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+                        };
+                        pixel |= unorm(color.x) << 16 | unorm(color.y) << 8 | unorm(color.z);
+                    }
+                }
+        }, threads);
+        return res;
+    }
+};
+
+// Binary PPM, the simplest format every image viewer reads
+inline bool WritePpm(const char* path, const std::vector<uint32_t>& pixels, int w, int h) {
+    const auto file = OpenFile(path, "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", w, h);
+    std::vector<unsigned char> rgb;
+    rgb.reserve(3 * pixels.size());
+    for (auto p : pixels)
+        rgb.insert(end(rgb), {static_cast<unsigned char>(p >> 16),
+                              static_cast<unsigned char>(p >> 8), static_cast<unsigned char>(p)});
+    const auto ok = fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,155 @@
+// Frame render graph: pass ordering, resource lifetimes and transient resource aliasing
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "core.h"
+
+// Frame render graph. Passes declare the resources they read and write, Compile() derives the
+// execution order, which pass clears each resource (its first writer) and resource lifetimes, then
+// aliases transient resources with disjoint lifetimes onto shared physical resources. Imported
+// resources (swap textures, back buffer) are owned elsewhere and never aliased. The graph is plain
+// CPU data, callers create the GPU objects for Physical and look them up per pass. Formats are
+// opaque to the graph (DXGI_FORMAT values in the app), only compared and sized by BytesPerPixel.
+struct RenderGraph {
+    struct Extent {
+        int w, h;
+    };
+    struct Resource {
+        const char* Name;
+        Extent Size;
+        unsigned Format;
+        bool Transient;
+        int FirstUse = -1, LastUse = -1, Physical = -1;
+    };
+    struct PhysicalResource {
+        Extent Size;
+        unsigned Format;
+    };
+    struct Pass {
+        const char* Name;
+        std::vector<int> Reads, Writes, Clears;
+        // Returns false to abort the rest of the frame
+        std::function<bool(const Pass&)> Execute;
+        bool ShouldClear(int resource) const {
+            return std::find(begin(Clears), end(Clears), resource) != end(Clears);
+        }
+    };
+
+    std::vector<Resource> Resources;
+    std::vector<PhysicalResource> Physical;
+    std::vector<Pass> Passes;
+    std::vector<int> Order;
+    size_t (*BytesPerPixel)(unsigned format);
+
+    explicit RenderGraph(size_t (*bytesPerPixel)(unsigned format)) : BytesPerPixel{bytesPerPixel} {}
+
+    size_t Bytes(Extent dims, unsigned format) const {
+        return size_t(dims.w) * dims.h * BytesPerPixel(format);
+    }
+
+    int Import(const char* name, Extent dims, unsigned format) {
+        Resources.push_back({name, dims, format, false});
+        return int(Resources.size()) - 1;
+    }
+    int CreateTransient(const char* name, Extent dims, unsigned format) {
+        Resources.push_back({name, dims, format, true});
+        return int(Resources.size()) - 1;
+    }
+    void AddPass(const char* name, std::vector<int> reads, std::vector<int> writes,
+                 std::function<bool(const Pass&)> execute) {
+        Passes.push_back({name, std::move(reads), std::move(writes), {}, std::move(execute)});
+    }
+
+    void Compile() {
+        // A pass depends on every earlier declared pass it has a read after write, write after
+        // read or write after write hazard with. Ready passes run in declaration order.
+        auto touches = [](const std::vector<int>& rs, int r) {
+            return std::find(begin(rs), end(rs), r) != end(rs);
+        };
+        const auto numPasses = int(Passes.size());
+        std::vector<int> pending(numPasses);
+        std::vector<std::vector<int>> successors(numPasses);
+        for (auto b = 0; b < numPasses; ++b)
+            for (auto a = 0; a < b; ++a) {
+                const auto& pa = Passes[a];
+                const auto& pb = Passes[b];
+                const auto hazard = std::any_of(begin(pa.Writes), end(pa.Writes), [&](int r) {
+                    return touches(pb.Reads, r) || touches(pb.Writes, r);
+                }) || std::any_of(begin(pa.Reads), end(pa.Reads), [&](int r) {
+                    return touches(pb.Writes, r);
+                });
+                if (!hazard) continue;
+                successors[a].push_back(b);
+                ++pending[b];
+            }
+        Order.clear();
+        while (int(Order.size()) < numPasses) {
+            auto next = 0;
+            while (next < numPasses && pending[next] != 0) ++next;
+            VALIDATE(next < numPasses, "Render graph has a dependency cycle.");
+            pending[next] = -1;
+            Order.push_back(next);
+            for (auto s : successors[next]) --pending[s];
+        }
+
+        // Lifetimes in execution order, the first writer of a resource clears it
+        for (auto& r : Resources) r.FirstUse = r.LastUse = -1;
+        for (auto i = 0; i < numPasses; ++i) {
+            auto& pass = Passes[Order[i]];
+            pass.Clears.clear();
+            for (const auto* rs : {&pass.Writes, &pass.Reads})
+                for (auto r : *rs) {
+                    auto& res = Resources[r];
+                    if (res.FirstUse < 0 && rs == &pass.Writes) pass.Clears.push_back(r);
+                    if (res.FirstUse < 0) res.FirstUse = i;
+                    res.LastUse = i;
+                }
+        }
+
+        // Greedily alias each transient onto a physical resource of the same format that is free
+        // by the time it is first used, growing the physical resource to fit if needed
+        Physical.clear();
+        std::vector<int> physicalLastUse;
+        std::vector<int> byFirstUse;
+        for (auto r = 0; r < int(Resources.size()); ++r)
+            if (Resources[r].Transient && Resources[r].FirstUse >= 0) byFirstUse.push_back(r);
+        std::sort(begin(byFirstUse), end(byFirstUse),
+                  [this](int a, int b) { return Resources[a].FirstUse < Resources[b].FirstUse; });
+        for (auto r : byFirstUse) {
+            auto& res = Resources[r];
+            auto p = 0;
+            while (p < int(Physical.size()) &&
+                   (Physical[p].Format != res.Format || physicalLastUse[p] >= res.FirstUse))
+                ++p;
+            if (p == int(Physical.size())) {
+                Physical.push_back({res.Size, res.Format});
+                physicalLastUse.push_back(-1);
+            }
+            Physical[p].Size = {std::max(Physical[p].Size.w, res.Size.w),
+                                std::max(Physical[p].Size.h, res.Size.h)};
+            physicalLastUse[p] = res.LastUse;
+            res.Physical = p;
+        }
+    }
+
+    size_t TransientBytes() const {
+        auto res = size_t{0};
+        for (const auto& r : Resources)
+            if (r.Transient && r.FirstUse >= 0) res += Bytes(r.Size, r.Format);
+        return res;
+    }
+    size_t PhysicalBytes() const {
+        auto res = size_t{0};
+        for (const auto& p : Physical) res += Bytes(p.Size, p.Format);
+        return res;
+    }
+
+    bool Execute() const {
+        for (auto i : Order)
+            if (!Passes[i].Execute(Passes[i])) return false;
+        return true;
+    }
+};
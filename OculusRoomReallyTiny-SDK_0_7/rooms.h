@@ -0,0 +1,163 @@
+// The demo scenes: the default room and generated grids of rooms, with their cells and portals
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "cells.h"
+#include "geometry.h"
+
+// The default room, with its cells and portals added to cells if given
+inline std::vector<MeshDesc> CreateRoomMeshes(bool bakeLighting = true,
+                                              CellGraph* cells = nullptr) {
+    std::vector<MeshDesc> res;
+    auto newSet = [bakeLighting] {
+        TriangleSet t;
+        t.BakeLighting = bakeLighting;
+        return t;
+    };
+
+    auto cube = newSet();
+    cube.AddBox(0.5f, -0.5f, 0.5f, -0.5f, 0.5f, -0.5f, 0xff404040);
+    res.push_back({std::move(cube), {0, 0, 0}, TextureFill::AUTO_CEILING, true});
+
+    auto spareCube = newSet();
+    spareCube.AddBox(0.1f, -0.1f, 0.1f, -0.1f, +0.1f, -0.1f, 0xffff0000);
+    res.push_back({std::move(spareCube), {0, -10, 0}, TextureFill::AUTO_CEILING});
+
+    auto walls = newSet();
+    walls.AddBox(10.1f, 0.0f, 20.0f, 10.0f, 4.0f, -20.0f, 0xff808080);     // Left Wall
+    walls.AddBox(10.0f, -0.1f, 20.1f, -10.0f, 4.0f, 20.0f, 0xff808080);    // Back Wall
+    walls.AddBox(-10.0f, -0.1f, 20.0f, -10.1f, 4.0f, -20.0f, 0xff808080);  // Right Wall
+    res.push_back({std::move(walls), {0, 0, 0}, TextureFill::AUTO_WALL});
+
+    auto floors = newSet();
+    floors.AddBox(10.0f, -0.1f, 20.0f, -10.0f, 0.0f, -20.1f, 0xff808080);    // Main floor
+    floors.AddBox(15.0f, -6.1f, -18.0f, -15.0f, -6.0f, -30.0f, 0xff808080);  // Bottom floor
+    res.push_back({std::move(floors), {0, 0, 0}, TextureFill::AUTO_FLOOR});  // Floors
+
+    auto ceiling = newSet();
+    ceiling.AddBox(10.0f, 4.0f, 20.0f, -10.0f, 4.1f, -20.1f, 0xff808080);
+    res.push_back({std::move(ceiling), {0, 0, 0}, TextureFill::AUTO_CEILING});  // Ceiling
+
+    auto furniture = newSet();
+    furniture.AddBox(-9.5f, 0.75f, -3.0f, -10.1f, 2.5f, -3.1f,
+                     0xff383838);  // Right side shelf// Verticals
+    furniture.AddBox(-9.5f, 0.95f, -3.7f, -10.1f, 2.75f, -3.8f,
+                     0xff383838);  // Right side shelf
+    furniture.AddBox(-9.55f, 1.20f, -2.5f, -10.1f, 1.30f, -3.75f,
+                     0xff383838);  // Right side shelf// Horizontals
+    furniture.AddBox(-9.55f, 2.00f, -3.05f, -10.1f, 2.10f, -4.2f,
+                     0xff383838);  // Right side shelf
+    furniture.AddBox(-5.0f, 1.1f, -20.0f, -10.0f, 1.2f, -20.1f, 0xff383838);  // Right railing
+    furniture.AddBox(10.0f, 1.1f, -20.0f, 5.0f, 1.2f, -20.1f, 0xff383838);    // Left railing
+    for (float f = 5; f <= 9; f += 1)
+        furniture.AddBox(-f, 0.0f, -20.0f, -f - 0.1f, 1.1f, -20.1f, 0xff505050);  // Left Bars
+    for (float f = 5; f <= 9; f += 1)
+        furniture.AddBox(f, 1.1f, -20.0f, f + 0.1f, 0.0f, -20.1f, 0xff505050);  // Right Bars
+    furniture.AddBox(1.8f, 0.8f, -1.0f, 0.0f, 0.7f, 0.0f, 0xff505000);          // Table
+    furniture.AddBox(1.8f, 0.0f, 0.0f, 1.7f, 0.7f, -0.1f, 0xff505000);          // Table Leg
+    furniture.AddBox(1.8f, 0.7f, -1.0f, 1.7f, 0.0f, -0.9f, 0xff505000);         // Table Leg
+    furniture.AddBox(0.0f, 0.0f, -1.0f, 0.1f, 0.7f, -0.9f, 0xff505000);         // Table Leg
+    furniture.AddBox(0.0f, 0.7f, 0.0f, 0.1f, 0.0f, -0.1f, 0xff505000);          // Table Leg
+    furniture.AddBox(1.4f, 0.5f, 1.1f, 0.8f, 0.55f, 0.5f, 0xff202050);          // Chair Set
+    furniture.AddBox(1.401f, 0.0f, 1.101f, 1.339f, 1.0f, 1.039f, 0xff202050);   // Chair Leg 1
+    furniture.AddBox(1.401f, 0.5f, 0.499f, 1.339f, 0.0f, 0.561f, 0xff202050);   // Chair Leg 2
+    furniture.AddBox(0.799f, 0.0f, 0.499f, 0.861f, 0.5f, 0.561f, 0xff202050);   // Chair Leg 2
+    furniture.AddBox(0.799f, 1.0f, 1.101f, 0.861f, 0.0f, 1.039f, 0xff202050);   // Chair Leg 2
+    furniture.AddBox(1.4f, 0.97f, 1.05f, 0.8f, 0.92f, 1.10f,
+                     0xff202050);  // Chair Back high bar
+    for (float f = 3.0f; f <= 6.6f; f += 0.4f)
+        furniture.AddBox(3, 0.0f, -f, 2.9f, 1.3f, -f - 0.1f, 0xff404040);  // Posts
+    res.push_back(
+        {std::move(furniture), {0, 0, 0}, TextureFill::AUTO_WHITE});  // Fixtures & furniture
+
+    if (cells) {
+        // The room and the lower floor, seen over the railing through the whole far end
+        const auto room = cells->AddCell({-10.0f, 0.0f, -20.0f}, {10.0f, 4.0f, 20.0f});
+        const auto lower = cells->AddCell({-15.0f, -6.0f, -30.0f}, {15.0f, 4.0f, -20.0f});
+        cells->AddPortal(room, lower, {-10.0f, -6.0f, -20.0f}, {10.0f, 4.0f, -20.0f});
+    }
+    return res;
+}
+
+// Generated venue of rooms x rooms connected rooms, each 8m square with a doorway in every
+// interior wall and a table. Meshes are split per row of rooms to stay within 16 bit indices. The
+// first mesh is the animated cube, like the default room. Each room is a cell and each doorway a
+// portal, added to cells if given.
+inline std::vector<MeshDesc> CreateRoomGrid(int rooms, bool bakeLighting = true,
+                                            CellGraph* cells = nullptr) {
+    std::vector<MeshDesc> res;
+
+    TriangleSet cube;
+    cube.BakeLighting = bakeLighting;
+    cube.AddBox(0.5f, -0.5f, 0.5f, -0.5f, 0.5f, -0.5f, 0xff404040);
+    res.push_back({std::move(cube), {0, 0, 0}, TextureFill::AUTO_CEILING, true});
+
+    const auto roomSize = 8.0f, height = 4.0f, thickness = 0.1f;
+    const auto door = 0.6f, doorHeight = 2.2f;
+    const auto x0 = -roomSize / 2, z0 = 6.0f;  // Room (0, 0) contains the starting camera position
+    // A wall along x (alongX) or z from a to b at c, with a centered doorway unless solid
+    auto addWall = [=](TriangleSet& walls, bool alongX, float a, float b, float c, bool solid) {
+        auto add = [&walls, alongX, c, thickness](float from, float to, float y1, float y2) {
+            if (alongX)
+                walls.AddBox(from, y1, c, to, y2, c - thickness, 0xff808080);
+            else
+                walls.AddBox(c + thickness, y1, from, c, y2, to, 0xff808080);
+        };
+        const auto mid = (a + b) / 2;
+        if (solid) {
+            add(a, b, 0.0f, height);
+            return;
+        }
+        add(a, mid - door, 0.0f, height);
+        add(mid + door, b, 0.0f, height);
+        add(mid - door, mid + door, doorHeight, height);  // Lintel
+    };
+    if (cells) {
+        // Room (i, j) is cell j * rooms + i
+        for (auto j = 0; j < rooms; ++j)
+            for (auto i = 0; i < rooms; ++i)
+                cells->AddCell({x0 + i * roomSize, 0.0f, z0 - (j + 1) * roomSize},
+                               {x0 + (i + 1) * roomSize, height, z0 - j * roomSize});
+        for (auto j = 0; j < rooms; ++j)
+            for (auto i = 0; i < rooms; ++i) {
+                const auto c = unsigned(j * rooms + i);
+                const auto xLeft = x0 + i * roomSize, zBack = z0 - (j + 1) * roomSize;
+                const auto xMid = xLeft + roomSize / 2, zMid = zBack + roomSize / 2;
+                if (j < rooms - 1)
+                    cells->AddPortal(c, c + rooms, {xMid - door, 0.0f, zBack},
+                                     {xMid + door, doorHeight, zBack});
+                if (i > 0)
+                    cells->AddPortal(c - 1, c, {xLeft, 0.0f, zMid - door},
+                                     {xLeft, doorHeight, zMid + door});
+            }
+    }
+    for (auto j = 0; j < rooms; ++j) {
+        TriangleSet walls, floors, ceilings, furniture;
+        walls.BakeLighting = floors.BakeLighting = ceilings.BakeLighting = bakeLighting;
+        furniture.BakeLighting = bakeLighting;
+        const auto zFront = z0 - j * roomSize, zBack = zFront - roomSize;
+        for (auto i = 0; i < rooms; ++i) {
+            const auto xLeft = x0 + i * roomSize, xRight = xLeft + roomSize;
+            floors.AddBox(xRight, -0.1f, zFront, xLeft, 0.0f, zBack, 0xff808080);
+            ceilings.AddBox(xRight, height, zFront, xLeft, height + 0.1f, zBack, 0xff808080);
+            // Each room owns its back and left walls, the last row and column close the grid
+            addWall(walls, true, xLeft, xRight, zBack + thickness, j == rooms - 1);
+            if (j == 0) addWall(walls, true, xLeft, xRight, zFront, true);
+            addWall(walls, false, zBack, zFront, xLeft, i == 0);
+            if (i == rooms - 1) addWall(walls, false, zBack, zFront, xRight - thickness, true);
+            const auto cx = xLeft + roomSize / 2 + 1.0f, cz = zBack + roomSize / 2;
+            furniture.AddBox(cx + 1.8f, 0.8f, cz - 1.0f, cx, 0.7f, cz, 0xff505000);  // Table
+            furniture.AddBox(cx + 1.8f, 0.0f, cz, cx + 1.7f, 0.7f, cz - 0.1f, 0xff505000);
+            furniture.AddBox(cx + 1.8f, 0.7f, cz - 1.0f, cx + 1.7f, 0.0f, cz - 0.9f, 0xff505000);
+            furniture.AddBox(cx, 0.0f, cz - 1.0f, cx + 0.1f, 0.7f, cz - 0.9f, 0xff505000);
+            furniture.AddBox(cx, 0.7f, cz, cx + 0.1f, 0.0f, cz - 0.1f, 0xff505000);
+        }
+        res.push_back({std::move(walls), {0, 0, 0}, TextureFill::AUTO_WALL});
+        res.push_back({std::move(floors), {0, 0, 0}, TextureFill::AUTO_FLOOR});
+        res.push_back({std::move(ceilings), {0, 0, 0}, TextureFill::AUTO_CEILING});
+        res.push_back({std::move(furniture), {0, 0, 0}, TextureFill::AUTO_WHITE});
+    }
+    return res;
+}
@@ -0,0 +1,161 @@
+// Live per frame counters in a shared memory ring, shared by the app and the telemetry reader
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Live per frame counters in a shared memory ring, for a monitor process to read at its own rate
+// without the frame loop ever waiting on it. The layout is fixed so other tools can read it:
+//   0    Header: uint32 Magic ("TLM1"), Version, Capacity (a power of two) and RecordSize, then a
+//        64 bit count of records published so far, padded to 64 bytes
+//   64   Capacity records of RecordSize bytes, the nth record published goes in slot n % Capacity
+// A record is a 64 bit sequence number followed by Counters. The sequence is odd while the writer
+// fills the slot and 2n + 2 once record n is complete. Readers copy the counters and keep them only
+// if the sequence was 2n + 2 both before and after the copy. Counters are stored as 64 bit atomic
+// words, so a reader racing the writer gets a torn copy it throws away rather than a data race.
+// The ring is named Local\OculusRoomTinyTelemetry on Windows and /OculusRoomTinyTelemetry under
+// /dev/shm on Linux, where it outlives the process until removed.
+struct Telemetry {
+    struct Counters {
+        unsigned long long Frame;
+        double Time, FrameSeconds, EyeCpuSeconds, EyeGpuSeconds;
+        double PoseAgeSeconds;  // From reading the tracking state to submitting the frame
+        uint32_t Draws, CulledModels, Models, UploadedBytes;
+    };
+    enum { Words = sizeof(Counters) / sizeof(uint64_t) };
+    struct Record {
+        std::atomic<uint64_t> Sequence;
+        std::atomic<uint64_t> Values[Words];
+    };
+    struct Header {
+        uint32_t Magic, Version, Capacity, RecordSize;
+        std::atomic<uint64_t> Written;
+        char Pad[40];
+    };
+    static_assert(sizeof(Counters) == Words * sizeof(uint64_t) &&
+                      std::is_trivially_copyable<Counters>::value,
+                  "Counters must copy as whole words.");
+    static_assert(sizeof(Header) == 64 && sizeof(Record) == 72, "Telemetry layout changed.");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory needs lock free 64 bit atomics.");
+    enum { Capacity = 1024 };  // Over 10 seconds of frames at 90Hz
+    static constexpr uint32_t Magic = 0x314d4c54u, Version = 1;
+
+    Header* Mapped = nullptr;
+    Record* Records = nullptr;
+#ifdef _WIN32
+    HANDLE Mapping = nullptr;
+#else
+    int File = -1;
+#endif
+
+    Telemetry() = default;
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+    ~Telemetry() { Close(); }
+
+    static size_t Bytes() { return sizeof(Header) + Capacity * sizeof(Record); }
+
+    // Create the ring for writing, or open an existing one read only. False if that fails or the
+    // existing ring has a different layout.
+    bool Open(bool create) {
+        Close();
+#ifdef _WIN32
+        const auto name = L"Local\\OculusRoomTinyTelemetry";
+        Mapping = create ? CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                              DWORD(Bytes()), name)
+                         : OpenFileMappingW(FILE_MAP_READ, FALSE, name);
+        const auto view =
+            Mapping ? MapViewOfFile(Mapping, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, Bytes())
+                    : nullptr;
+#else
+        File = shm_open("/OculusRoomTinyTelemetry", create ? O_CREAT | O_RDWR : O_RDONLY, 0644);
+        if (File >= 0 && create && ftruncate(File, off_t(Bytes())) != 0) {
+            close(File);
+            File = -1;
+        }
+        auto view = File >= 0 ? mmap(nullptr, Bytes(), create ? PROT_READ | PROT_WRITE : PROT_READ,
+                                     MAP_SHARED, File, 0)
+                              : MAP_FAILED;
+        if (view == MAP_FAILED) view = nullptr;
+#endif
+        if (!view || !Attach(view, create)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    // Use Bytes() of memory at view as the ring, initializing it when creating. False if an
+    // existing ring has a different layout. Open does this for the shared mapping.
+    bool Attach(void* view, bool create) {
+        Mapped = static_cast<Header*>(view);
+        Records = reinterpret_cast<Record*>(Mapped + 1);
+        if (create) {
+            // The ring may be left over from an earlier run, readers restart when Written drops
+            Mapped->Written.store(0, std::memory_order_relaxed);
+            for (auto i = 0u; i < Capacity; ++i)
+                Records[i].Sequence.store(0, std::memory_order_relaxed);
+            Mapped->Version = Version;
+            Mapped->Capacity = Capacity;
+            Mapped->RecordSize = uint32_t(sizeof(Record));
+            std::atomic_thread_fence(std::memory_order_release);
+            Mapped->Magic = Magic;
+            return true;
+        }
+        return Mapped->Magic == Magic && Mapped->Version == Version &&
+               Mapped->Capacity == Capacity && Mapped->RecordSize == sizeof(Record);
+    }
+
+    void Close() {
+#ifdef _WIN32
+        if (Mapping && Mapped) UnmapViewOfFile(Mapped);
+        if (Mapping) CloseHandle(Mapping);
+        Mapping = nullptr;
+#else
+        if (File >= 0 && Mapped) munmap(Mapped, Bytes());
+        if (File >= 0) close(File);
+        File = -1;
+#endif
+        Mapped = nullptr;
+        Records = nullptr;
+    }
+
+    // Never blocks, a slow reader just misses records that have been overwritten
+    void Publish(const Counters& counters) {
+        const auto n = Mapped->Written.load(std::memory_order_relaxed);
+        auto& record = Records[n % Capacity];
+        uint64_t words[Words];
+        memcpy(words, &counters, sizeof(counters));
+        record.Sequence.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (auto i = 0; i < Words; ++i)
+            record.Values[i].store(words[i], std::memory_order_relaxed);
+        record.Sequence.store(2 * n + 2, std::memory_order_release);
+        Mapped->Written.store(n + 1, std::memory_order_release);
+    }
+
+    // Copy record n, false if it has been overwritten or is being written
+    bool Read(uint64_t n, Counters& counters) const {
+        const auto& record = Records[n % Capacity];
+        const auto sequence = record.Sequence.load(std::memory_order_acquire);
+        uint64_t words[Words];
+        for (auto i = 0; i < Words; ++i)
+            words[i] = record.Values[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence != 2 * n + 2 || record.Sequence.load(std::memory_order_relaxed) != sequence)
+            return false;
+        memcpy(&counters, words, sizeof(counters));
+        return true;
+    }
+};
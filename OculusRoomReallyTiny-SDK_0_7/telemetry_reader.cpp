@@ -0,0 +1,58 @@
+// Reader for the telemetry ring, prints a summary of the frames published since the last poll every
+// interval until killed. Run alongside an app instance started with -telemetry:
+//   telemetry_reader [interval ms, default 1000]
+// Builds on any platform from the CMakeLists.txt at the repository root.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "telemetry.h"
+
+int main(int argc, char** argv) {
+    const auto interval = std::chrono::milliseconds(argc > 1 ? std::max(1, atoi(argv[1])) : 1000);
+    Telemetry telemetry;
+    printf("Waiting for a -telemetry instance...\n");
+    fflush(stdout);
+    while (!telemetry.Open(false)) std::this_thread::sleep_for(interval);
+    auto next = telemetry.Mapped->Written.load(std::memory_order_acquire);
+    for (;;) {
+        std::this_thread::sleep_for(interval);
+        const auto written = telemetry.Mapped->Written.load(std::memory_order_acquire);
+        if (written < next) next = 0;  // The writer restarted
+        auto missed = written - next > Telemetry::Capacity ? written - next - Telemetry::Capacity
+                                                           : uint64_t{0};
+        next += missed;
+        auto frames = 0u;
+        auto frameMs = 0.0, worstMs = 0.0, eyeCpuMs = 0.0, eyeGpuMs = 0.0, poseAgeMs = 0.0;
+        auto draws = 0.0, culled = 0.0, models = 0.0, uploaded = 0.0;
+        for (auto counters = Telemetry::Counters{}; next < written; ++next) {
+            if (!telemetry.Read(next, counters)) {
+                ++missed;
+                continue;
+            }
+            ++frames;
+            frameMs += 1000.0 * counters.FrameSeconds;
+            worstMs = std::max(worstMs, 1000.0 * counters.FrameSeconds);
+            eyeCpuMs += 1000.0 * counters.EyeCpuSeconds;
+            eyeGpuMs += 1000.0 * counters.EyeGpuSeconds;
+            poseAgeMs += 1000.0 * counters.PoseAgeSeconds;
+            draws += counters.Draws;
+            culled += counters.CulledModels;
+            models += counters.Models;
+            uploaded += counters.UploadedBytes;
+        }
+        if (frames)
+            printf("%4u frames: %.2fms (worst %.2fms), eye cpu %.3fms gpu %.3fms, pose age "
+                   "%.2fms, %.0f draws, %.1f of %.0f models culled, %.1f KB uploaded, %llu "
+                   "missed\n",
+                   frames, frameMs / frames, worstMs, eyeCpuMs / frames, eyeGpuMs / frames,
+                   poseAgeMs / frames, draws / frames, culled / frames, models / frames,
+                   uploaded / 1024 / frames, static_cast<unsigned long long>(missed));
+        else
+            printf("No frames, %llu missed\n", static_cast<unsigned long long>(missed));
+        fflush(stdout);
+    }
+}
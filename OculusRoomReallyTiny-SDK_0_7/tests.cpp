@@ -0,0 +1,1755 @@
+// Tests for the platform neutral parts of the app, built on any platform from the CMakeLists.txt at
+// the repository root. Runs every test, or only those named on the command line.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "capture.h"
+#include "core.h"
+#include "geometry.h"
+#include "gpu_memory.h"
+#include "hlod.h"
+#include "input.h"
+#include "lights.h"
+#include "pacing.h"
+#include "pvs.h"
+#include "raster.h"
+#include "raycast.h"
+#include "render_graph.h"
+#include "rooms.h"
+#include "telemetry.h"
+
+struct Test {
+    const char* Name;
+    void (*Run)();
+};
+
+std::vector<Test>& Tests() {
+    static std::vector<Test> tests;
+    return tests;
+}
+
+struct AddTest {
+    AddTest(const char* name, void (*run)()) { Tests().push_back({name, run}); }
+};
+
+#define TEST(name)                         \
+    void name();                           \
+    const AddTest name##Test{#name, name}; \
+    void name()
+
+int Failures = 0;
+
+// Non fatal check, logged with its location
+#define CHECK(x)                                                                   \
+    if (!(x)) {                                                                    \
+        fprintf(stderr, "%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #x);     \
+        ++Failures;                                                                \
+    }
+
+// View space point to D3D clip space for an eye fov, as ovrMatrix4f_Projection does for a right
+// handed projection with near and far planes at 0.2 and 1000
+Float4 Project(const FovTangents& fov, const Float3& v) {
+    const auto n = 0.2f, f = 1000.0f;
+    const auto w = -v.z;
+    const auto x = (2.0f * v.x / w - fov.RightTan + fov.LeftTan) / (fov.LeftTan + fov.RightTan);
+    const auto y = (2.0f * v.y / w - fov.UpTan + fov.DownTan) / (fov.UpTan + fov.DownTan);
+    return {x * w, y * w, w * f / (f - n) - f * n / (f - n), w};
+}
+
+// The mask covers everything outside the polygon around the visible circle and nothing inside the
+// circle, for symmetric and off center eye fovs
+TEST(HiddenAreaMask) {
+    const FovTangents fovs[] = {{1.0f, 1.0f, 1.0f, 1.0f}, {1.33f, 1.33f, 1.06f, 1.09f}};
+    for (const auto& fov : fovs) {
+        const auto w = 400, h = 480, segments = 32;
+        const auto verts = CreateHiddenAreaMesh(fov, segments);
+        CHECK(verts.size() == size_t(segments) * 6);
+        auto raster = CoverageRasterizer{w, h};
+        for (auto i = size_t{0}; i < verts.size(); i += 3)
+            raster.DrawTriangle(Project(fov, verts[i]), Project(fov, verts[i + 1]),
+                                Project(fov, verts[i + 2]));
+        const auto radius = std::max({fov.UpTan, fov.DownTan, fov.LeftTan, fov.RightTan});
+        const auto inner = radius / std::cos(Pi / segments);
+        auto wrong = 0, masked = 0;
+        for (auto y = 0; y < h; ++y)
+            for (auto x = 0; x < w; ++x) {
+                const auto tx = -fov.LeftTan + (x + 0.5f) / w * (fov.LeftTan + fov.RightTan);
+                const auto ty = fov.UpTan - (y + 0.5f) / h * (fov.UpTan + fov.DownTan);
+                const auto r = std::hypot(tx, ty);
+                const auto covered = raster.Depth[size_t(y) * w + x] < 1.0f;
+                masked += covered ? 1 : 0;
+                if ((r < radius * 0.999f && covered) || (r > inner * 1.001f && !covered)) ++wrong;
+            }
+        CHECK(wrong == 0);
+        CHECK(masked > 0);
+        CHECK(size_t(masked) == size_t(raster.CountCovered()));
+    }
+}
+
+// Depth testing and overdraw counts for full screen quads, and clipping against the near plane
+TEST(CoverageRasterizerDepth) {
+    const auto w = 64, h = 48;
+    auto quad = [](CoverageRasterizer& raster, float z, bool depthEqual) {
+        const Float4 tl{-1, 1, z, 1}, tr{1, 1, z, 1}, bl{-1, -1, z, 1}, br{1, -1, z, 1};
+        raster.DrawTriangle(tl, tr, bl, depthEqual);
+        raster.DrawTriangle(tr, br, bl, depthEqual);
+    };
+    const auto pixels = size_t(w) * h;
+
+    auto backToFront = CoverageRasterizer{w, h};
+    quad(backToFront, 0.6f, false);
+    quad(backToFront, 0.3f, false);
+    CHECK(size_t(backToFront.CountCovered()) == pixels);
+    CHECK(backToFront.Fragments == 2 * pixels);
+    CHECK(backToFront.Passed == 2 * pixels);
+
+    auto frontToBack = CoverageRasterizer{w, h};
+    quad(frontToBack, 0.3f, false);
+    quad(frontToBack, 0.6f, false);
+    CHECK(frontToBack.Passed == pixels);
+
+    // Equal test after a depth pre-pass shades each pixel once
+    frontToBack.Fragments = frontToBack.Passed = 0;
+    quad(frontToBack, 0.3f, true);
+    quad(frontToBack, 0.6f, true);
+    CHECK(frontToBack.Fragments == 2 * pixels);
+    CHECK(frontToBack.Passed == pixels);
+
+    // Counter clockwise triangles are culled
+    auto culled = CoverageRasterizer{w, h};
+    culled.DrawTriangle({-1, 1, 0.5f, 1}, {-1, -1, 0.5f, 1}, {1, 1, 0.5f, 1});
+    CHECK(culled.Fragments == 0);
+
+    // A triangle half behind the near plane keeps only its front half
+    auto clipped = CoverageRasterizer{w, h};
+    clipped.DrawTriangle({-1, 1, -1, 1}, {1, 1, 1, 1}, {-1, -1, -1, 1});
+    clipped.DrawTriangle({1, 1, 1, 1}, {1, -1, 1, 1}, {-1, -1, -1, 1});
+    CHECK(size_t(clipped.CountCovered()) == pixels / 2);
+}
+
+// Dynamic resolution against a simulated GPU whose frame time is a fixed cost plus a cost per
+// pixel, measured LatencyFrames late like the GPU timer. Every load must settle on one scale inside
+// the band, or at a scale limit, without shrinking and growing back and forth.
+TEST(DynamicResolutionConverges) {
+    const auto budget = 1.0 / 90.0;
+    struct Load {
+        double FixedSeconds, PixelSeconds;  // Pixel cost at scale 1
+        double Noise;                       // Relative amplitude of per frame variation
+    };
+    const Load loads[] = {{0.002, 0.014, 0.0},  {0.002, 0.0045, 0.0}, {0.001, 0.03, 0.0},
+                          {0.002, 0.014, 0.03}, {0.0, 0.0105, 0.03},  {0.004, 0.05, 0.0}};
+    for (const auto& load : loads) {
+        auto res = DynamicResolution{0.3f, 1.0f, 1.0f};
+        double measured[DynamicResolution::LatencyFrames] = {};
+        auto random = 12345u;
+        auto reversals = 0, lastDirection = 0, lastChange = 0;
+        auto frameSeconds = 0.0;
+        const auto frames = 600;
+        for (auto frame = 0; frame < frames; ++frame) {
+            auto& slot = measured[frame % DynamicResolution::LatencyFrames];
+            const auto before = res.Scale;
+            res.Update(slot, budget);
+            if (res.Scale != before) {
+                const auto direction = res.Scale > before ? 1 : -1;
+                if (lastDirection && direction != lastDirection) ++reversals;
+                lastDirection = direction;
+                lastChange = frame;
+            }
+            random = random * 1664525u + 1013904223u;
+            const auto noise = load.Noise * (double(random >> 8) / double(1u << 24) * 2.0 - 1.0);
+            frameSeconds = (load.FixedSeconds + load.PixelSeconds * res.Scale * res.Scale) *
+                           (1.0 + noise);
+            slot = frameSeconds;
+        }
+        CHECK(lastChange < frames / 2);
+        CHECK(reversals == 0);
+        const auto settled = float(frameSeconds / budget);
+        const auto margin = 1.0f + float(load.Noise);
+        CHECK((settled <= DynamicResolution::ShrinkAbove * margin &&
+               settled >= DynamicResolution::GrowBelow / margin) ||
+              (res.Scale == res.MaxScale && settled < DynamicResolution::ShrinkAbove) ||
+              (res.Scale == res.MinScale && settled > DynamicResolution::GrowBelow));
+    }
+}
+
+// A load change mid run is followed to a new steady scale, again without oscillating
+TEST(DynamicResolutionFollowsLoadChanges) {
+    const auto budget = 1.0 / 90.0;
+    auto res = DynamicResolution{0.3f, 1.0f, 1.0f};
+    double measured[DynamicResolution::LatencyFrames] = {};
+    const double pixelSeconds[] = {0.02, 0.006, 0.012, 0.03};
+    auto frame = 0;
+    for (auto pixel : pixelSeconds) {
+        auto lastChange = frame, reversals = 0, lastDirection = 0;
+        auto frameSeconds = 0.0;
+        for (const auto end = frame + 300; frame < end; ++frame) {
+            auto& slot = measured[frame % DynamicResolution::LatencyFrames];
+            const auto before = res.Scale;
+            res.Update(slot, budget);
+            if (res.Scale != before) {
+                const auto direction = res.Scale > before ? 1 : -1;
+                if (lastDirection && direction != lastDirection) ++reversals;
+                lastDirection = direction;
+                lastChange = frame;
+            }
+            frameSeconds = 0.002 + pixel * res.Scale * res.Scale;
+            slot = frameSeconds;
+        }
+        CHECK(frame - lastChange > 150);
+        CHECK(reversals <= 1);  // The measurements in flight when the load changes may be stale
+        const auto settled = float(frameSeconds / budget);
+        CHECK(settled <= DynamicResolution::ShrinkAbove);
+        CHECK(settled >= DynamicResolution::GrowBelow || res.Scale == res.MaxScale);
+    }
+}
+
+// Stand-in for the compositor: ovr_SubmitFrame results for an app that is hidden between two
+// times, e.g. while the HMD is taken off
+struct StandInCompositor {
+    enum { ovrSuccess = 0, ovrSuccess_NotVisible = 1000 };
+    double HiddenFrom, HiddenUntil;
+    unsigned Submits = 0;
+
+    int SubmitFrame(double now) {
+        ++Submits;
+        return now >= HiddenFrom && now < HiddenUntil ? ovrSuccess_NotVisible : ovrSuccess;
+    }
+};
+
+// The Render, Poll and Wait transitions for individual submit results
+TEST(VisibilityThrottleTransitions) {
+    using Action = VisibilityThrottle::Action;
+    auto throttle = VisibilityThrottle{};
+    CHECK(throttle.NextAction(0.0) == Action::Render);
+    throttle.OnSubmit(StandInCompositor::ovrSuccess, 1.0);
+    CHECK(throttle.NextAction(1.0) == Action::Render);
+    CHECK(throttle.NextAction(100.0) == Action::Render);
+
+    throttle.OnSubmit(StandInCompositor::ovrSuccess_NotVisible, 2.0);
+    CHECK(throttle.NextAction(2.0) == Action::Wait);
+    CHECK(throttle.NextAction(2.0 + VisibilityThrottle::PollInterval * 0.5) == Action::Wait);
+    CHECK(throttle.NextAction(2.0 + VisibilityThrottle::PollInterval) == Action::Poll);
+
+    // Still hidden, the next poll is a full interval after this one
+    const auto poll = 2.0 + VisibilityThrottle::PollInterval * 1.5;
+    throttle.OnSubmit(StandInCompositor::ovrSuccess_NotVisible, poll);
+    CHECK(throttle.NextAction(poll + VisibilityThrottle::PollInterval * 0.5) == Action::Wait);
+    CHECK(throttle.NextAction(poll + VisibilityThrottle::PollInterval) == Action::Poll);
+
+    throttle.OnSubmit(StandInCompositor::ovrSuccess, poll + VisibilityThrottle::PollInterval);
+    CHECK(throttle.NextAction(poll + VisibilityThrottle::PollInterval) == Action::Render);
+}
+
+// The main loop's use of the throttle against the stand-in compositor on a simulated clock: every
+// frame renders while visible, only spaced out polls are submitted while hidden, and rendering
+// resumes within a poll interval of becoming visible again
+TEST(VisibilityThrottleLowPowerLoop) {
+    using Action = VisibilityThrottle::Action;
+    const auto frameSeconds = 1.0 / 90.0, hiddenFrom = 1.0, hiddenUntil = 3.0, end = 4.0;
+    auto compositor = StandInCompositor{hiddenFrom, hiddenUntil};
+    auto throttle = VisibilityThrottle{};
+    auto rendered = 0u, renderedWhileHidden = 0u, polls = 0u;
+    auto lastPoll = -1.0, shortestPollGap = 1e9, firstRenderAfter = 1e9;
+    for (auto now = 0.0; now < end;) {
+        switch (throttle.NextAction(now)) {
+            case Action::Wait:
+                CHECK(throttle.NextPoll > now);
+                now = throttle.NextPoll;  // The loop sleeps until the next poll
+                break;
+            case Action::Poll:
+                if (lastPoll >= 0.0) shortestPollGap = std::min(shortestPollGap, now - lastPoll);
+                lastPoll = now;
+                ++polls;
+                throttle.OnSubmit(compositor.SubmitFrame(now), now);
+                break;
+            case Action::Render:
+                ++rendered;
+                if (now >= hiddenFrom + frameSeconds && now < hiddenUntil) ++renderedWhileHidden;
+                if (now >= hiddenUntil) firstRenderAfter = std::min(firstRenderAfter, now);
+                now += frameSeconds;
+                throttle.OnSubmit(compositor.SubmitFrame(now), now);
+                break;
+        }
+    }
+    const auto visibleFrames = unsigned((end - (hiddenUntil - hiddenFrom)) / frameSeconds);
+    CHECK(renderedWhileHidden == 0);
+    CHECK(rendered >= visibleFrames - 10 && rendered <= visibleFrames + 2);
+    CHECK(shortestPollGap >= VisibilityThrottle::PollInterval - 1e-9);
+    const auto expectedPolls = (hiddenUntil - hiddenFrom) / VisibilityThrottle::PollInterval;
+    CHECK(polls >= unsigned(expectedPolls) - 1 && polls <= unsigned(expectedPolls) + 1);
+    CHECK(firstRenderAfter - hiddenUntil <= VisibilityThrottle::PollInterval + 1e-9);
+    CHECK(compositor.Submits == rendered + polls);
+}
+
+// The position stream matches the interleaved vertices, and splitting a smaller range into the same
+// scratch reuses its storage rather than reallocating
+TEST(SplitPositionsReusesStorage) {
+    auto mesh = TriangleSet{};
+    mesh.AddBox(0.0f, 0.0f, 0.0f, 1.0f, 2.0f, 3.0f, 0xff808080);
+    mesh.AddBox(-1.0f, 0.5f, 2.0f, 4.0f, 1.0f, 2.5f, 0xff808080);
+    std::vector<Float3> positions;
+    SplitPositions(mesh.Vertices.data(), mesh.Vertices.size(), positions);
+    CHECK(positions.size() == mesh.Vertices.size());
+    auto same = [&mesh, &positions](size_t first) {
+        for (auto i = size_t{0}; i < positions.size(); ++i) {
+            const auto& p = mesh.Vertices[first + i].Pos;
+            if (positions[i].x != p.x || positions[i].y != p.y || positions[i].z != p.z)
+                return false;
+        }
+        return true;
+    };
+    CHECK(same(0));
+    const auto storage = positions.data();
+    SplitPositions(mesh.Vertices.data() + TriangleSet::VerticesPerBox, TriangleSet::VerticesPerBox,
+                   positions);
+    CHECK(positions.size() == TriangleSet::VerticesPerBox);
+    CHECK(positions.data() == storage);
+    CHECK(same(TriangleSet::VerticesPerBox));
+}
+
+// Stand-ins for the DXGI formats the frame graph uses and their sizes
+enum : unsigned { ColorFormat = 29, DepthFormat = 45, WideFormat = 10 };
+
+size_t TestBytesPerPixel(unsigned format) { return format == WideFormat ? 8 : 4; }
+
+// The app's frame graph: two eyes rendered one after the other, each with its own transient depth
+// buffer, then submit and mirror. The depth buffers have disjoint lifetimes so they alias.
+TEST(RenderGraphAliasesEyeDepth) {
+    auto graph = RenderGraph{TestBytesPerPixel};
+    const RenderGraph::Extent left{1182, 1464}, right{1182, 1464};
+    const int colors[] = {graph.Import("Left eye color", left, ColorFormat),
+                          graph.Import("Right eye color", right, ColorFormat)};
+    const int depths[] = {graph.CreateTransient("Left eye depth", left, DepthFormat),
+                          graph.CreateTransient("Right eye depth", right, DepthFormat)};
+    const auto mirror = graph.Import("Mirror texture", {1920, 1080}, ColorFormat);
+    const auto backBuffer = graph.Import("Back buffer", {1920, 1080}, ColorFormat);
+    std::vector<const char*> executed;
+    auto record = [&executed](const RenderGraph::Pass& pass) {
+        executed.push_back(pass.Name);
+        return true;
+    };
+    for (auto eye = 0; eye < 2; ++eye)
+        graph.AddPass(eye ? "Right eye" : "Left eye", {}, {colors[eye], depths[eye]}, record);
+    graph.AddPass("Submit", {colors[0], colors[1]}, {mirror}, record);
+    graph.AddPass("Mirror", {mirror}, {backBuffer}, record);
+    graph.Compile();
+
+    CHECK(graph.Physical.size() == 1);
+    CHECK(graph.Resources[depths[0]].Physical == 0);
+    CHECK(graph.Resources[depths[0]].Physical == graph.Resources[depths[1]].Physical);
+    CHECK(graph.Resources[colors[0]].Physical == -1);  // Imported resources are never aliased
+    CHECK(graph.PhysicalBytes() < graph.TransientBytes());
+    CHECK(graph.PhysicalBytes() == size_t(left.w) * left.h * 4);
+    CHECK(graph.TransientBytes() == 2 * graph.PhysicalBytes());
+
+    // Declaration order is a valid order here, and each eye pass clears its own targets
+    CHECK((graph.Order == std::vector<int>{0, 1, 2, 3}));
+    CHECK(graph.Passes[0].ShouldClear(colors[0]) && graph.Passes[0].ShouldClear(depths[0]));
+    CHECK(graph.Passes[1].ShouldClear(colors[1]) && graph.Passes[1].ShouldClear(depths[1]));
+    CHECK(!graph.Passes[2].ShouldClear(colors[0]) && graph.Passes[2].ShouldClear(mirror));
+    CHECK(graph.Execute());
+    CHECK(executed.size() == 4);
+}
+
+// Transients only alias when their lifetimes are disjoint and their formats match, and a shared
+// physical resource grows to the largest transient placed on it
+TEST(RenderGraphAliasingRules) {
+    auto graph = RenderGraph{TestBytesPerPixel};
+    const auto a = graph.CreateTransient("A", {100, 50}, DepthFormat);
+    const auto b = graph.CreateTransient("B", {60, 80}, DepthFormat);
+    const auto c = graph.CreateTransient("C", {100, 100}, WideFormat);
+    const auto d = graph.CreateTransient("D", {10, 10}, DepthFormat);
+    const auto out = graph.Import("Out", {100, 100}, ColorFormat);
+    auto pass = [](const RenderGraph::Pass&) { return true; };
+    graph.AddPass("Write A", {}, {a}, pass);
+    graph.AddPass("A to B", {a}, {b}, pass);  // A is still live when B is written
+    graph.AddPass("B to C", {b}, {c}, pass);
+    graph.AddPass("C to D", {c}, {d}, pass);
+    graph.AddPass("D to out", {d}, {out}, pass);
+    graph.Compile();
+
+    const auto& res = graph.Resources;
+    CHECK(res[a].Physical != res[b].Physical);
+    CHECK(res[c].Physical != res[a].Physical && res[c].Physical != res[b].Physical);
+    CHECK(res[d].Physical == res[a].Physical);  // A is dead by then, B is still being read
+    CHECK(graph.Physical.size() == 3);
+    const auto& shared = graph.Physical[size_t(res[a].Physical)];
+    CHECK(shared.Size.w == 100 && shared.Size.h == 50);
+    const auto& grown = graph.Physical[size_t(res[b].Physical)];
+    CHECK(grown.Size.w == 60 && grown.Size.h == 80);
+    CHECK(graph.TransientBytes() == (5000 + 4800 + 100) * 4 + 10000 * 8);
+    CHECK(graph.PhysicalBytes() == (5000 + 4800) * 4 + 10000 * 8);
+}
+
+// Only the first writer of a resource clears it, and a failing pass stops the rest of the frame
+TEST(RenderGraphClearsAndAborts) {
+    auto graph = RenderGraph{TestBytesPerPixel};
+    const auto shadow = graph.CreateTransient("Shadow", {64, 64}, DepthFormat);
+    const auto color = graph.Import("Color", {64, 64}, ColorFormat);
+    std::vector<int> executed;
+    auto pass = [&executed](int id, bool ok) {
+        return [&executed, id, ok](const RenderGraph::Pass&) {
+            executed.push_back(id);
+            return ok;
+        };
+    };
+    graph.AddPass("Shadow", {}, {shadow}, pass(0, true));
+    graph.AddPass("Scene", {shadow}, {color}, pass(1, false));
+    graph.AddPass("Unrelated", {}, {}, pass(2, true));
+    graph.AddPass("Post", {color}, {color}, pass(3, true));
+    graph.Compile();
+    CHECK((graph.Order == std::vector<int>{0, 1, 2, 3}));
+    CHECK(graph.Passes[0].ShouldClear(shadow) && graph.Passes[1].ShouldClear(color));
+    CHECK(!graph.Passes[3].ShouldClear(color));
+    CHECK(!graph.Execute());
+    CHECK((executed == std::vector<int>{0, 1}));
+}
+
+// Keeps the compiler from eliding the allocations under test
+void* volatile AllocationSink;
+
+// Every replaceable operator new form is counted, nothrow and array forms included
+TEST(AllocationTrackerCountsAllForms) {
+    const auto count = AllocationTracker::Count, bytes = AllocationTracker::Bytes;
+    auto single = new int{1};
+    AllocationSink = single;
+    auto array = new int[4];
+    AllocationSink = array;
+    auto nothrowSingle = new (std::nothrow) int{2};
+    AllocationSink = nothrowSingle;
+    auto nothrowArray = new (std::nothrow) int[8];
+    AllocationSink = nothrowArray;
+    CHECK(AllocationTracker::Count - count == 4);
+    CHECK(AllocationTracker::Bytes - bytes >= 14 * sizeof(int));
+    delete single;
+    delete[] array;
+    delete nothrowSingle;
+    delete[] nothrowArray;
+
+    // Counts are per thread
+    const auto before = AllocationTracker::Count;
+    std::thread{[] { AllocationSink = new int[2]; delete[] static_cast<int*>(AllocationSink); }}
+        .join();
+    CHECK(AllocationTracker::Count - before <= 1);  // At most the thread's own state
+}
+
+// A headless steady state frame loop over the per frame CPU work that runs without a GPU or the
+// runtime: the frame arena, pacing, the frame graph and logging. Once warmed up, a frame must not
+// touch the heap at all.
+TEST(SteadyStateFrameLoopDoesNotAllocate) {
+    auto arena = FrameArena{64 * 1024};
+    Logger logger{false};
+    auto resolution = DynamicResolution{0.5f, 1.0f, 1.0f};
+    auto visibility = VisibilityThrottle{};
+    auto graph = RenderGraph{TestBytesPerPixel};
+    const int colors[] = {graph.Import("Left eye color", {1182, 1464}, ColorFormat),
+                          graph.Import("Right eye color", {1182, 1464}, ColorFormat)};
+    const int depths[] = {graph.CreateTransient("Left eye depth", {1182, 1464}, DepthFormat),
+                          graph.CreateTransient("Right eye depth", {1182, 1464}, DepthFormat)};
+    const auto mirror = graph.Import("Mirror texture", {1920, 1080}, ColorFormat);
+    auto now = 0.0, gpuSeconds = 0.0;
+    auto draws = 0u, layerCount = 0u;
+    auto raster = CoverageRasterizer{64, 64};
+    KeyEventQueue input;
+    auto keyboard = KeyboardState{};
+    for (auto eye = 0; eye < 2; ++eye)
+        graph.AddPass("Eye", {}, {colors[eye], depths[eye]}, [&](const RenderGraph::Pass&) {
+            std::fill(begin(raster.Depth), end(raster.Depth), 1.0f);
+            raster.DrawTriangle({-1, 1, 0.5f, 1}, {1, 1, 0.5f, 1}, {-1, -1, 0.5f, 1});
+            draws += unsigned(raster.Passed);
+            return true;
+        });
+    graph.AddPass("Submit", {colors[0], colors[1]}, {mirror}, [&](const RenderGraph::Pass&) {
+        // Layers live in the frame arena like the app's ovrLayerEyeFov list
+        auto layers = arena.MakeVector<Float4>();
+        layers.reserve(4);
+        for (auto i = 0; i < 4; ++i) layers.push_back({float(i), 0.0f, 0.0f, 1.0f});
+        layerCount += unsigned(layers.size());
+        visibility.OnSubmit(0, now);
+        return true;
+    });
+    graph.Compile();
+
+    auto frame = [&](unsigned index) {
+        arena.BeginFrame();
+        if (visibility.NextAction(now) != VisibilityThrottle::Action::Render) return;
+        input.Push({now, 'W', index % 2 == 0});
+        keyboard.Drain(input, now);
+        resolution.Update(gpuSeconds, 1.0 / 90.0);
+        graph.Execute();
+        gpuSeconds = 0.004 + 0.008 * resolution.Scale * resolution.Scale;
+        now += 1.0 / 90.0;
+        if (index % 90 == 0)
+            logger.Write(LogLevel::Info, "Frame %u: %.3fms, %u draws\n", index,
+                         1000.0 * gpuSeconds, draws);
+    };
+    for (auto i = 0u; i < 10; ++i) frame(i);
+    const auto count = AllocationTracker::Count;
+    for (auto i = 10u; i < 1010; ++i) frame(i);
+    CHECK(AllocationTracker::Count == count);
+    CHECK(layerCount == 4 * 1010);
+    CHECK(!keyboard.Keys['W'] && input.Dropped == 0);
+}
+
+// Texture sizes over full and partial mip chains, arrays, samples and block compressed formats
+TEST(TextureBytesFormats) {
+    const auto rgba = FormatBlock{1, 4}, bc1 = FormatBlock{4, 8}, bc7 = FormatBlock{4, 16};
+    CHECK(TextureBytes(1182, 1464, 1, 1, 1, rgba) == size_t(1182) * 1464 * 4);
+    CHECK(TextureBytes(1182, 1464, 1, 1, 4, rgba) == size_t(1182) * 1464 * 16);
+    CHECK(TextureBytes(64, 64, 1, 6, 1, rgba) == size_t(64) * 64 * 4 * 6);
+
+    // Full chains of 256x256 are 256, 128, ..., 1: the levels sum to 87381 texels
+    CHECK(TextureBytes(256, 256, 0, 1, 1, rgba) == size_t(87381) * 4);
+    CHECK(TextureBytes(256, 256, 9, 1, 1, rgba) == TextureBytes(256, 256, 0, 1, 1, rgba));
+    CHECK(TextureBytes(256, 256, 8, 1, 1, rgba) == size_t(87380) * 4);
+    CHECK(TextureBytes(256, 64, 0, 1, 1, rgba) ==
+          size_t(256 * 64 + 128 * 32 + 64 * 16 + 32 * 8 + 16 * 4 + 8 * 2 + 4 + 2 + 1) * 4);
+
+    // Block compressed levels are whole 4x4 blocks, the 2x2 and 1x1 levels included
+    CHECK(TextureBytes(256, 256, 1, 1, 1, bc1) == size_t(256) * 256 / 2);
+    CHECK(TextureBytes(256, 256, 1, 1, 1, bc7) == size_t(256) * 256);
+    const auto bc1Blocks = 64 * 64 + 32 * 32 + 16 * 16 + 8 * 8 + 4 * 4 + 2 * 2 + 1 + 1 + 1;
+    CHECK(TextureBytes(256, 256, 0, 1, 1, bc1) == size_t(bc1Blocks) * 8);
+    CHECK(TextureBytes(256, 256, 0, 1, 1, bc7) == size_t(bc1Blocks) * 16);
+    CHECK(TextureBytes(6, 10, 1, 1, 1, bc1) == size_t(2 * 3) * 8);
+}
+
+// Totals, owners and the high-water mark follow adds and removes, also from several threads
+TEST(GpuMemoryTrackerAccounting) {
+    GpuMemoryTracker tracker;
+    tracker.Add(GpuMemoryCategory::RenderTarget, "Eye buffers", 3000);
+    tracker.Add(GpuMemoryCategory::Texture, "Scene textures", 500);
+    tracker.Add(GpuMemoryCategory::Texture, "Capture staging", 700);
+    CHECK(tracker.Total == 4200 && tracker.HighWater == 4200);
+    tracker.Remove(GpuMemoryCategory::RenderTarget, "Eye buffers", 3000);
+    CHECK(tracker.Total == 1200 && tracker.HighWater == 4200);
+    CHECK(tracker.Bytes[size_t(GpuMemoryCategory::Texture)] == 1200);
+    CHECK(tracker.Bytes[size_t(GpuMemoryCategory::RenderTarget)] == 0);
+    CHECK(tracker.Owners.size() == 3);
+    CHECK(tracker.OwnerBytes("Capture staging") == 700);
+
+    // Resources are released from whichever thread drops the last reference
+    std::vector<std::thread> threads;
+    for (auto t = 0; t < 4; ++t)
+        threads.emplace_back([&tracker] {
+            for (auto i = 0; i < 20000; ++i) {
+                tracker.Add(GpuMemoryCategory::Geometry, "Geometry pool", 64);
+                tracker.Remove(GpuMemoryCategory::Geometry, "Geometry pool", 64);
+            }
+        });
+    for (auto& thread : threads) thread.join();
+    CHECK(tracker.Total == 1200);
+    CHECK(tracker.Bytes[size_t(GpuMemoryCategory::Geometry)] == 0);
+    CHECK(tracker.OwnerBytes("Geometry pool") == 0);
+    CHECK(tracker.HighWater >= 4200 && tracker.HighWater <= 4200 + 4 * 64);
+}
+
+// First fit allocation, failure when no range is large enough and coalescing with both neighbours
+TEST(RangeAllocatorCoalesces) {
+    RangeAllocator allocator{100};
+    RangeAllocator::Range a, b, c, d;
+    CHECK(allocator.Allocate(10, a) && a.Start == 0 && a.Count == 10);
+    CHECK(allocator.Allocate(20, b) && b.Start == 10 && b.Count == 20);
+    CHECK(allocator.Allocate(30, c) && c.Start == 30 && c.Count == 30);
+    CHECK(!allocator.Allocate(41, d));
+    CHECK(allocator.FreeCount() == 40 && allocator.LargestFree() == 40);
+    CHECK(allocator.Fragmentation() == 0.0f);
+
+    // A hole before the tail: 20 of 60 free units are split off
+    allocator.Release(b);
+    CHECK(allocator.Free.size() == 2 && allocator.FreeCount() == 60);
+    CHECK(std::fabs(allocator.Fragmentation() - (1.0f - 40.0f / 60.0f)) < 1e-6f);
+    CHECK(!allocator.Allocate(50, d));
+
+    // First fit takes the hole, not the tail
+    CHECK(allocator.Allocate(5, d) && d.Start == 10);
+    allocator.Release(d);
+    CHECK(allocator.Free.size() == 2);
+
+    // Merging with the previous range, then with both neighbours into one range
+    allocator.Release(a);
+    CHECK(allocator.Free.size() == 2 && allocator.Free[0].Start == 0 &&
+          allocator.Free[0].Count == 30);
+    allocator.Release(c);
+    CHECK(allocator.Free.size() == 1 && allocator.FreeCount() == 100);
+    CHECK(allocator.Fragmentation() == 0.0f);
+    allocator.Release({0, 0});
+    CHECK(allocator.Free.size() == 1);
+    CHECK(allocator.Allocate(100, a) && allocator.Free.empty() && !allocator.Allocate(1, b));
+    CHECK(allocator.Fragmentation() == 0.0f);
+}
+
+// Random allocations and releases never overlap, and releasing everything coalesces back to a
+// single range whatever the order
+TEST(RangeAllocatorRandomChurn) {
+    const auto capacity = 4096u;
+    RangeAllocator allocator{capacity};
+    std::vector<int> owner(capacity, -1);
+    std::vector<RangeAllocator::Range> live;
+    std::mt19937 random{1234};
+    auto maxFragmentation = 0.0f;
+    for (auto i = 0; i < 20000; ++i) {
+        if (live.empty() || random() % 3 != 0) {
+            auto range = RangeAllocator::Range{};
+            const auto count = 1 + unsigned(random() % 64);
+            const auto largest = allocator.LargestFree();
+            CHECK(allocator.Allocate(count, range) == (largest >= count));
+            if (largest < count) continue;
+            for (auto e = range.Start; e < range.Start + range.Count; ++e) {
+                CHECK(owner[e] == -1);
+                owner[e] = i;
+            }
+            live.push_back(range);
+        } else {
+            const auto pick = random() % live.size();
+            const auto range = live[pick];
+            live[pick] = live.back();
+            live.pop_back();
+            std::fill_n(begin(owner) + range.Start, range.Count, -1);
+            allocator.Release(range);
+        }
+        // The free list stays sorted, disjoint and never has adjacent ranges left unmerged
+        for (size_t f = 1; f < allocator.Free.size(); ++f)
+            CHECK(allocator.Free[f - 1].Start + allocator.Free[f - 1].Count <
+                  allocator.Free[f].Start);
+        CHECK(allocator.FreeCount() == size_t(std::count(begin(owner), end(owner), -1)));
+        maxFragmentation = std::max(maxFragmentation, allocator.Fragmentation());
+    }
+    CHECK(maxFragmentation > 0.0f);
+    std::shuffle(begin(live), end(live), random);
+    for (const auto& range : live) allocator.Release(range);
+    CHECK(allocator.Free.size() == 1 && allocator.FreeCount() == capacity);
+    CHECK(allocator.Fragmentation() == 0.0f);
+}
+
+// Removed box slots are handed out again, most recently removed first, before the set grows, and
+// the reused slot holds the new box
+TEST(TriangleSetReusesRemovedSlots) {
+    const auto n = size_t{TriangleSet::VerticesPerBox};
+    auto mesh = TriangleSet{};
+    for (auto i = 0u; i < 4; ++i)
+        CHECK(mesh.AddBox(float(i), 0, 0, i + 0.5f, 1, 1, 0xff808080) == i);
+    mesh.RemoveBox(1);
+    mesh.RemoveBox(2);
+    CHECK(mesh.Boxes[1].Empty() && mesh.Boxes[2].Empty());
+    CHECK(mesh.AddBox(5, 0, 0, 6, 2, 1, 0xff808080) == 2);
+    CHECK(mesh.AddBox(7, 0, 0, 8, 3, 1, 0xff808080) == 1);
+    CHECK(mesh.Vertices.size() == 4 * n && mesh.Indices.size() == 4 * n);
+    CHECK(mesh.Boxes.size() == 4 && mesh.FreeBoxes.empty());
+    CHECK(!mesh.Boxes[2].Empty() && mesh.Boxes[2].Min.x == 5 && mesh.Boxes[2].Max.y == 2);
+    CHECK(!mesh.Boxes[1].Empty() && mesh.Boxes[1].Min.x == 7 && mesh.Boxes[1].Max.y == 3);
+    for (auto i = n; i < 2 * n; ++i) {
+        CHECK(mesh.Vertices[i].Pos.x >= 7 && mesh.Vertices[i].Pos.x <= 8);
+        CHECK(size_t(mesh.Indices[i]) == i);
+    }
+    CHECK(mesh.AddBox(9, 0, 0, 10, 1, 1, 0xff808080) == 4);
+    CHECK(mesh.Vertices.size() == 5 * n && mesh.Boxes.size() == 5);
+}
+
+// A removed box leaves only degenerate triangles in its slot and the other boxes untouched
+TEST(TriangleSetRemovedBoxIsDegenerate) {
+    const auto n = size_t{TriangleSet::VerticesPerBox};
+    auto mesh = TriangleSet{};
+    for (auto i = 0; i < 3; ++i) mesh.AddBox(float(i), 0, 0, i + 0.5f, 1, 1, 0xff808080);
+    const auto indices = mesh.Indices;
+    mesh.RemoveBox(1);
+    CHECK(mesh.Boxes[1].Empty() && !mesh.Boxes[0].Empty() && !mesh.Boxes[2].Empty());
+    for (auto i = size_t{0}; i < mesh.Indices.size(); i += 3) {
+        const auto a = mesh.Indices[i], b = mesh.Indices[i + 1], c = mesh.Indices[i + 2];
+        const auto removed = i >= n && i < 2 * n;
+        CHECK(removed ? a == b && b == c && size_t(a) == n
+                      : a == indices[i] && b == indices[i + 1] && c == indices[i + 2]);
+    }
+}
+
+// Edits are recorded as vertex ranges, an edit right after the last range extends it and any other
+// edit starts a new range
+TEST(TriangleSetDirtyRangesCoalesce) {
+    const auto n = unsigned{TriangleSet::VerticesPerBox};
+    auto mesh = TriangleSet{};
+    for (auto i = 0; i < 4; ++i) mesh.AddBox(float(i), 0, 0, i + 0.5f, 1, 1, 0xff808080);
+    auto dirty = [&mesh](std::vector<std::pair<unsigned, unsigned>> expected) {
+        auto same = mesh.Dirty.size() == expected.size();
+        for (auto i = size_t{0}; same && i < expected.size(); ++i)
+            same = mesh.Dirty[i].Start == expected[i].first &&
+                   mesh.Dirty[i].Count == expected[i].second;
+        mesh.Dirty.clear();
+        return same;
+    };
+    CHECK(dirty({{0, 4 * n}}));
+    mesh.ModifyBox(2, 2, 0, 0, 3, 1, 1, 0xff808080);
+    mesh.ModifyBox(0, 0, 0, 0, 1, 1, 1, 0xff808080);
+    CHECK(dirty({{2 * n, n}, {0, n}}));
+    mesh.ModifyBox(1, 1, 0, 0, 2, 1, 1, 0xff808080);
+    mesh.RemoveBox(2);
+    mesh.ModifyBox(3, 3, 0, 0, 4, 1, 1, 0xff808080);
+    CHECK(dirty({{n, 3 * n}}));
+    mesh.RemoveBox(0);
+    CHECK(mesh.AddBox(0, 0, 0, 1, 1, 1, 0xff808080) == 0);
+    CHECK(mesh.AddBox(2, 0, 0, 3, 1, 1, 0xff808080) == 2);
+    CHECK(mesh.AddBox(4, 0, 0, 5, 1, 1, 0xff808080) == 4);
+    CHECK(dirty({{0, n}, {0, n}, {2 * n, n}, {4 * n, n}}));
+    auto copy = TriangleSet{};
+    copy.CopyBox(mesh, 1);
+    copy.CopyBox(mesh, 3);
+    CHECK(copy.Dirty.size() == 1 && copy.Dirty[0].Start == 0 && copy.Dirty[0].Count == 2 * n);
+}
+
+// Brute force reference for RemoveHiddenFaces: a face is hidden when any other static box covers
+// it in plane and extends past it on the outward side
+std::vector<Vertex> VisibleFaces(const std::vector<MeshDesc>& meshes, size_t m) {
+    const auto eps = 1e-4f;
+    auto world = [](const Float3& v, const Float3& pos, int axis) {
+        return (&v.x)[axis] + (&pos.x)[axis];
+    };
+    const int faceAxes[] = {1, 1, 0, 0, 2, 2};
+    const auto& mesh = meshes[m];
+    std::vector<Vertex> res;
+    for (size_t b = 0; b < mesh.Mesh.Boxes.size(); ++b) {
+        const auto& box = mesh.Mesh.Boxes[b];
+        if (box.Empty()) continue;
+        for (auto f = 0u; f < 6; ++f) {
+            const auto first = b * TriangleSet::VerticesPerBox + f * 6;
+            const auto axis = faceAxes[f];
+            const auto c = world(mesh.Mesh.Vertices[first].Pos, mesh.Pos, axis);
+            const auto outward = c >= world(box.Max, mesh.Pos, axis);
+            auto hidden = false;
+            for (size_t o = 0; o < meshes.size(); ++o) {
+                if (meshes[o].Dynamic) continue;
+                for (size_t ob = 0; ob < meshes[o].Mesh.Boxes.size(); ++ob) {
+                    const auto& occ = meshes[o].Mesh.Boxes[ob];
+                    if (occ.Empty() || (o == m && ob == b)) continue;
+                    const auto& pos = meshes[o].Pos;
+                    auto covers = true;
+                    for (auto a = 0; a < 3; ++a)
+                        if (a != axis &&
+                            (world(occ.Min, pos, a) > world(box.Min, mesh.Pos, a) + eps ||
+                             world(occ.Max, pos, a) < world(box.Max, mesh.Pos, a) - eps))
+                            covers = false;
+                    if (covers && (outward ? world(occ.Min, pos, axis) <= c + eps &&
+                                                 world(occ.Max, pos, axis) > c + eps
+                                           : world(occ.Max, pos, axis) >= c - eps &&
+                                                 world(occ.Min, pos, axis) < c - eps))
+                        hidden = true;
+                }
+            }
+            if (!hidden)
+                res.insert(end(res), begin(mesh.Mesh.Vertices) + first,
+                           begin(mesh.Mesh.Vertices) + first + 6);
+        }
+    }
+    return res;
+}
+
+bool SameVertices(const std::vector<Vertex>& a, const std::vector<Vertex>& b) {
+    return a.size() == b.size() &&
+           std::equal(begin(a), end(a), begin(b), [](const Vertex& l, const Vertex& r) {
+               return l.Pos.x == r.Pos.x && l.Pos.y == r.Pos.y && l.Pos.z == r.Pos.z &&
+                      l.C == r.C && l.U == r.U && l.V == r.V;
+           });
+}
+
+// Faces under a box on the floor, inside a larger box and between stacked boxes go, faces that are
+// only coplanar or partly covered stay
+TEST(RemoveHiddenFacesSimple) {
+    std::vector<MeshDesc> meshes(3);
+    for (auto& mesh : meshes) mesh.Mesh.BakeLighting = false;
+    meshes[0].Mesh.AddBox(-5.0f, -0.1f, -5.0f, 5.0f, 0.0f, 5.0f, 0xff808080);  // Floor
+    meshes[1].Mesh.AddBox(0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0xff404040);     // Crate on it
+    meshes[1].Mesh.AddBox(0.2f, 0.2f, 0.2f, 0.8f, 0.8f, 0.8f, 0xff404040);     // Inside the crate
+    meshes[2].Pos = {0.0f, 1.0f, 0.0f};                                        // Stacked crate
+    meshes[2].Mesh.AddBox(0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0xff404040);
+    RemoveHiddenFaces(meshes);
+    // The floor keeps all faces, the crate loses its bottom and top, the inner box everything
+    CHECK(meshes[0].Mesh.Indices.size() == 36);
+    CHECK(meshes[1].Mesh.Indices.size() == 24);
+    CHECK(meshes[2].Mesh.Indices.size() == 30);
+    for (const auto& v : meshes[1].Mesh.Vertices) CHECK(v.Pos.y == 0.0f || v.Pos.y == 1.0f);
+}
+
+// The grid accelerated removal keeps exactly the faces the brute force test keeps, over random
+// boxes snapped to a coarse lattice so they often touch, overlap, nest and coincide
+TEST(RemoveHiddenFacesMatchesBruteForce) {
+    std::mt19937 random{99};
+    auto coordinate = [&random](int cells) { return 0.25f * float(int(random() % cells)); };
+    for (auto scene = 0; scene < 8; ++scene) {
+        std::vector<MeshDesc> meshes(5);
+        for (size_t m = 0; m < meshes.size(); ++m) {
+            auto& mesh = meshes[m];
+            mesh.Mesh.BakeLighting = false;
+            mesh.Pos = {coordinate(4), 0.0f, coordinate(4)};
+            mesh.Dynamic = m == 4 && scene % 2;
+            for (auto b = 0; b < 60; ++b) {
+                const auto x = coordinate(24), y = coordinate(8), z = coordinate(24);
+                mesh.Mesh.AddBox(x, y, z, x + 0.25f + coordinate(12), y + 0.25f + coordinate(6),
+                                 z + 0.25f + coordinate(12), 0xff000000 | random() % 0xffffff);
+            }
+            // A few removed slots, which neither occlude nor produce faces
+            mesh.Mesh.RemoveBox(TriangleSet::BoxHandle(random() % 60));
+        }
+        std::vector<std::vector<Vertex>> expected;
+        for (size_t m = 0; m < meshes.size(); ++m) expected.push_back(VisibleFaces(meshes, m));
+        const auto dynamicVertices = meshes[4].Mesh.Vertices;
+        const auto stats = RemoveHiddenFaces(meshes);
+        for (size_t m = 0; m < meshes.size(); ++m)
+            CHECK(SameVertices(meshes[m].Mesh.Vertices,
+                               meshes[m].Dynamic ? dynamicVertices : expected[m]));
+        CHECK(stats.TrianglesAfter < stats.TrianglesBefore);
+        CHECK(stats.TrianglesAfter > stats.TrianglesBefore / 4);
+        // Far fewer occluder tests than the all pairs count of boxes x faces
+        CHECK(stats.OccluderTests < 300 * 300 * 6 / 10);
+    }
+}
+
+// Flat colored venue of boxes that touch without overlapping: a floor of 1m tiles colored in 2m
+// blocks, walls built from 1m pieces with a doorway, a table, and a pillar of stacked cubes. The
+// furniture mesh is offset, like meshes placed in a scene.
+std::vector<MeshDesc> MergeTestScene() {
+    std::vector<MeshDesc> meshes(3);
+    for (auto& mesh : meshes) mesh.Mesh.BakeLighting = false;
+    auto& floors = meshes[0].Mesh;
+    for (auto i = 0; i < 8; ++i)
+        for (auto j = 0; j < 8; ++j)
+            floors.AddBox(float(i), -0.1f, float(j), float(i + 1), 0.0f, float(j + 1),
+                          (i / 2 + j / 2) % 2 ? 0xff808080 : 0xff605040);
+    auto& walls = meshes[1].Mesh;
+    for (auto i = 0; i < 8; ++i) {
+        const auto lo = float(i), hi = float(i + 1);
+        // Along x with a doorway at 3-4, along z solid
+        if (i == 3)
+            walls.AddBox(lo, 2.2f, -0.1f, hi, 3.0f, 0.0f, 0xffb0b0b0);
+        else
+            walls.AddBox(lo, 0.0f, -0.1f, hi, 3.0f, 0.0f, 0xffb0b0b0);
+        walls.AddBox(-0.1f, 0.0f, lo, 0.0f, 3.0f, hi, 0xffb0b0b0);
+    }
+    auto& furniture = meshes[2].Mesh;
+    meshes[2].Pos = {1.0f, 0.0f, 1.0f};
+    furniture.AddBox(2.0f, 0.7f, 2.0f, 3.5f, 0.8f, 3.0f, 0xff505000);  // Table top
+    for (auto x : {2.0f, 3.4f})
+        for (auto z : {2.0f, 2.9f})
+            furniture.AddBox(x, 0.0f, z, x + 0.1f, 0.7f, z + 0.1f, 0xff505000);  // Legs
+    for (auto y = 0; y < 3; ++y)  // Pillar on the corner of a floor block
+        furniture.AddBox(4.0f, float(y), 4.0f, 5.0f, float(y + 1), 5.0f, 0xff202050);
+    RemoveHiddenFaces(meshes);
+    return meshes;
+}
+
+// World space vertices that lie strictly inside an axis aligned triangle edge, where rasterization
+// can crack
+std::vector<std::tuple<float, float, float>> TJunctions(const std::vector<MeshDesc>& meshes) {
+    std::vector<Float3> points;
+    std::vector<std::pair<Float3, Float3>> edges;
+    for (const auto& mesh : meshes) {
+        const auto& t = mesh.Mesh;
+        auto world = [&mesh, &t](size_t i) {
+            const auto& p = t.Vertices[t.Indices[i]].Pos;
+            return Float3{p.x + mesh.Pos.x, p.y + mesh.Pos.y, p.z + mesh.Pos.z};
+        };
+        for (size_t i = 0; i < t.Indices.size(); i += 3)
+            for (auto e = 0u; e < 3; ++e) {
+                points.push_back(world(i + e));
+                edges.emplace_back(world(i + e), world(i + (e + 1) % 3));
+            }
+    }
+    std::vector<std::tuple<float, float, float>> res;
+    for (const auto& edge : edges)
+        for (auto d = 0; d < 3; ++d) {
+            const auto &a = edge.first, &b = edge.second;
+            const auto o1 = (d + 1) % 3, o2 = (d + 2) % 3;
+            if ((&a.x)[o1] != (&b.x)[o1] || (&a.x)[o2] != (&b.x)[o2]) continue;
+            const auto lo = std::min((&a.x)[d], (&b.x)[d]), hi = std::max((&a.x)[d], (&b.x)[d]);
+            for (const auto& p : points)
+                if ((&p.x)[o1] == (&a.x)[o1] && (&p.x)[o2] == (&a.x)[o2] && (&p.x)[d] > lo &&
+                    (&p.x)[d] < hi)
+                    res.emplace_back(p.x, p.y, p.z);
+        }
+    std::sort(begin(res), end(res));
+    res.erase(std::unique(begin(res), end(res)), end(res));
+    return res;
+}
+
+// Software rasterizer resolving the nearest face's color and perspective correct texture
+// coordinates at every pixel center, with the culling and near clipping of CoverageRasterizer
+struct ShadingRasterizer {
+    struct ClipVertex {
+        Float4 P;
+        float U, V;
+    };
+    int W, H;
+    std::vector<float> Depth, U, V;
+    std::vector<uint32_t> Color;
+
+    ShadingRasterizer(int w, int h)
+        : W{w}, H{h}, Depth(size_t(w) * h, 1.0f), U(Depth.size()), V(Depth.size()),
+          Color(Depth.size()) {}
+
+    void DrawTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c,
+                      uint32_t color) {
+        const ClipVertex in[] = {a, b, c};
+        ClipVertex out[4];
+        auto n = 0;
+        for (auto i = 0; i < 3; ++i) {
+            const auto p = in[i], q = in[(i + 1) % 3];
+            if (p.P.z >= 0.0f) out[n++] = p;
+            if ((p.P.z >= 0.0f) != (q.P.z >= 0.0f)) {
+                const auto t = p.P.z / (p.P.z - q.P.z);
+                auto lerp = [t](float x, float y) { return x + t * (y - x); };
+                out[n++] = {{lerp(p.P.x, q.P.x), lerp(p.P.y, q.P.y), lerp(p.P.z, q.P.z),
+                             lerp(p.P.w, q.P.w)},
+                            lerp(p.U, q.U),
+                            lerp(p.V, q.V)};
+            }
+        }
+        for (auto i = 2; i < n; ++i) Rasterize(out[0], out[i - 1], out[i], color);
+    }
+
+    void Rasterize(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, uint32_t color) {
+        auto toScreen = [this](const Float4& v) {
+            return Float3{(v.x / v.w * 0.5f + 0.5f) * W, (0.5f - v.y / v.w * 0.5f) * H, v.z / v.w};
+        };
+        const auto v0 = toScreen(a.P), v1 = toScreen(b.P), v2 = toScreen(c.P);
+        const auto area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (area <= 0.0f) return;
+        const auto minX = std::max(0, int(std::floor(std::min({v0.x, v1.x, v2.x}))));
+        const auto maxX = std::min(W - 1, int(std::ceil(std::max({v0.x, v1.x, v2.x}))));
+        const auto minY = std::max(0, int(std::floor(std::min({v0.y, v1.y, v2.y}))));
+        const auto maxY = std::min(H - 1, int(std::ceil(std::max({v0.y, v1.y, v2.y}))));
+        auto edge = [](const Float3& p, const Float3& q, float x, float y) {
+            return (q.x - p.x) * (y - p.y) - (x - p.x) * (q.y - p.y);
+        };
+        for (auto y = minY; y <= maxY; ++y)
+            for (auto x = minX; x <= maxX; ++x) {
+                const auto px = x + 0.5f, py = y + 0.5f;
+                const auto w0 = edge(v1, v2, px, py) / area, w1 = edge(v2, v0, px, py) / area;
+                const auto w2 = 1.0f - w0 - w1;
+                if (w0 < 0 || w1 < 0 || w2 < 0) continue;
+                const auto z = w0 * v0.z + w1 * v1.z + w2 * v2.z;
+                const auto i = size_t(y) * W + x;
+                if (z >= Depth[i]) continue;
+                const auto q0 = w0 / a.P.w, q1 = w1 / b.P.w, q2 = w2 / c.P.w;
+                const auto q = q0 + q1 + q2;
+                Depth[i] = z;
+                Color[i] = color;
+                U[i] = (q0 * a.U + q1 * b.U + q2 * c.U) / q;
+                V[i] = (q0 * a.V + q1 * b.V + q2 * c.V) / q;
+            }
+    }
+
+    // Draw meshes as seen from eye looking down -z, turned by yaw about the vertical axis then by
+    // pitch about the horizontal one
+    void DrawMeshes(const std::vector<MeshDesc>& meshes, const Float3& eye, float yaw,
+                    float pitch) {
+        const auto fov = FovTangents{1.0f, 1.0f, 1.0f, 1.0f};
+        const auto cy = std::cos(yaw), sy = std::sin(yaw), cp = std::cos(pitch),
+                   sp = std::sin(pitch);
+        for (const auto& mesh : meshes) {
+            auto clip = [&](const Vertex& v) {
+                const auto dx = v.Pos.x + mesh.Pos.x - eye.x, dy = v.Pos.y + mesh.Pos.y - eye.y,
+                           dz = v.Pos.z + mesh.Pos.z - eye.z;
+                const auto x = cy * dx - sy * dz, z = sy * dx + cy * dz;
+                const auto view = Float3{x, cp * dy + sp * z, -sp * dy + cp * z};
+                return ClipVertex{Project(fov, view), v.U, v.V};
+            };
+            const auto& t = mesh.Mesh;
+            for (size_t i = 0; i < t.Indices.size(); i += 3) {
+                const auto& v0 = t.Vertices[t.Indices[i]];
+                DrawTriangle(clip(v0), clip(t.Vertices[t.Indices[i + 1]]),
+                             clip(t.Vertices[t.Indices[i + 2]]), v0.C);
+            }
+        }
+    }
+};
+
+// Merging cuts the venue's triangles by more than half, leaves no T-junction that wasn't there
+// before, and renders the same pixels in the same colors with the same texture coordinates from
+// viewpoints all around the venue
+TEST(MergeCoplanarFacesRendersTheSame) {
+    const auto original = MergeTestScene();
+    auto merged = original;
+    const auto stats = MergeCoplanarFaces(merged);
+    CHECK(stats.TrianglesAfter * 2 < stats.TrianglesBefore);
+    CHECK(stats.EdgeVertices > 0);
+
+    const auto before = TJunctions(original), after = TJunctions(merged);
+    CHECK(std::includes(begin(before), end(before), begin(after), end(after)));
+
+    struct View {
+        Float3 Eye;
+        float Yaw, Pitch;
+    };
+    const View views[] = {{{4.3f, 1.6f, 6.7f}, 0.3f, -0.2f},   {{7.1f, 1.7f, 7.6f}, 0.7f, -0.5f},
+                          {{1.2f, 0.9f, 1.3f}, -2.4f, -0.1f},  {{4.1f, 4.3f, 10.3f}, 0.05f, -0.5f},
+                          {{6.8f, 2.7f, 2.1f}, 2.2f, -0.9f},   {{3.6f, 1.4f, -2.9f}, 3.0f, -0.15f},
+                          {{-3.2f, 2.1f, 4.4f}, -1.45f, -0.2f}};
+    for (const auto& view : views) {
+        auto a = ShadingRasterizer{240, 240}, b = ShadingRasterizer{240, 240};
+        a.DrawMeshes(original, view.Eye, view.Yaw, view.Pitch);
+        b.DrawMeshes(merged, view.Eye, view.Yaw, view.Pitch);
+        auto covered = size_t{0}, differ = size_t{0};
+        for (size_t i = 0; i < a.Depth.size(); ++i) {
+            const auto coveredA = a.Depth[i] < 1.0f, coveredB = b.Depth[i] < 1.0f;
+            covered += coveredA ? 1 : 0;
+            if (coveredA != coveredB ||
+                (coveredA && (a.Color[i] != b.Color[i] || std::fabs(a.U[i] - b.U[i]) > 1e-3f ||
+                              std::fabs(a.V[i] - b.V[i]) > 1e-3f)))
+                ++differ;
+        }
+        CHECK(covered > a.Depth.size() / 4);
+        CHECK(differ == 0);
+        if (differ) fprintf(stderr, "%zu of %zu pixels differ\n", differ, covered);
+    }
+}
+
+// Merging two tiles drops the corner where they met a side face that is still there, so the
+// merged top and bottom are split at that corner and keep their facing. The T-junctions the
+// neighbouring tiles in another mesh already made, at x = 0.5 and x = 1, are left as they were.
+TEST(MergeCoplanarFacesSplitsEdges) {
+    std::vector<MeshDesc> meshes(2);
+    for (auto& mesh : meshes) mesh.Mesh.BakeLighting = false;
+    meshes[0].Mesh.AddBox(0.0f, -0.1f, 0.0f, 1.0f, 0.0f, 1.0f, 0xff808080);
+    meshes[0].Mesh.AddBox(1.0f, -0.1f, 0.0f, 2.0f, 0.0f, 1.0f, 0xff808080);
+    meshes[1].Mesh.AddBox(0.0f, -0.1f, 1.0f, 0.5f, 0.0f, 2.0f, 0xff404040);
+    meshes[1].Mesh.AddBox(0.5f, -0.1f, 1.0f, 2.0f, 0.0f, 2.0f, 0xff202020);
+    RemoveHiddenFaces(meshes);
+    const auto before = TJunctions(meshes);
+    CHECK(before.size() == 4);
+    const auto stats = MergeCoplanarFaces(meshes);
+    CHECK(stats.EdgeVertices == 2);
+    CHECK(TJunctions(meshes) == before);
+    // The pair's top and bottom become pentagons of three triangles, its front one quad
+    CHECK(stats.TrianglesBefore - stats.TrianglesAfter == 1 + 1 + 2);
+    for (const auto& mesh : meshes)
+        for (size_t i = 0; i < mesh.Mesh.Indices.size(); i += 3) {
+            const auto& p0 = mesh.Mesh.Vertices[mesh.Mesh.Indices[i]].Pos;
+            const auto& p1 = mesh.Mesh.Vertices[mesh.Mesh.Indices[i + 1]].Pos;
+            const auto& p2 = mesh.Mesh.Vertices[mesh.Mesh.Indices[i + 2]].Pos;
+            // Top faces wind clockwise seen from above, bottom faces from below, whether split
+            // or not
+            if (p0.y == p1.y && p1.y == p2.y) {
+                const auto ny = (p1.z - p0.z) * (p2.x - p0.x) - (p1.x - p0.x) * (p2.z - p0.z);
+                CHECK(ny != 0.0f && (ny < 0.0f) == (p0.y == 0.0f));
+            }
+        }
+}
+
+// Every cluster lists, in light order, exactly the lights whose bounding box reaches its depth
+// slice and whose tangent space bounds over that box reach its tile, found by testing every light
+// against every cluster. Lights are spread through and around the frustum of a turned eye.
+TEST(LightClustersMatchBruteForce) {
+    const auto fov = FovTangents{1.3f, 1.4f, 1.1f, 1.2f};
+    auto clusters = LightClusters{fov};
+    auto random = std::mt19937{65};
+    auto uniform = [&random](float a, float b) {
+        return std::uniform_real_distribution<float>{a, b}(random);
+    };
+    const auto halfTurn = 0.35f;
+    const auto eye =
+        Pose{{3.0f, 1.6f, -2.0f}, {0.0f, std::sin(halfTurn), 0.0f, std::cos(halfTurn)}};
+    std::vector<PointLight> lights(1000);
+    for (auto& light : lights) {
+        const auto view = Float3{uniform(-60, 60), uniform(-40, 40), uniform(-110, 5)};
+        const auto offset = Rotate(eye.Rot, view);
+        light.Pos = {eye.Pos.x + offset.x, eye.Pos.y + offset.y, eye.Pos.z + offset.z};
+        light.Radius = uniform(0.2f, 8.0f);
+    }
+    clusters.Build(lights, eye);
+    CHECK(clusters.Dropped == 0);
+
+    // Brute force overlap of light i and cluster c, 1 inside, 0 outside and -1 when within rounding
+    // of a cluster boundary
+    const auto eps = 1e-4f;
+    auto overlap = [](float lo, float hi, float clusterLo, float clusterHi, float margin) {
+        return lo > clusterHi + margin || hi < clusterLo - margin   ? 0
+               : lo > clusterHi - margin || hi < clusterLo + margin ? -1
+                                                                     : 1;
+    };
+    auto expected = [&](size_t i, int c) {
+        const int tilesX = LightClusters::TilesX, tilesY = LightClusters::TilesY;
+        const auto x = c % tilesX, y = c / tilesX % tilesY, s = c / (tilesX * tilesY);
+        const auto pos = ToView(eye, lights[i].Pos);
+        const auto r = lights[i].Radius;
+        const auto zNear = std::max(-pos.z - r, clusters.Near);
+        const auto zFar = std::min(-pos.z + r, clusters.Far);
+        if (zNear > zFar) return 0;
+        const auto sliceNear = clusters.Near * std::exp(float(s) / clusters.SliceScale());
+        const auto sliceFar = s == LightClusters::Slices - 1
+                                  ? clusters.Far
+                                  : clusters.Near * std::exp(float(s + 1) / clusters.SliceScale());
+        const auto inDepth = overlap(zNear, zFar, sliceNear, sliceFar, eps * sliceNear);
+        // Tangents over all eight corners of the light's box, clamped to the depth range
+        auto tanLo = Float3{FLT_MAX, FLT_MAX, 0}, tanHi = Float3{-FLT_MAX, -FLT_MAX, 0};
+        for (auto corner = 0; corner < 8; ++corner) {
+            const auto cx = pos.x + (corner & 1 ? r : -r), cy = pos.y + (corner & 2 ? r : -r);
+            const auto z = corner & 4 ? zFar : zNear;
+            tanLo = {std::min(tanLo.x, cx / z), std::min(tanLo.y, cy / z), 0};
+            tanHi = {std::max(tanHi.x, cx / z), std::max(tanHi.y, cy / z), 0};
+        }
+        // The outermost tiles extend to infinity, lights beyond the fov edge land in them
+        const auto tileW = (fov.LeftTan + fov.RightTan) / tilesX;
+        const auto tileH = (fov.DownTan + fov.UpTan) / tilesY;
+        const auto x0 = x == 0 ? -FLT_MAX : -fov.LeftTan + x * tileW;
+        const auto x1 = x == tilesX - 1 ? FLT_MAX : -fov.LeftTan + (x + 1) * tileW;
+        const auto y0 = y == 0 ? -FLT_MAX : -fov.DownTan + y * tileH;
+        const auto y1 = y == tilesY - 1 ? FLT_MAX : -fov.DownTan + (y + 1) * tileH;
+        // Lights entirely outside the fov on one side are skipped rather than clamped
+        const auto inFov = overlap(tanLo.x, tanHi.x, -fov.LeftTan, fov.RightTan, eps) *
+                           overlap(tanLo.y, tanHi.y, -fov.DownTan, fov.UpTan, eps);
+        const auto inTile =
+            overlap(tanLo.x, tanHi.x, x0, x1, eps) * overlap(tanLo.y, tanHi.y, y0, y1, eps);
+        return inDepth * inFov * inTile;
+    };
+
+    auto offset = 0u, pairs = 0u, marginal = 0u;
+    for (auto c = 0; c < LightClusters::Count; ++c) {
+        const auto range = clusters.Ranges[c];
+        CHECK(range.Offset == offset);
+        offset += range.Count;
+        const auto first = clusters.Indices.begin() + range.Offset;
+        CHECK(std::is_sorted(first, first + range.Count));
+        CHECK(std::adjacent_find(first, first + range.Count) == first + range.Count);
+        for (auto i = size_t{0}; i < lights.size(); ++i) {
+            const auto listed = std::binary_search(first, first + range.Count, uint32_t(i));
+            const auto want = expected(i, c);
+            CHECK(want < 0 || listed == (want == 1));
+            pairs += want == 1 ? 1 : 0;
+            marginal += want < 0 ? 1 : 0;
+        }
+    }
+    CHECK(offset == clusters.Assigned);
+    CHECK(pairs <= clusters.Assigned && pairs + marginal >= clusters.Assigned);
+    CHECK(pairs > 5000 && marginal < pairs / 100);
+
+    // Lights that do not fit are dropped from the end of the index list, so the nearest clusters
+    // keep their complete lists
+    for (auto& light : lights) light.Radius *= 6.0f;
+    clusters.Build(lights, eye);
+    CHECK(clusters.Dropped > 0 && clusters.Assigned == LightClusters::IndexCapacity);
+    auto full = std::vector<unsigned>(LightClusters::Count, 0u);
+    for (const auto& b : clusters.LightBounds)
+        for (auto s = b.S0; s <= b.S1; ++s)
+            for (auto y = b.Y0; y <= b.Y1; ++y)
+                for (auto x = b.X0; x <= b.X1; ++x)
+                    ++full[(s * LightClusters::TilesY + y) * LightClusters::TilesX + x];
+    auto truncated = false;
+    auto total = size_t{0};
+    for (auto c = 0; c < LightClusters::Count; ++c) {
+        const auto count = clusters.Ranges[c].Count;
+        CHECK(truncated ? count == 0 : count <= full[c]);
+        truncated = truncated || count < full[c];
+        total += full[c];
+    }
+    CHECK(truncated && total == clusters.Assigned + clusters.Dropped);
+}
+
+// Distance along a ray to where it enters a box, clamped to 0 for an origin inside, or -1 for a
+// miss within tMax. Zero direction components are handled exactly rather than by a reciprocal.
+float RayBoxEntry(const Float3& o, const Float3& d, const TriangleSet::Box& b, float tMax) {
+    auto tNear = 0.0f, tFar = tMax;
+    for (auto axis = 0; axis < 3; ++axis) {
+        const auto oa = (&o.x)[axis], da = (&d.x)[axis];
+        const auto lo = (&b.Min.x)[axis], hi = (&b.Max.x)[axis];
+        if (da == 0.0f) {
+            if (oa < lo || oa > hi) return -1.0f;
+            continue;
+        }
+        const auto t1 = (lo - oa) / da, t2 = (hi - oa) / da;
+        tNear = std::max(tNear, std::min(t1, t2));
+        tFar = std::min(tFar, std::max(t1, t2));
+    }
+    return tNear <= tFar ? tNear : -1.0f;
+}
+
+// Closest hit of a ray over every box, -1 for a miss
+std::pair<float, uint32_t> ClosestBox(const std::vector<TriangleSet::Box>& boxes, const Float3& o,
+                                      const Float3& d, float tMax) {
+    auto res = std::make_pair(-1.0f, UINT32_MAX);
+    for (auto b = 0u; b < boxes.size(); ++b) {
+        const auto t = RayBoxEntry(o, d, boxes[b], tMax);
+        if (t >= 0.0f && (res.first < 0.0f || t < res.first)) res = {t, b};
+    }
+    return res;
+}
+
+// Packet traversal finds the closest box of every ray and occlusion queries agree with testing
+// every box, for random boxes and rays including axis aligned ones and origins inside boxes
+TEST(BoxBvhMatchesBruteForce) {
+    auto random = std::mt19937{67};
+    auto uniform = [&random](float a, float b) {
+        return std::uniform_real_distribution<float>{a, b}(random);
+    };
+    std::vector<TriangleSet::Box> boxes(300);
+    for (auto& b : boxes) {
+        b.Min = {uniform(-10, 10), uniform(-10, 10), uniform(-10, 10)};
+        b.Max = Add(b.Min, {uniform(0.1f, 2), uniform(0.1f, 2), uniform(0.1f, 2)});
+    }
+    const auto bvh = BoxBvh{boxes};
+    auto randomRay = [&](int i, Float3& o, Float3& d) {
+        o = {uniform(-12, 12), uniform(-12, 12), uniform(-12, 12)};
+        d = Normalize({uniform(-1, 1), uniform(-1, 1), uniform(-1, 1)});
+        if (i % 4 == 0) d = i % 8 ? Float3{0, 0, -1} : Float3{1, 0, 0};
+    };
+    auto hits = 0, misses = 0, occluded = 0;
+    for (auto p = 0; p < 500; ++p) {
+        auto packet = BoxBvh::RayPacket{};
+        Float3 origins[4], dirs[4];
+        for (auto lane = 0; lane < 4; ++lane) {
+            randomRay(p * 4 + lane, origins[lane], dirs[lane]);
+            for (auto axis = 0; axis < 3; ++axis) {
+                packet.Origin[axis][lane] = (&origins[lane].x)[axis];
+                packet.InvDir[axis][lane] = BoxBvh::SafeReciprocal((&dirs[lane].x)[axis]);
+            }
+            packet.TMax[lane] = 100.0f;
+            packet.Box[lane] = UINT32_MAX;
+        }
+        bvh.Intersect(packet);
+        for (auto lane = 0; lane < 4; ++lane) {
+            const auto expected = ClosestBox(boxes, origins[lane], dirs[lane], 100.0f);
+            if (expected.first < 0.0f) {
+                CHECK(packet.Box[lane] == UINT32_MAX);
+                ++misses;
+                continue;
+            }
+            ++hits;
+            CHECK(packet.Box[lane] != UINT32_MAX);
+            if (packet.Box[lane] == UINT32_MAX) continue;
+            // Boxes entered at the same distance are equally right
+            const auto tolerance = 1e-4f * (1.0f + expected.first);
+            CHECK(std::abs(packet.TMax[lane] - expected.first) <= tolerance);
+            const auto t = RayBoxEntry(origins[lane], dirs[lane], boxes[packet.Box[lane]], 100.0f);
+            CHECK(std::abs(t - expected.first) <= tolerance);
+        }
+
+        Float3 o, d;
+        randomRay(p, o, d);
+        const auto tMax = uniform(0.5f, 20.0f);
+        const auto expected = ClosestBox(boxes, o, d, 100.0f).first;
+        if (expected >= 0.0f && std::abs(expected - tMax) < 1e-3f) continue;
+        const auto blocked = expected >= 0.0f && expected <= tMax;
+        CHECK(bvh.Occluded(BoxBvh::MakeRay(o, d, tMax)) == blocked);
+        occluded += blocked ? 1 : 0;
+    }
+    CHECK(hits > 200 && misses > 200 && occluded > 50 && occluded < 450);
+    CHECK(!BoxBvh{{}}.Occluded(BoxBvh::MakeRay({0, 0, 0}, {0, 0, -1}, 10.0f)));
+}
+
+// The default room seen from a turned eye has every pixel of the closest box found by testing
+// each pixel's ray against every box, shaded by RayCaster::Shade and stored without any transfer
+// function, as the UNORM views of the sRGB eye buffers do
+TEST(RayCasterMatchesBruteForce) {
+    const auto meshes = CreateRoomMeshes();
+    const auto caster = RayCaster{meshes};
+    std::vector<RayCaster::BoxRef> refs;
+    const auto boxes = RayCaster::CollectBoxes(meshes, refs);
+    const auto w = 96, h = 64;
+    const auto fov = FovTangents{0.6f, 0.8f, 1.1f, 0.9f};
+    const auto halfTurn = -0.2f;
+    const auto eye =
+        Pose{{0.5f, 1.6f, 4.0f}, {0.0f, std::sin(halfTurn), 0.0f, std::cos(halfTurn)}};
+    const auto image = caster.Render(eye, fov, w, h, 3);
+    CHECK(image.size() == size_t(w) * h);
+    auto unorm = [](float c) {
+        return uint32_t(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+    };
+    auto wrong = 0, background = 0;
+    for (auto y = 0; y < h; ++y)
+        for (auto x = 0; x < w; ++x) {
+            const auto tanX = -fov.LeftTan + (fov.LeftTan + fov.RightTan) * (x + 0.5f) / float(w);
+            const auto tanY = fov.UpTan - (fov.UpTan + fov.DownTan) * (y + 0.5f) / float(h);
+            const auto dir = Rotate(eye.Rot, {tanX, tanY, -1.0f});
+            const auto hit = ClosestBox(boxes, eye.Pos, dir, 1000.0f);
+            auto expected = 0xff000000u;
+            if (hit.first >= 0.0f) {
+                const auto color = caster.Shade(Add(eye.Pos, Scale(dir, hit.first)), hit.second);
+                expected |= unorm(color.x) << 16 | unorm(color.y) << 8 | unorm(color.z);
+            } else {
+                ++background;
+            }
+            const auto pixel = image[size_t(y) * w + x];
+            auto close = true;
+            for (auto shift = 0; shift < 32; shift += 8)
+                close = close && std::abs(int((pixel >> shift) & 0xff) -
+                                          int((expected >> shift) & 0xff)) <= 1;
+            wrong += close ? 0 : 1;
+        }
+    // Pixels exactly on an edge between boxes may go either way
+    CHECK(wrong <= w * h / 200);
+    CHECK(background > 0 && background < w * h / 2);
+}
+
+// A 4x4 grid gets a cell per room. Every static box lands in exactly one detail mesh and inside a
+// slab of its cell's proxy, which has fewer triangles than the cell's detail. Nearby cells keep
+// their detail, distant ones switch to proxies. In a single cell of floor tiles, a wall with a
+// doorway and three small cubes, the tiles and the wall pieces each collapse to one slab and the
+// cubes to one block per 2m.
+TEST(HlodProxiesCoverDetail) {
+    auto meshes = CreateRoomGrid(4, false);
+    auto boxes = size_t{0};
+    for (const auto& mesh : meshes)
+        if (!mesh.Dynamic)
+            boxes += size_t(std::count_if(begin(mesh.Mesh.Boxes), end(mesh.Mesh.Boxes),
+                                          [](const TriangleSet::Box& b) { return !b.Empty(); }));
+    auto hlod = Hlod{};
+    hlod.Build(meshes);
+    CHECK(hlod.Clusters.size() == 16 && meshes[0].Dynamic);
+    const auto firstProxy = meshes.size();
+    hlod.AppendProxies(meshes);
+    CHECK(meshes.size() == firstProxy + 16);
+
+    auto detailBoxes = size_t{0};
+    std::vector<int> owners(firstProxy, 0);
+    for (const auto& cluster : hlod.Clusters) {
+        CHECK(cluster.Proxy >= firstProxy && cluster.Radius > 4.0f);
+        const auto& proxy = meshes[cluster.Proxy].Mesh;
+        auto detailTriangles = size_t{0};
+        for (auto m : cluster.Detail) {
+            ++owners[m];
+            const auto& mesh = meshes[m];
+            detailTriangles += mesh.Mesh.Indices.size() / 3;
+            for (const auto& b : mesh.Mesh.Boxes) {
+                ++detailBoxes;
+                const auto mn = Add(b.Min, mesh.Pos), mx = Add(b.Max, mesh.Pos);
+                auto inside = [&mn, &mx](const TriangleSet::Box& s) {
+                    return mn.x >= s.Min.x && mn.y >= s.Min.y && mn.z >= s.Min.z &&
+                           mx.x <= s.Max.x && mx.y <= s.Max.y && mx.z <= s.Max.z;
+                };
+                const auto covered = std::any_of(begin(proxy.Boxes), end(proxy.Boxes), inside);
+                CHECK(covered);
+            }
+        }
+        const auto proxyTriangles = proxy.Indices.size() / 3;
+        CHECK(proxyTriangles == 12 * proxy.Boxes.size());
+        CHECK(proxyTriangles > 0 && proxyTriangles < detailTriangles);
+    }
+    CHECK(detailBoxes == boxes);
+    CHECK(std::count(begin(owners) + 1, end(owners), 1) == ptrdiff_t(firstProxy - 1));
+
+    std::vector<bool> visible(meshes.size(), true);
+    const auto eye = Float3{0.0f, 1.6f, 2.0f};  // In room (0, 0)
+    const auto proxies = hlod.Select(visible, eye, 800.0f, 400.0f);
+    CHECK(proxies > 0 && proxies < 16);
+    for (const auto& cluster : hlod.Clusters) {
+        const auto near = Length(Subtract(cluster.Center, eye)) <= cluster.Radius;
+        CHECK(near ? !visible[cluster.Proxy] : true);
+        for (auto m : cluster.Detail) CHECK(visible[m] != visible[cluster.Proxy]);
+    }
+    CHECK(hlod.Select(visible, {0.0f, 1.6f, 2000.0f}, 800.0f, 400.0f) == 16);
+
+    TriangleSet room;
+    room.BakeLighting = false;
+    for (auto x = 0.0f; x < 2.0f; x += 1.0f)
+        for (auto z = 0.0f; z < 2.0f; z += 1.0f)
+            room.AddBox(x, -0.1f, z, x + 1, 0.0f, z + 1, 0xff808080);
+    room.AddBox(0.0f, 0.0f, -0.1f, 0.8f, 2.5f, 0.0f, 0xff808080);  // Wall left of the doorway
+    room.AddBox(1.2f, 0.0f, -0.1f, 2.0f, 2.5f, 0.0f, 0xff808080);  // Right of the doorway
+    room.AddBox(0.8f, 2.0f, -0.1f, 1.2f, 2.5f, 0.0f, 0xff808080);  // Lintel
+    room.AddBox(0.4f, 0.0f, 0.4f, 0.6f, 0.2f, 0.6f, 0xff808080);
+    room.AddBox(0.8f, 0.0f, 0.6f, 1.0f, 0.2f, 0.8f, 0xff808080);
+    room.AddBox(3.4f, 0.0f, 0.4f, 3.6f, 0.2f, 0.6f, 0xff808080);  // In the next 2m block
+    std::vector<MeshDesc> single = {{room, {0, 0, 0}, TextureFill::AUTO_WHITE}};
+    auto singleHlod = Hlod{};
+    singleHlod.Build(single);
+    singleHlod.AppendProxies(single);
+    CHECK(single.size() == 2 && singleHlod.Clusters.size() == 1);
+    CHECK(single[0].Mesh.Indices.size() / 3 == 10 * 12);
+    CHECK(single[1].Mesh.Indices.size() / 3 == 4 * 12);
+}
+
+// Quaternion product, applying b then a
+Float4 Multiply(const Float4& a, const Float4& b) {
+    return {a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+            a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+            a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+            a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
+}
+
+// Portal traversal is conservative: from random eyes in the default room and in room grids,
+// every cell that rays through the fov pass through before hitting a box is marked visible. Most
+// cells of the larger grids are culled, and an eye inside a wall marks every cell.
+TEST(CellGraphContainsRayVisibility) {
+    const auto fov = FovTangents{1.2f, 1.3f, 1.1f, 1.0f};
+    auto random = std::mt19937{69};
+    auto uniform = [&random](float a, float b) {
+        return std::uniform_real_distribution<float>{a, b}(random);
+    };
+    for (auto rooms : {0, 3, 5}) {
+        auto cells = CellGraph{};
+        const auto meshes = rooms ? CreateRoomGrid(rooms, false, &cells)
+                                  : CreateRoomMeshes(false, &cells);
+        cells.AssignMeshes(meshes);
+        const auto boxes = StaticBoxes(meshes);
+        auto missed = 0, seen = 0;
+        auto visibleCells = size_t{0};
+        const auto eyes = 60;
+        for (auto e = 0; e < eyes; ++e) {
+            const auto& cell = cells.Cells[random() % cells.Cells.size()];
+            const auto pos =
+                Float3{uniform(cell.Min.x + 0.3f, cell.Max.x - 0.3f), uniform(0.3f, 3.7f),
+                       uniform(cell.Min.z + 0.3f, cell.Max.z - 0.3f)};
+            const auto yaw = uniform(-Pi, Pi) / 2, pitch = uniform(-0.6f, 0.6f) / 2;
+            const auto eye = Pose{pos, Multiply({0.0f, std::sin(yaw), 0.0f, std::cos(yaw)},
+                                                {std::sin(pitch), 0.0f, 0.0f, std::cos(pitch)})};
+            CHECK(cells.Traverse(eye, fov));
+            visibleCells +=
+                size_t(std::count(begin(cells.VisibleCells), end(cells.VisibleCells), true));
+            for (auto r = 0; r < 40; ++r) {
+                const auto tanX = uniform(-fov.LeftTan, fov.RightTan);
+                const auto tanY = uniform(-fov.DownTan, fov.UpTan);
+                const auto dir = Normalize(Rotate(eye.Rot, {tanX, tanY, -1.0f}));
+                const auto hit = ClosestBox(boxes, eye.Pos, dir, 200.0f).first;
+                for (auto t = 0.02f; t < hit; t += 0.1f) {
+                    const auto c = cells.Locate(Add(eye.Pos, Scale(dir, t)));
+                    if (c < 0) continue;
+                    ++seen;
+                    missed += cells.VisibleCells[size_t(c)] ? 0 : 1;
+                }
+            }
+        }
+        CHECK(missed == 0 && seen > 10000);
+        const auto total = cells.Cells.size();
+        CHECK(rooms < 5 || visibleCells < eyes * total / 3);
+    }
+
+    auto cells = CellGraph{};
+    cells.AssignMeshes(CreateRoomGrid(2, false, &cells));
+    const auto inWall = Pose{{-4.05f, 1.6f, 2.0f}, {0.0f, 0.0f, 0.0f, 1.0f}};
+    CHECK(!cells.Traverse(inWall, fov));
+    CHECK(std::count(begin(cells.VisibleCells), end(cells.VisibleCells), true) == 4);
+}
+
+// A baked file maps back with every cell's set as baked, a second load maps the cache without
+// baking, and a cache for other geometry or a truncated one is rejected. Standing in the first row
+// of a 3x3 grid hides some other row's meshes but never the dynamic cube.
+TEST(PvsRoundTripsThroughMappedFile) {
+    const auto meshes = CreateRoomGrid(3, false);
+    const auto path = "pvs_test.bin";
+    remove(path);
+    Pvs baked;
+    const auto contents = baked.Bake(meshes, 2);
+    auto header = Pvs::Header{};
+    memcpy(&header, contents.data(), sizeof(header));
+    CHECK(header.CellsX >= 6 && header.CellsZ >= 6 && header.Models == meshes.size());
+    CHECK(header.Rows > 1 && header.Rows < header.CellsX * header.CellsZ);
+
+    Pvs pvs;
+    CHECK(pvs.Load(meshes, path) && pvs.BakeSeconds > 0.0);
+    CHECK(pvs.Bytes == contents.size() * sizeof(uint32_t));
+    Pvs cached;
+    CHECK(cached.Load(meshes, path) && cached.BakeSeconds == 0.0);
+    const auto rowOfCell = contents.data() + sizeof(header) / sizeof(uint32_t);
+    const auto cells = size_t(header.CellsX) * header.CellsZ;
+    auto hiding = 0;
+    for (auto cell = size_t{0}; cell < cells; ++cell) {
+        const auto expected = rowOfCell + cells + size_t(rowOfCell[cell]) * header.Words;
+        const auto center =
+            Float3{header.OriginX + (float(cell % header.CellsX) + 0.5f) * Pvs::CellSize, 1.6f,
+                   header.OriginZ + (float(cell / header.CellsX) + 0.5f) * Pvs::CellSize};
+        const auto row = cached.Lookup(center);
+        CHECK(row && std::equal(expected, expected + header.Words, row));
+        std::vector<bool> visible(meshes.size(), true);
+        hiding += cached.Cull(center, visible) ? 1 : 0;
+        CHECK(visible[0]);
+    }
+    CHECK(hiding > 0);
+    CHECK(!cached.Lookup({header.OriginX - 1.0f, 1.6f, header.OriginZ}));
+
+    Pvs stale;
+    CHECK(!stale.Map(path, Pvs::Key(meshes) + 1) && !stale.Mapped);
+    if (const auto file = OpenFile(path, "wb")) {
+        fwrite(contents.data(), sizeof(uint32_t), contents.size() - 1, file);
+        fclose(file);
+    }
+    CHECK(!stale.Map(path, Pvs::Key(meshes)));
+    remove(path);
+}
+
+// Key events come out in order with their queue time, and a full ring drops new events
+TEST(KeyEventQueueOrderAndOverflow) {
+    KeyEventQueue queue;
+    auto keyboard = KeyboardState{};
+    queue.Push({1.0, 'A', true});
+    queue.Push({1.5, 'B', true});
+    queue.Push({2.0, 'A', false});
+    queue.Push({2.5, 0x1a4, true});  // Wraps to 0xa4 like the 256 entry key table
+    keyboard.Drain(queue, 3.0);
+    CHECK(keyboard.Events == 4);
+    CHECK(std::abs(keyboard.Latency - 5.0) < 1e-9);
+    CHECK(!keyboard.Keys['A'] && keyboard.Keys['B'] && keyboard.Keys[0xa4]);
+    keyboard.Drain(queue, 4.0);
+    CHECK(keyboard.Events == 0 && keyboard.Latency == 0.0);
+
+    for (auto i = 0u; i < 300; ++i) queue.Push({double(i), unsigned(i % 2 ? 'C' : 'D'), i < 256});
+    CHECK(queue.Dropped == 300 - 256);
+    auto last = KeyEvent{};
+    auto count = 0u, ordered = 0u;
+    while (queue.Poll(last)) ordered += last.Time == double(count++) ? 1 : 0;
+    CHECK(count == 256 && ordered == 256);
+}
+
+// Key state rebuilt on one thread from events pushed on another matches the pushing side's
+TEST(KeyboardStateAcrossThreads) {
+    KeyEventQueue queue;
+    auto keyboard = KeyboardState{};
+    auto expected = KeyboardState{};
+    const auto total = 100000u;
+    std::thread producer{[&queue, &expected] {
+        auto rng = std::mt19937{7};
+        for (auto i = 0u; i < total; ++i) {
+            const auto event = KeyEvent{double(i), unsigned(rng() % 16), rng() % 2 == 0};
+            // Wait for room rather than drop, so the final state is known
+            while (queue.Ring.Tail - queue.Ring.Head.load() == queue.Ring.Items.size())
+                std::this_thread::yield();
+            expected.Apply(event);
+            queue.Push(event);
+        }
+    }};
+    auto applied = size_t{0};
+    while (applied < total) {
+        keyboard.Drain(queue, double(total));
+        applied += keyboard.Events;
+    }
+    producer.join();
+    CHECK(applied == total && queue.Dropped == 0);
+    CHECK(std::equal(std::begin(keyboard.Keys), std::end(keyboard.Keys),
+                     std::begin(expected.Keys)));
+}
+
+// A reader polling the ring while it is written only ever accepts whole records, checked by
+// deriving every counter from the frame number
+TEST(TelemetryReadsAreNeverTorn) {
+    std::vector<uint64_t> memory(Telemetry::Bytes() / sizeof(uint64_t));
+    Telemetry writer, reader;
+    CHECK(writer.Attach(memory.data(), true) && reader.Attach(memory.data(), false));
+    auto counters = [](unsigned long long n) {
+        const auto t = double(n);
+        return Telemetry::Counters{n, t, t + 1.0, t + 2.0, t + 3.0, t + 4.0,
+                                   uint32_t(n), uint32_t(~n), uint32_t(n * 3), uint32_t(n >> 3)};
+    };
+    const auto total = 200000u;
+    std::thread producer{[&writer, &counters] {
+        for (auto n = 0u; n < total; ++n) writer.Publish(counters(n));
+    }};
+    auto read = 0u, torn = 0u;
+    for (auto done = false; !done;) {
+        done = writer.Mapped->Written.load() == total;
+        // The oldest records are the ones being overwritten
+        const auto written = reader.Mapped->Written.load(std::memory_order_acquire);
+        const auto oldest = written > Telemetry::Capacity ? written - Telemetry::Capacity : 0;
+        for (auto n = oldest; n < std::min(written, oldest + 16); ++n) {
+            auto c = Telemetry::Counters{};
+            if (!reader.Read(n, c)) continue;
+            const auto expected = counters(n);
+            ++read;
+            torn += memcmp(&c, &expected, sizeof(c)) != 0 ? 1 : 0;
+        }
+    }
+    producer.join();
+    CHECK(read > 0 && torn == 0);
+    auto last = Telemetry::Counters{};
+    CHECK(reader.Read(total - 1, last) && last.Frame == total - 1);
+    CHECK(!reader.Read(total - 1 - Telemetry::Capacity, last));
+
+    // A ring with another layout is refused
+    memory[0] ^= 1;
+    CHECK(!reader.Attach(memory.data(), false));
+}
+
+// Pixels of an 8 bit RGB PNG as 0x00RRGGBB, decoded independently of the encoder: chunk CRCs are
+// checked bit by bit and the zlib stream must be fixed Huffman blocks. Empty if anything is wrong.
+std::vector<uint32_t> DecodePng(const std::vector<unsigned char>& png, int w, int h) {
+    auto be32 = [&png](size_t at) {
+        return uint32_t(png[at]) << 24 | uint32_t(png[at + 1]) << 16 | uint32_t(png[at + 2]) << 8 |
+               png[at + 3];
+    };
+    const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (png.size() < 8 || memcmp(png.data(), signature, 8) != 0) return {};
+    std::vector<unsigned char> z;
+    auto header = false, ended = false;
+    for (auto at = size_t{8}; at + 12 <= png.size() && !ended;) {
+        const auto length = be32(at);
+        if (at + 12 + length > png.size()) return {};
+        auto crc = ~0u;
+        for (auto i = at + 4; i < at + 8 + length; ++i) {
+            crc ^= png[i];
+            for (auto k = 0; k < 8; ++k) crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+        }
+        if (~crc != be32(at + 8 + length)) return {};
+        const auto type = std::string(png.begin() + long(at) + 4, png.begin() + long(at) + 8);
+        const auto data = png.begin() + long(at) + 8;
+        if (type == "IHDR")
+            header = length == 13 && be32(at + 8) == uint32_t(w) && be32(at + 12) == uint32_t(h) &&
+                     std::equal(data + 8, data + 13, std::begin({8, 2, 0, 0, 0}));
+        if (type == "IDAT") z.insert(z.end(), data, data + length);
+        ended = type == "IEND";
+        at += 12 + length;
+    }
+    if (!header || !ended || z.size() < 6 || (z[0] << 8 | z[1]) % 31 || (z[0] & 0x0f) != 8)
+        return {};
+
+    // Inflate
+    auto bit = size_t{16};
+    auto get = [&z, &bit](int n) {
+        auto res = 0u;
+        for (auto i = 0; i < n; ++i, ++bit)
+            res |= bit / 8 < z.size() ? ((z[bit / 8] >> (bit % 8)) & 1u) << i : 0u;
+        return res;
+    };
+    auto code = [&get](int n, unsigned start) {  // Huffman codes are read MSB first
+        for (auto i = 0; i < n; ++i) start = start << 1 | get(1);
+        return start;
+    };
+    std::vector<unsigned char> raw;
+    for (auto last = 0u; !last;) {
+        last = get(1);
+        if (get(2) != 1) return {};
+        for (;;) {
+            auto sym = code(7, 0);
+            if (sym <= 0x17) {
+                sym += 256;
+            } else {
+                sym = code(1, sym);
+                if (sym >= 0x30 && sym <= 0xbf)
+                    sym -= 0x30;
+                else if (sym >= 0xc0 && sym <= 0xc7)
+                    sym = sym - 0xc0 + 280;
+                else
+                    sym = code(1, sym) - 0x190 + 144;
+            }
+            if (sym < 256) {
+                raw.push_back(static_cast<unsigned char>(sym));
+                continue;
+            }
+            if (sym == 256) break;
+            // Lengths and distances from their base and extra bit counts per RFC 1951
+            const auto l = sym - 257;
+            const auto lengthExtra = l < 8 || l == 28 ? 0u : l / 4 - 1;
+            const auto lengthBase =
+                l < 8 ? 3 + l : l == 28 ? 258u : ((4 + l % 4) << lengthExtra) + 3;
+            const auto length = lengthBase + get(int(lengthExtra));
+            const auto d = code(5, 0);
+            if (d >= 30) return {};
+            const auto distanceExtra = d < 4 ? 0u : d / 2 - 1;
+            const auto distance =
+                d < 4 ? d + 1 : ((2 + d % 2) << distanceExtra) + 1 + get(int(distanceExtra));
+            if (distance > raw.size()) return {};
+            for (auto i = 0u; i < length; ++i) raw.push_back(raw[raw.size() - distance]);
+        }
+    }
+    if (bit > 8 * z.size()) return {};
+
+    // Adler-32 after the last whole byte, then undo the row filters
+    const auto at = (bit + 7) / 8;
+    auto a = 1u, b = 0u;
+    for (auto c : raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    if (at + 4 != z.size() || raw.size() != size_t(h) * (1 + 3 * size_t(w))) return {};
+    auto adler = 0u;
+    for (auto i = at; i < at + 4; ++i) adler = adler << 8 | z[i];
+    if (adler != (b << 16 | a)) return {};
+    std::vector<uint32_t> pixels;
+    for (auto y = 0; y < h; ++y) {
+        auto row = raw.begin() + long(y) * (1 + 3 * w);
+        const auto filter = *row++;
+        if (filter > 1) return {};
+        if (filter == 1)
+            for (auto x = 3; x < 3 * w; ++x)
+                row[x] = static_cast<unsigned char>(row[x] + row[x - 3]);
+        for (auto x = 0; x < w; ++x)
+            pixels.push_back(uint32_t(row[3 * x]) << 16 | uint32_t(row[3 * x + 1]) << 8 |
+                             row[3 * x + 2]);
+    }
+    return pixels;
+}
+
+// Encoded images decode to the same pixels, for flat, repeating and noisy content with matches at
+// every length and distance the encoder can find
+TEST(PngRoundTrips) {
+    auto rng = std::mt19937{3};
+    auto roundTrips = [](const std::vector<uint32_t>& pixels, int w, int h) {
+        auto rgb = pixels;
+        for (auto& p : rgb) p &= 0xffffff;
+        return DecodePng(EncodePng(pixels, w, h), w, h) == rgb;
+    };
+    CHECK(roundTrips({0xff123456}, 1, 1));
+    std::vector<uint32_t> pixels(size_t(333) * 200);
+    for (auto y = 0; y < 200; ++y)
+        for (auto x = 0; x < 333; ++x)
+            pixels[size_t(y) * 333 + x] = y < 50    ? 0xff404040                        // Flat
+                                          : y < 100 ? uint32_t(x / 7 * 0x010203 + y)    // Bands
+                                          : y < 150 ? uint32_t(rng())                   // Noise
+                                                    : pixels[size_t(y - 50) * 333 + x];  // Repeat
+    CHECK(roundTrips(pixels, 333, 200));
+    CHECK(EncodePng(pixels, 333, 200).size() < pixels.size() * 3 * 3 / 4);
+    CHECK(!roundTrips(pixels, 333, 199));  // The decoder does check
+}
+
+// Captures encode in order on the workers, and a capture is dropped instead of waited for when its
+// slot is still busy or too small
+TEST(CaptureQueueSlots) {
+    {
+        CaptureQueue queue{2, 16, 2, 0};  // No workers, so retired slots stay busy
+        CHECK(queue.Issue(0, 4, 4, "") == 0);
+        CHECK(queue.Issue(1, 4, 5, "") == -1 && queue.Dropped == 1);
+        CHECK(queue.Issue(1, 2, 2, "") == 1);
+        CHECK(queue.Oldest(1) == -1 && queue.Oldest(2) == 0);
+        queue.Retire();
+        CHECK(queue.Oldest(2) == -1 && queue.Oldest(3) == 1);
+        queue.Retire();
+        CHECK(queue.Oldest(10) == -1);
+        CHECK(queue.Issue(2, 1, 1, "") == -1 && queue.Dropped == 2);
+    }
+
+    const auto w = 37, h = 23;
+    const auto count = 6u;
+    CaptureQueue queue{count, size_t(w) * h, 0, 2};
+    for (auto i = 0u; i < count; ++i) {
+        const auto slot = queue.Issue(i, w, h, i == 0 ? "/no/such/directory/capture.png" : "");
+        CHECK(slot == int(i));
+        if (slot < 0) continue;
+        auto& pixels = queue.Slots[size_t(slot)].Pixels;
+        for (auto p = 0u; p < unsigned(w * h); ++p)
+            pixels.push_back(0xff000000u | (p * 2654435761u + i));
+        queue.Retire();
+    }
+    for (auto i = 0u; i < count; ++i)
+        while (queue.Slots[i].Busy.load(std::memory_order_acquire)) std::this_thread::yield();
+    {
+        std::lock_guard<std::mutex> lock{queue.Lock};
+        CHECK(queue.Written == count - 1 && queue.Failed == 1 && queue.Dropped == 0);
+    }
+    for (auto i = 1u; i < count; ++i) {
+        // Read back as R8G8B8A8, so red is the low byte
+        auto expected = std::vector<uint32_t>{};
+        for (auto p = 0u; p < unsigned(w * h); ++p) {
+            const auto v = p * 2654435761u + i;
+            expected.push_back((v & 0xff) << 16 | (v & 0xff00) | ((v >> 16) & 0xff));
+        }
+        CHECK(DecodePng(queue.Slots[i].Png, w, h) == expected);
+    }
+}
+
+int main(int argc, char** argv) {
+    auto run = 0;
+    for (const auto& test : Tests()) {
+        auto selected = argc < 2;
+        for (auto i = 1; i < argc; ++i) selected = selected || strcmp(argv[i], test.Name) == 0;
+        if (!selected) continue;
+        const auto failures = Failures;
+        test.Run();
+        printf("%s %s\n", Failures == failures ? "passed" : "FAILED", test.Name);
+        ++run;
+    }
+    if (!run) fprintf(stderr, "No tests matched\n");
+    return Failures || !run ? 1 : 0;
+}
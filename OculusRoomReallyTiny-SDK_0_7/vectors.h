@@ -0,0 +1,60 @@
+// Plain float vectors for the CPU code shared with the tests. On Windows these are the DirectXMath
+// storage types so the app loads and stores them directly, elsewhere they are equivalent structs.
+#pragma once
+
+#include <cmath>
+
+#ifdef _WIN32
+#include <DirectXMath.h>
+using Float3 = DirectX::XMFLOAT3;
+using Float4 = DirectX::XMFLOAT4;
+#else
+struct Float3 {
+    float x, y, z;
+};
+struct Float4 {
+    float x, y, z, w;
+};
+#endif
+
+const float Pi = 3.141592654f;
+
+// Float3 arithmetic for the CPU code, DirectXMath vectors are only used in the app itself
+inline Float3 Add(const Float3& a, const Float3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Float3 Subtract(const Float3& a, const Float3& b) {
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+inline Float3 Scale(const Float3& v, float s) { return {v.x * s, v.y * s, v.z * s}; }
+inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Float3 Cross(const Float3& a, const Float3& b) {
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+inline float Length(const Float3& v) { return std::sqrt(Dot(v, v)); }
+inline Float3 Normalize(const Float3& v) { return Scale(v, 1.0f / Length(v)); }
+
+// Tangents of the half angles of an eye fov, laid out like ovrFovPort
+struct FovTangents {
+    float UpTan, DownTan, LeftTan, RightTan;
+};
+
+// Position and orientation quaternion (x, y, z, w) of a camera or eye. Its view space looks down -z
+// with y up, as the app's view matrices do.
+struct Pose {
+    Float3 Pos;
+    Float4 Rot;
+};
+
+// Rotate v by the unit quaternion q
+inline Float3 Rotate(const Float4& q, const Float3& v) {
+    const auto tx = 2.0f * (q.y * v.z - q.z * v.y), ty = 2.0f * (q.z * v.x - q.x * v.z),
+               tz = 2.0f * (q.x * v.y - q.y * v.x);
+    return {v.x + q.w * tx + q.y * tz - q.z * ty, v.y + q.w * ty + q.z * tx - q.x * tz,
+            v.z + q.w * tz + q.x * ty - q.y * tx};
+}
+
+// World space point to the view space of pose
+inline Float3 ToView(const Pose& pose, const Float3& p) {
+    const auto& q = pose.Rot;
+    return Rotate({-q.x, -q.y, -q.z, q.w},
+                  {p.x - pose.Pos.x, p.y - pose.Pos.y, p.z - pose.Pos.z});
+}